@@ -0,0 +1,141 @@
+#include "simulation.h"
+#include "snapshot.h"
+#include "histogram.h"
+#include "util.h"
+#include <functional>
+
+
+// Times every phase of the server tick separately on synthetic worlds and
+// writes one CSV row per phase and configuration to a file. The phases run on
+// the given number of threads, one by default.
+
+struct Config {
+    int players;
+    int bullets;
+    int npcs;
+    float blocks; // Per world chunk
+    const char* density;
+    float extent; // Entities are spread over [-extent, extent]
+};
+
+Simulation makeSimulation(const Config& config, uint32_t seed) {
+    Simulation sim{60, seed, World{World::Params{seed, config.blocks}}};
+    std::mt19937 mt{seed};
+    std::uniform_real_distribution<float> pos(-config.extent, config.extent);
+    std::uniform_real_distribution<float> dir(-1.f, 1.f);
+
+    for (int i = 0; i < config.players; ++i) {
+        Player& p = sim.addPlayer();
+        p.pos = {pos(mt), pos(mt)};
+        p.velo = proto::playerSpeed * Vec2{dir(mt), dir(mt)};
+        p.target = p.pos + Vec2{dir(mt), dir(mt)};
+    }
+
+    std::uniform_int_distribution<size_t> shooter(0, sim.players.size() - 1);
+    for (int i = 0; i < config.bullets; ++i) {
+        const Player& p = sim.players[shooter(mt)];
+        const Vec2 velo = proto::bulletSpeed * unit(Vec2{dir(mt), dir(mt)});
+        sim.bullets.push_back(Bullet{{{pos(mt), pos(mt)}, velo, p.id, proto::ID(i + 1)}, sim.tick + 60});
+    }
+
+    for (int i = 0; i < config.npcs; ++i) {
+        sim.npcs.push_back(Npc{{proto::ID(config.bullets + i + 1), {pos(mt), pos(mt)}, {0, 0}}});
+    }
+
+    sim.loadChunks();
+
+    return sim;
+}
+
+// Runs phase on a fresh copy of the entities every iteration, only the phase
+// itself is timed
+Histogram measure(Simulation& sim, int iterations, const std::function<void(Simulation&)>& phase) {
+    const auto players = sim.players;
+    const auto bullets = sim.bullets;
+    const auto npcs = sim.npcs;
+
+    Histogram h;
+    for (int i = 0; i < iterations; ++i) {
+        sim.players = players;
+        sim.bullets = bullets;
+        sim.npcs = npcs;
+        sim.events.clear();
+
+        const auto t0 = Clock::now();
+        phase(sim);
+        const auto t1 = Clock::now();
+        h.record(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count());
+    }
+
+    sim.players = players;
+    sim.bullets = bullets;
+    sim.npcs = npcs;
+    return h;
+}
+
+int main(int argc, char** argv) {
+    const int iterations = argc > 1 ? std::atoi(argv[1]) : 100;
+    const char* path = argc > 2 ? argv[2] : "bench.csv";
+    const int threads = argc > 3 ? std::max(1, std::atoi(argv[3])) : 1;
+    JobSystem jobs(threads - 1);
+
+    FILE* out = std::fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "ERROR\t unable to open %s\n", path);
+        return -1;
+    }
+
+    std::vector<Config> configs;
+    for (int players : {16, 64, 256}) {
+        for (int bullets : {128, 1024}) {
+            for (int npcs : {0, 2000}) {
+                for (float blocks : {0.25f, 2.5f}) {
+                    configs.push_back({players, bullets, npcs, blocks, "spread", 1000.f});
+                    configs.push_back({players, bullets, npcs, blocks, "clustered", 50.f});
+                }
+            }
+        }
+    }
+
+    std::vector<Client> clients;
+    SnapshotEncoder encoder;
+    char buf[proto::maxSnapshotSize];
+
+    const std::vector<std::pair<const char*, std::function<void(Simulation&)>>> phases{
+        {"bullet_player", [](Simulation& sim) { sim.collideBullets(); }},
+        {"bullet_world", [](Simulation& sim) { sim.expireBullets(); }},
+        {"player_world", [](Simulation& sim) { sim.collideWorld(); }},
+        {"player_player", [](Simulation& sim) { sim.collidePlayers(); }},
+        {"integrate", [](Simulation& sim) { sim.integrate(); }},
+        {"horde", [](Simulation& sim) { sim.moveHorde(); }},
+        {"step", [](Simulation& sim) { sim.step(); }},
+        {"snapshot", [&](Simulation& sim) {
+            encoder.encodeEntities(sim);
+            for (auto& client : clients) {
+                encoder.fill(sim, client, buf, sizeof buf);
+            }
+        }},
+    };
+
+    fprintf(out, "phase,players,bullets,npcs,blocks_per_chunk,density,threads,iterations,mean_ns,p50_ns,p90_ns,p99_ns,max_ns\n");
+    for (const auto& config : configs) {
+        Simulation sim = makeSimulation(config, 1);
+        sim.jobs = &jobs;
+
+        clients.clear();
+        for (const auto& p : sim.players) {
+            clients.push_back(Client{p.id});
+        }
+
+        for (const auto& [name, phase] : phases) {
+            const Histogram h = measure(sim, iterations, phase);
+            fprintf(out, "%s,%d,%d,%d,%.2f,%s,%d,%d,%.0f,%lu,%lu,%lu,%lu\n",
+                name, config.players, config.bullets, config.npcs, config.blocks, config.density, threads, iterations,
+                h.mean(), h.percentile(50), h.percentile(90), h.percentile(99), h.max());
+            fflush(out);
+        }
+    }
+
+    std::fclose(out);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+// Flat binary serialization of trivially copyable values, vectors of them
+// and strings. Only meant to be read back by the same build on the same
+// machine, so there is no care for endianness or layout.
+
+class Writer {
+public:
+	template <typename T>
+	void write(const T& v) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		bytes(&v, sizeof v);
+	}
+
+	template <typename T>
+	void write(const std::vector<T>& v) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		write<uint64_t>(v.size());
+		bytes(v.data(), v.size() * sizeof (T));
+	}
+
+	void write(const std::string& s) {
+		write<uint64_t>(s.size());
+		bytes(s.data(), s.size());
+	}
+
+	void bytes(const void* data, size_t n) {
+		const char* p = static_cast<const char*>(data);
+		buf.insert(buf.end(), p, p + n);
+	}
+
+	const std::vector<char>& data() const {
+		return buf;
+	}
+
+private:
+	std::vector<char> buf;
+};
+
+// Throws when reading past the end
+class Reader {
+public:
+	Reader(const char* data, size_t size)
+	: it{data},
+	  end{data + size}
+	{}
+
+	template <typename T>
+	T read() {
+		static_assert(std::is_trivially_copyable_v<T>);
+		T v;
+		bytes(&v, sizeof v);
+		return v;
+	}
+
+	template <typename T>
+	void read(std::vector<T>& v) {
+		static_assert(std::is_trivially_copyable_v<T>);
+		const auto n = read<uint64_t>();
+		if (n > size_t(end - it) / sizeof (T)) {
+			throw std::runtime_error("archive is truncated");
+		}
+		v.resize(n);
+		bytes(v.data(), n * sizeof (T));
+	}
+
+	void read(std::string& s) {
+		const auto n = read<uint64_t>();
+		if (n > size_t(end - it)) {
+			throw std::runtime_error("archive is truncated");
+		}
+		s.assign(it, n);
+		it += n;
+	}
+
+	void bytes(void* out, size_t n) {
+		if (n > size_t(end - it)) {
+			throw std::runtime_error("archive is truncated");
+		}
+		std::memcpy(out, it, n);
+		it += n;
+	}
+
+private:
+	const char* it;
+	const char* end;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <vector>
+
+
+struct AtlasSize {
+	int32_t width;
+	int32_t height;
+};
+
+// Where a rectangle went, and which page it is on
+struct AtlasPlace {
+	uint32_t page;
+	int32_t x;
+	int32_t y;
+};
+
+struct AtlasLayout {
+	std::vector<AtlasPlace> places; // In the order of the rectangles
+	std::vector<AtlasSize> pages;   // As much of each page as is used
+};
+
+// Places rectangles in rows in the order they are given, left to right and
+// top to bottom, and starts a new page once one is full. Good enough for
+// animation frames, which are all about the same size. With an atlasSize of
+// 0 every rectangle gets a page of its own.
+inline AtlasLayout packRows(const std::vector<AtlasSize>& sizes, int32_t atlasSize, int32_t padding) {
+	AtlasLayout layout;
+	if (atlasSize <= 0) {
+		for (size_t i = 0; i < sizes.size(); ++i) {
+			layout.places.push_back({uint32_t(i), 0, 0});
+			layout.pages.push_back(sizes[i]);
+		}
+		return layout;
+	}
+
+	int32_t x = 0;
+	int32_t y = 0;
+	int32_t rowHeight = 0;
+	for (const auto& size : sizes) {
+		if (size.width > atlasSize || size.height > atlasSize) {
+			throw std::runtime_error(std::format("{}x{} doesn't fit an atlas of {}", size.width, size.height, atlasSize));
+		}
+		if (layout.pages.empty()) {
+			layout.pages.push_back({0, 0});
+		}
+		if (x + size.width > atlasSize) {
+			x = 0;
+			y += rowHeight + padding;
+			rowHeight = 0;
+		}
+		if (y + size.height > atlasSize) {
+			layout.pages.push_back({0, 0});
+			x = 0;
+			y = 0;
+			rowHeight = 0;
+		}
+
+		layout.places.push_back({uint32_t(layout.pages.size() - 1), x, y});
+		auto& page = layout.pages.back();
+		page = {std::max(page.width, x + size.width), std::max(page.height, y + size.height)};
+		x += size.width + padding;
+		rowHeight = std::max(rowHeight, size.height);
+	}
+	return layout;
+}
+
+#endif
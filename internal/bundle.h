@@ -0,0 +1,168 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include "mapped_file.h"
+
+
+// Bundle files hold animations already decoded and packed into atlases, for
+// the client to upload straight from the mapped file. assetpack makes them.
+namespace bundle {
+
+constexpr uint32_t magic = 0x4c444e42; // "BNDL"
+constexpr uint32_t version = 1;
+
+// Followed by the atlases, the animations and the frames, then the pixels of
+// every atlas as 8 bit RGBA
+struct FileHeader {
+	uint32_t magic{bundle::magic};
+	uint32_t version{bundle::version};
+	uint32_t numAtlases;
+	uint32_t numAnimations;
+	uint32_t numFrames;
+};
+
+struct Atlas {
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset; // Of the pixels from the start of the file
+};
+
+// Frames of an animation are next to each other in the frames
+struct Animation {
+	char name[120]; // Directory of the frames within the asset tree
+	uint32_t firstFrame;
+	uint32_t numFrames;
+};
+
+struct Frame {
+	uint32_t atlas;
+	float x;
+	float y;
+	float width;
+	float height;
+};
+
+// Pixels of an atlas to write
+struct Pixels {
+	uint32_t width;
+	uint32_t height;
+	const void* data;
+};
+
+inline void write(const char* path, const std::vector<Animation>& animations, const std::vector<Frame>& frames,
+                  const std::vector<Pixels>& atlases) {
+	std::ofstream out{path, std::ios::binary};
+	if (!out) {
+		throw std::runtime_error(std::format("unable to open {}", path));
+	}
+
+	const FileHeader h{.numAtlases = uint32_t(atlases.size()), .numAnimations = uint32_t(animations.size()),
+	                   .numFrames = uint32_t(frames.size())};
+	uint64_t offset = sizeof h + atlases.size() * sizeof (Atlas) + animations.size() * sizeof (Animation)
+		+ frames.size() * sizeof (Frame);
+	out.write(reinterpret_cast<const char*>(&h), sizeof h);
+	for (const auto& pixels : atlases) {
+		const Atlas a{pixels.width, pixels.height, offset};
+		out.write(reinterpret_cast<const char*>(&a), sizeof a);
+		offset += uint64_t(pixels.width) * pixels.height * 4;
+	}
+	out.write(reinterpret_cast<const char*>(animations.data()), animations.size() * sizeof (Animation));
+	out.write(reinterpret_cast<const char*>(frames.data()), frames.size() * sizeof (Frame));
+	for (const auto& pixels : atlases) {
+		out.write(static_cast<const char*>(pixels.data), uint64_t(pixels.width) * pixels.height * 4);
+	}
+
+	if (!out) {
+		throw std::runtime_error(std::format("unable to write {}", path));
+	}
+}
+
+}
+
+// A bundle file mapped into memory. The index is copied out when opened, the
+// pixels are only read from the mapping.
+class Bundle {
+public:
+	Bundle(const char* path)
+	: file{path}
+	{
+		bundle::FileHeader h;
+		if (file.size < sizeof h) {
+			throw std::runtime_error(std::format("{} is too short", path));
+		}
+		std::memcpy(&h, file.data, sizeof h);
+		if (h.magic != bundle::magic || h.version != bundle::version) {
+			throw std::runtime_error(std::format("{} is not a bundle or of an unsupported version", path));
+		}
+
+		const uint64_t index = uint64_t(h.numAtlases) * sizeof (bundle::Atlas)
+			+ uint64_t(h.numAnimations) * sizeof (bundle::Animation) + uint64_t(h.numFrames) * sizeof (bundle::Frame);
+		if (file.size - sizeof h < index) {
+			throw std::runtime_error(std::format("index of {} is cut short", path));
+		}
+		const char* it = file.data + sizeof h;
+		atlases = read<bundle::Atlas>(it, h.numAtlases);
+		animations = read<bundle::Animation>(it, h.numAnimations);
+		frames = read<bundle::Frame>(it, h.numFrames);
+
+		for (const auto& a : atlases) {
+			if (a.offset > file.size || (file.size - a.offset) / 4 / std::max(a.width, 1u) < a.height) {
+				throw std::runtime_error(std::format("pixels of {} are cut short", path));
+			}
+		}
+		for (auto& anim : animations) {
+			anim.name[sizeof anim.name - 1] = '\0';
+			if (anim.firstFrame > frames.size() || frames.size() - anim.firstFrame < anim.numFrames) {
+				throw std::runtime_error(std::format("invalid animation {} in {}", anim.name, path));
+			}
+		}
+		for (const auto& f : frames) {
+			if (f.atlas >= atlases.size()) {
+				throw std::runtime_error(std::format("invalid frame in {}", path));
+			}
+		}
+	}
+
+	// Throws when there is no animation of that name
+	std::span<const bundle::Frame> animation(std::string_view name) const {
+		for (const auto& anim : animations) {
+			if (name == anim.name) {
+				return {frames.data() + anim.firstFrame, anim.numFrames};
+			}
+		}
+		throw std::runtime_error(std::format("no animation {} in the bundle", name));
+	}
+
+	const std::vector<bundle::Atlas>& getAtlases() const {
+		return atlases;
+	}
+
+	const void* pixels(const bundle::Atlas& atlas) const {
+		return file.data + atlas.offset;
+	}
+
+private:
+	template <typename T>
+	static std::vector<T> read(const char*& it, size_t n) {
+		std::vector<T> v(n);
+		std::memcpy(v.data(), it, n * sizeof (T));
+		it += n * sizeof (T);
+		return v;
+	}
+
+	MappedFile file;
+	std::vector<bundle::Atlas> atlases;
+	std::vector<bundle::Animation> animations;
+	std::vector<bundle::Frame> frames;
+};
+
+#endif
@@ -0,0 +1,248 @@
+#ifndef CONDITIONER_H
+#define CONDITIONER_H
+
+#include <asio.hpp>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "util.h"
+
+
+using udp = asio::ip::udp;
+using Clock = std::chrono::high_resolution_clock;
+
+// How datagrams are treated in one direction
+struct LinkConditions {
+	Clock::duration latency{0};
+	Clock::duration jitter{0};  // Extra delay, uniform in [0, jitter]
+	float loss{0};              // Probability of dropping a datagram
+	float duplicate{0};         // Probability of delivering a datagram twice
+	float reorder{0};           // Probability of holding a datagram back past the ones sent after it
+	float bandwidth{0};         // Bytes per second, 0 is unlimited
+
+	bool enabled() const {
+		return latency.count() > 0 || jitter.count() > 0 || loss > 0 || duplicate > 0 || reorder > 0 || bandwidth > 0;
+	}
+};
+
+struct Conditions {
+	LinkConditions out;
+	LinkConditions in;
+	uint32_t seed{1};
+};
+
+// Conditions from --latency and --jitter in milliseconds and --loss as a
+// fraction, taken out of the arguments. Both directions get the same ones.
+// Throws if a value is not a number or out of range.
+inline Conditions takeConditions(int& argc, char** argv, uint32_t seed) {
+	LinkConditions link;
+	if (const char* arg = TakeOption(argc, argv, "latency")) {
+		link.latency = std::chrono::milliseconds(std::stoi(arg));
+	}
+	if (const char* arg = TakeOption(argc, argv, "jitter")) {
+		link.jitter = std::chrono::milliseconds(std::stoi(arg));
+	}
+	if (const char* arg = TakeOption(argc, argv, "loss")) {
+		link.loss = std::stof(arg);
+	}
+	if (link.latency.count() < 0 || link.jitter.count() < 0 || !(link.loss >= 0 && link.loss <= 1)) {
+		throw std::invalid_argument("latency and jitter can't be negative and loss has to be in range [0, 1]");
+	}
+	return {link, link, seed};
+}
+
+// Decides the fate of the datagrams of one direction. The same seed and the
+// same sequence of datagrams give the same decisions.
+class LinkModel {
+public:
+	LinkModel(const LinkConditions& conditions, uint32_t seed)
+	: conditions{conditions},
+	  mt{seed}
+	{}
+
+	// Delays after which copies of a datagram of n bytes sent at now arrive,
+	// empty when it is lost
+	std::vector<Clock::duration> plan(size_t n, Clock::time_point now) {
+		std::vector<Clock::duration> delays;
+
+		// A capped link sends one datagram after the other
+		Clock::duration queued{0};
+		if (conditions.bandwidth > 0) {
+			const auto start = std::max(now, linkFreeAt);
+			linkFreeAt = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(n / conditions.bandwidth));
+			queued = linkFreeAt - now;
+		}
+
+		if (chance(conditions.loss)) {
+			return delays;
+		}
+
+		const int copies = chance(conditions.duplicate) ? 2 : 1;
+		for (int i = 0; i < copies; ++i) {
+			auto delay = queued + conditions.latency + jitter();
+			if (chance(conditions.reorder)) {
+				delay += std::max<Clock::duration>(conditions.latency + conditions.jitter, std::chrono::milliseconds(1));
+			}
+			delays.push_back(delay);
+		}
+		return delays;
+	}
+
+private:
+	bool chance(float p) {
+		return p > 0 && std::uniform_real_distribution<float>(0, 1)(mt) < p;
+	}
+
+	Clock::duration jitter() {
+		if (conditions.jitter.count() == 0) {
+			return Clock::duration{0};
+		}
+		return Clock::duration{std::uniform_int_distribution<Clock::rep>(0, conditions.jitter.count())(mt)};
+	}
+
+	LinkConditions conditions;
+	std::mt19937 mt;
+	Clock::time_point linkFreeAt{};
+};
+
+// Stands in for the udp::socket of Connection and Server. Without conditions
+// it passes everything straight to the socket, with them every datagram in
+// either direction goes through a LinkModel and a timer before it is sent
+// or handed to the receiver.
+class ConditionedSocket {
+public:
+	using Handler = std::function<void(std::error_code, size_t)>;
+
+	ConditionedSocket(asio::io_context& ioc, const udp::endpoint& local, const Conditions& conditions = {})
+	: ioc{ioc},
+	  socket{ioc, local},
+	  conditioned{conditions.out.enabled() || conditions.in.enabled()},
+	  out{conditions.out, conditions.seed},
+	  in{conditions.in, conditions.seed + 1}
+	{}
+
+	ConditionedSocket(asio::io_context& ioc, const udp& protocol, const Conditions& conditions = {})
+	: ConditionedSocket{ioc, udp::endpoint{protocol, 0}, conditions}
+	{}
+
+	udp::endpoint local_endpoint() const {
+		return socket.local_endpoint();
+	}
+
+	template <typename Buffers, typename SendHandler>
+	void async_send_to(const Buffers& buffers, const udp::endpoint& to, SendHandler handler) {
+		if (!conditioned) {
+			socket.async_send_to(buffers, to, std::move(handler));
+			return;
+		}
+
+		// The caller may free its buffers once the handler has run
+		auto datagram = std::make_shared<std::vector<char>>(asio::buffer_size(buffers));
+		asio::buffer_copy(asio::buffer(*datagram), buffers);
+		asio::post(ioc, [handler, n = datagram->size()]() mutable {
+			handler(std::error_code{}, n);
+		});
+
+		for (const auto delay : out.plan(datagram->size(), Clock::now())) {
+			after(delay, [this, datagram, to] {
+				socket.async_send_to(asio::buffer(*datagram), to, [datagram](std::error_code, size_t) {});
+			});
+		}
+	}
+
+	template <typename ReceiveHandler>
+	void async_receive_from(asio::mutable_buffer buffer, udp::endpoint& from, ReceiveHandler handler) {
+		if (!conditioned) {
+			socket.async_receive_from(buffer, from, std::move(handler));
+			return;
+		}
+
+		pending = Pending{buffer, &from, std::move(handler)};
+		if (!receiving) {
+			receiving = true;
+			receive();
+		}
+		deliver();
+	}
+
+private:
+	struct Datagram {
+		std::vector<char> data;
+		udp::endpoint from;
+		std::error_code ec;
+	};
+
+	struct Pending {
+		asio::mutable_buffer buffer;
+		udp::endpoint* from;
+		Handler handler;
+	};
+
+	void after(Clock::duration delay, std::function<void()> f) {
+		auto timer = std::make_shared<asio::high_resolution_timer>(ioc, delay);
+		timer->async_wait([timer, f = std::move(f)](std::error_code ec) {
+			if (!ec) {
+				f();
+			}
+		});
+	}
+
+	// Keeps reading the real socket, the datagrams are handed out once their
+	// conditions allow
+	void receive() {
+		socket.async_receive_from(asio::buffer(bufIn), fromIn, [this](std::error_code ec, size_t n) {
+			if (ec) {
+				ready.push_back({{}, fromIn, ec});
+				deliver();
+				receive();
+				return;
+			}
+
+			auto datagram = std::make_shared<Datagram>(Datagram{{bufIn, bufIn + n}, fromIn});
+			for (const auto delay : in.plan(n, Clock::now())) {
+				after(delay, [this, datagram] {
+					ready.push_back(*datagram);
+					deliver();
+				});
+			}
+			receive();
+		});
+	}
+
+	void deliver() {
+		if (!pending || ready.empty()) {
+			return;
+		}
+
+		auto p = std::move(*pending);
+		pending.reset();
+		auto datagram = std::move(ready.front());
+		ready.pop_front();
+
+		const size_t n = asio::buffer_copy(p.buffer, asio::buffer(datagram.data));
+		*p.from = datagram.from;
+		asio::post(ioc, [handler = std::move(p.handler), ec = datagram.ec, n] {
+			handler(ec, n);
+		});
+	}
+
+	asio::io_context& ioc;
+	udp::socket socket;
+	bool conditioned;
+	LinkModel out;
+	LinkModel in;
+
+	bool receiving{false};
+	char bufIn[65536];
+	udp::endpoint fromIn;
+	std::optional<Pending> pending;
+	std::deque<Datagram> ready;
+};
+
+#endif
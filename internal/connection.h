@@ -8,6 +8,9 @@
 #include <queue>
 #include <vector>
 #include <format>
+#include "histogram.h"
+#include "log.h"
+#include "conditioner.h"
 
 
 using udp = asio::ip::udp;
@@ -47,6 +50,7 @@ class Connection {
 		uint32_t writeReliableID{0};
 		uint32_t recvID{0};
 		uint32_t recvReliableID{0};
+		std::map<uint32_t, std::vector<char>> outOfOrder;
 	};
 
 	struct Message {
@@ -54,13 +58,24 @@ class Connection {
 		std::vector<char> payload;
 		Handler handler;
 		Clock::time_point createdAt;
+		Clock::time_point sentAt;
 	};
 
 public:
 	using Listener = std::function<void(char*, size_t)>;
 
-	Connection(udp::endpoint peer)
-	: socket{ioc, udp::v4()},
+	struct Stats {
+		uint64_t packetsIn{0};
+		uint64_t bytesIn{0};
+		uint64_t packetsOut{0};
+		uint64_t bytesOut{0};
+		uint64_t resends{0};
+		uint64_t lost{0};      // Gaps in the ids of unreliable messages received
+		Histogram confirmRtt;  // Microseconds from writeReliable to confirmation
+	};
+
+	Connection(udp::endpoint peer, const Conditions& conditions = {})
+	: socket{ioc, udp::v4(), conditions},
 	  peer{std::move(peer)},
 	  timer{ioc}
 	{
@@ -86,7 +101,9 @@ public:
 		const Message& msg = (waitingForConfirmation[id] = Message{
 			Header{channel, (uint32_t)dataLen, Header::Type::Reliable, id},
 			{(const char*) data, ((const char*) data) + dataLen}, 
-			handler
+			handler,
+			Clock::now(),
+			Clock::now()
 		});
 
 		send(msg);
@@ -96,6 +113,10 @@ public:
 		return ping;
 	}
 
+	const Stats& getStats() const {
+		return stats;
+	}
+
 	void listen(Channel channel, Listener listener) {
 		listeners[channel] = listener;
 	}
@@ -111,6 +132,8 @@ public:
 private:
 	void send(const Header& h, const void* data = nullptr, Handler handler = [](std::error_code, size_t){}) {
 		const size_t totalSize = sizeof h + h.payloadSize;
+		stats.packetsOut++;
+		stats.bytesOut += totalSize;
 		auto buf = new char[totalSize];
 		std::memcpy(buf, &h, sizeof h);
 		if (h.payloadSize > 0) {
@@ -123,13 +146,15 @@ private:
 			[handler, buf](std::error_code ec, size_t n) {
 				handler(ec, n);
 				if (ec) {
-					fprintf(stderr, "ERROR Connection::write: %s\n", ec.message().c_str());
+					LOG_ERROR("Connection::write: %s", ec.message().c_str());
 				}
 				delete[] buf;
 			});
 	}
 
 	void send(const Message& msg) {
+		stats.packetsOut++;
+		stats.bytesOut += sizeof msg.header + msg.payload.size();
 		socket.async_send_to(
 			std::vector<asio::const_buffer>{
 				asio::buffer((char*)&msg.header, sizeof (Header)), 
@@ -137,7 +162,7 @@ private:
 			peer,
 			[](std::error_code ec, size_t n) {
 				if (ec) {
-					fprintf(stderr, "ERROR Connection::send(Message): %s\n", ec.message().c_str());
+					LOG_ERROR("Connection::send(Message): %s", ec.message().c_str());
 				}
 			}
 		);
@@ -153,13 +178,15 @@ private:
 		timer.expires_after(interval);
 		timer.async_wait([this](std::error_code ec) {
 			if (ec) {
-				printf("ERROR: timer async_wait: %s\n", ec.message().c_str());
+				LOG_ERROR("timer async_wait: %s", ec.message().c_str());
 			}
 
 			for (auto& [_, msg] : waitingForConfirmation) {
-				if (Clock::now() - msg.createdAt > 2 * ping) {
-					printf("resend id=%d\n", msg.header.id);
+				if (Clock::now() - msg.sentAt > 2 * ping) {
+					LOG_DEBUG("resend id=%d", msg.header.id);
 					send(msg);
+					msg.sentAt = Clock::now();
+					stats.resends++;
 				}
 			}
 			
@@ -174,24 +201,26 @@ private:
 			peer,
 			[this](std::error_code ec, size_t n) {
 				if (ec) {
-					fprintf(stderr, "ERROR Connection::startReceive: %s\n", ec.message().c_str());
+					LOG_ERROR("Connection::startReceive: %s", ec.message().c_str());
 					startReceive(); // Fuckit just try again
 					return;
 				}
 
 				if (n < sizeof (Header)) {
-					fprintf(stderr, "ERROR: received less bytes than the header is in length. (%ld bytes)\n", n);
+					LOG_ERROR("received less bytes than the header is in length. (%ld bytes)", n);
 					startReceive();
 					return;
 				}
 
 				Header h;
 				std::memcpy(&h, buf, sizeof h);
+				stats.packetsIn++;
+				stats.bytesIn += n;
 
 				if (n == sizeof h + h.payloadSize) {
 					handleMessage(h);
 				} else {
-					fprintf(stderr, "ERROR: Size of the received datagram is not valid. (%ld bytes. Should be %ld)\n", 
+					LOG_ERROR("Size of the received datagram is not valid. (%ld bytes. Should be %ld)",
 						n, sizeof h + h.payloadSize);
 				}
 
@@ -199,27 +228,59 @@ private:
 			});
 	}
 
+	void deliver(Channel channel, char* data, size_t n) {
+		if (listeners.contains(channel)) {
+			listeners[channel](data, n);
+		} else {
+			LOG_ERROR("received data to channel %d that is not being listened", channel);
+		}
+	}
+
 	void handleMessage(const Header& h) {
 		switch (h.type) {
 		case Header::Type::Unreliable:
-			if (listeners.contains(h.channel)) {
-				listeners[h.channel](buf + sizeof h, h.payloadSize);
-			} else {
-				fprintf(stderr, "ERROR: received data to channel %d that is not being listened\n", h.channel);
+		{
+			auto& info = chInfos[h.channel];
+			if (h.id > info.recvID + 1) {
+				stats.lost += h.id - info.recvID - 1;
 			}
+			info.recvID = std::max(info.recvID, h.id);
+
+			deliver(h.channel, buf + sizeof h, h.payloadSize);
 			break;
+		}
 		case Header::Type::Reliable:
-			if (listeners.contains(h.channel)) {
-				listeners[h.channel](buf + sizeof h, h.payloadSize);
-			} else {
-				fprintf(stderr, "ERROR: received data to channel %d that is not being listened\n", h.channel);
+		{
+			send(Header{h.channel, 0, Header::Type::Confirmation, h.id});
+
+			// Reliable messages are delivered once and in order
+			auto& info = chInfos[h.channel];
+			if (h.id <= info.recvReliableID) {
+				break;
+			}
+			if (h.id > info.recvReliableID + 1) {
+				info.outOfOrder[h.id] = {buf + sizeof h, buf + sizeof h + h.payloadSize};
+				break;
 			}
 
-			send(Header{h.channel, 0, Header::Type::Confirmation, h.id});
+			deliver(h.channel, buf + sizeof h, h.payloadSize);
+			++info.recvReliableID;
+
+			for (auto it = info.outOfOrder.find(info.recvReliableID + 1); it != info.outOfOrder.end(); 
+			     it = info.outOfOrder.find(info.recvReliableID + 1)) {
+				deliver(h.channel, it->second.data(), it->second.size());
+				++info.recvReliableID;
+				info.outOfOrder.erase(it);
+			}
 			break;
+		}
 		case Header::Type::Confirmation:
-			if (waitingForConfirmation.erase(h.id) == 0) {
-				fprintf(stderr, "ERROR: received confirmation for message %d that is not waiting to be confirmed\n", h.id);
+			if (auto it = waitingForConfirmation.find(h.id); it != waitingForConfirmation.end()) {
+				const auto rtt = Clock::now() - it->second.createdAt;
+				stats.confirmRtt.record(std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
+				waitingForConfirmation.erase(it);
+			} else {
+				LOG_DEBUG("received confirmation for message %d that is not waiting to be confirmed", h.id);
 			}
 			break;
 		case Header::Type::Ping:
@@ -230,7 +291,7 @@ private:
 	}
 
 	asio::io_context ioc;
-	udp::socket socket;
+	ConditionedSocket socket;
 	udp::endpoint peer;
 	std::map<Channel, Listener> listeners;
 	char buf[10000];
@@ -239,6 +300,7 @@ private:
 	bool isConnected_{false};
 	Clock::duration ping{0};
 	std::map<Channel, ChannelInfo> chInfos;
+	Stats stats;
 };
 
 
@@ -0,0 +1,248 @@
+#ifndef FLOWFIELD_H
+#define FLOWFIELD_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "vec.h"
+#include "world.h"
+
+
+// Distance to the nearest goal for every cell of a grid laid over the chunks
+// around the goals, walking around blocks, and the way to go from each cell
+// to get there. Any number of agents can then find their way with a few
+// lookups each.
+//
+// The field is only rebuilt when a goal moves to another cell, and which
+// cells blocks cover is kept per chunk between rebuilds.
+class FlowField {
+public:
+	static constexpr float cellSize = 2.f;
+	static constexpr int32_t cellsPerChunk = int32_t(World::chunkSize / cellSize);
+	static constexpr uint16_t unreachable = 0xffff;
+
+	// Covers margin chunks around the goals, but at most maxChunks chunks
+	// across. Goals outside of that are left out.
+	FlowField(int32_t margin = 2, int32_t maxChunks = 16)
+	: margin{margin},
+	  maxChunks{maxChunks}
+	{}
+
+	// Works out the area the goals need and loads its chunks. Returns whether
+	// build() has anything to do.
+	bool prepare(World& world, const Vec2* goals, size_t n) {
+		Area next{};
+		if (n > 0) {
+			ChunkCoord lo = World::chunkOf(goals[0]);
+			ChunkCoord hi = lo;
+			for (size_t i = 1; i < n; ++i) {
+				const ChunkCoord c = World::chunkOf(goals[i]);
+				lo = {std::min(lo.x, c.x), std::min(lo.y, c.y)};
+				hi = {std::max(hi.x, c.x), std::max(hi.y, c.y)};
+			}
+			next.width = std::min(hi.x - lo.x + 1 + 2 * margin, maxChunks);
+			next.height = std::min(hi.y - lo.y + 1 + 2 * margin, maxChunks);
+			next.origin = {(lo.x + hi.x + 1 - next.width) / 2, (lo.y + hi.y + 1 - next.height) / 2};
+		}
+
+		cells.clear();
+		for (size_t i = 0; i < n; ++i) {
+			if (const auto cell = next.cell(goals[i])) {
+				cells.push_back(*cell);
+			}
+		}
+		std::sort(cells.begin(), cells.end());
+		cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+
+		if (next == pending && cells == pendingGoals) {
+			return dirty;
+		}
+		pending = next;
+		pendingGoals.swap(cells);
+		dirty = true;
+
+		for (int32_t x = 0; x < next.width; ++x) {
+			for (int32_t y = 0; y < next.height; ++y) {
+				world.load({next.origin.x + x, next.origin.y + y});
+			}
+		}
+		return true;
+	}
+
+	// Recomputes the field for what prepare() was last given. Only reads the
+	// world, so it can run alongside anything else that does.
+	void build(const World& world) {
+		if (!dirty) {
+			return;
+		}
+		dirty = false;
+		area = pending;
+		goalCells = pendingGoals;
+
+		// A ring of walls around the cells saves checking for the edges
+		const int32_t stride = area.width * cellsPerChunk + 2;
+		distances.assign(size_t(stride) * (area.height * cellsPerChunk + 2), wall);
+		std::erase_if(masks, [this](const auto& kv) {
+			return !area.contains(World::coordOf(kv.first));
+		});
+		for (int32_t x = 0; x < area.width; ++x) {
+			for (int32_t y = 0; y < area.height; ++y) {
+				const ChunkCoord c{area.origin.x + x, area.origin.y + y};
+				const auto& mask = maskOf(world, c);
+				for (int32_t j = 0; j < cellsPerChunk; ++j) {
+					uint16_t* row = &distances[index(x * cellsPerChunk, y * cellsPerChunk + j)];
+					for (int32_t k = 0; k < cellsPerChunk; ++k) {
+						row[k] = mask[j * cellsPerChunk + k] ? wall : unreachable;
+					}
+				}
+			}
+		}
+
+		// Breadth first from every goal at once
+		queue.clear();
+		for (const uint32_t goal : goalCells) {
+			distances[goal] = 0;
+			queue.push_back(goal);
+		}
+		for (size_t head = 0; head < queue.size(); ++head) {
+			const uint32_t i = queue[head];
+			const uint16_t d = distances[i] + 1;
+			for (const uint32_t n : {i + 1, i - 1, i + stride, i - stride}) {
+				if (distances[n] == unreachable) {
+					distances[n] = d;
+					queue.push_back(n);
+				}
+			}
+		}
+
+		++builds;
+	}
+
+	bool covers(Vec2 pos) const {
+		return area.cell(pos).has_value();
+	}
+
+	// Unit length, zero at a goal and where no goal can be reached from.
+	// Towards the nearest neighbour, diagonally only where no block is in the
+	// way of cutting the corner. Cells blocks cover lead out of them, agents
+	// get pushed into those along the edges. Worked out on the spot, as there
+	// are far fewer agents than cells.
+	Vec2 direction(Vec2 pos) const {
+		const auto cell = area.cell(pos);
+		if (!cell || distances[*cell] == 0) {
+			return {0, 0};
+		}
+
+		const int32_t stride = area.width * cellsPerChunk + 2;
+		auto reachable = [&](int32_t dx, int32_t dy) {
+			return distances[*cell + dy * stride + dx] < wall;
+		};
+
+		uint16_t best = distances[*cell];
+		Vec2 dir{0, 0};
+		for (int32_t dy = -1; dy <= 1; ++dy) {
+			for (int32_t dx = -1; dx <= 1; ++dx) {
+				if (!reachable(dx, dy) || (dx != 0 && dy != 0 && !(reachable(dx, 0) && reachable(0, dy)))) {
+					continue;
+				}
+				if (const uint16_t d = distances[*cell + dy * stride + dx]; d < best) {
+					best = d;
+					dir = Vec2{float(dx), float(dy)};
+				}
+			}
+		}
+		return dir.x != 0 && dir.y != 0 ? std::sqrt(0.5f) * dir : dir;
+	}
+
+	// In cells walked
+	uint16_t distance(Vec2 pos) const {
+		const auto cell = area.cell(pos);
+		return cell && distances[*cell] < wall ? distances[*cell] : unreachable;
+	}
+
+	// How many times the field was built so far
+	uint64_t getBuilds() const {
+		return builds;
+	}
+
+private:
+	// Whole chunks, so the cells of a chunk can be copied over as they are
+	struct Area {
+		ChunkCoord origin{0, 0};
+		int32_t width{0};
+		int32_t height{0};
+
+		bool operator==(const Area&) const = default;
+
+		bool contains(ChunkCoord c) const {
+			return c.x >= origin.x && c.y >= origin.y && c.x < origin.x + width && c.y < origin.y + height;
+		}
+
+		// Index of the cell pos is in
+		std::optional<uint32_t> cell(Vec2 pos) const {
+			const int32_t x = int32_t(std::floor(pos.x / cellSize)) - origin.x * cellsPerChunk;
+			const int32_t y = int32_t(std::floor(pos.y / cellSize)) - origin.y * cellsPerChunk;
+			if (x < 0 || y < 0 || x >= width * cellsPerChunk || y >= height * cellsPerChunk) {
+				return std::nullopt;
+			}
+			return index(x, y);
+		}
+
+		uint32_t index(int32_t x, int32_t y) const {
+			return uint32_t((y + 1) * (width * cellsPerChunk + 2) + x + 1);
+		}
+	};
+
+	// Cells of blocks, and the ring around the area
+	static constexpr uint16_t wall = unreachable - 1;
+
+	uint32_t index(int32_t x, int32_t y) const {
+		return area.index(x, y);
+	}
+
+	// Cells of the chunk any block covers part of, row by row
+	const std::vector<uint8_t>& maskOf(const World& world, ChunkCoord c) {
+		auto [it, inserted] = masks.try_emplace(World::key(c));
+		auto& mask = it->second;
+		if (!inserted) {
+			return mask;
+		}
+
+		mask.assign(cellsPerChunk * cellsPerChunk, 0);
+		const Chunk* chunk = world.find(c);
+		if (!chunk) {
+			return mask;
+		}
+		const Vec2 o = World::origin(c);
+		for (const auto& b : chunk->blocks) {
+			const int32_t x0 = std::max(0, int32_t(std::floor((b.pos.x - o.x) / cellSize)));
+			const int32_t y0 = std::max(0, int32_t(std::floor((b.pos.y - o.y) / cellSize)));
+			const int32_t x1 = std::min(cellsPerChunk, int32_t(std::ceil((b.pos.x + b.size.x - o.x) / cellSize)));
+			const int32_t y1 = std::min(cellsPerChunk, int32_t(std::ceil((b.pos.y + b.size.y - o.y) / cellSize)));
+			for (int32_t y = y0; y < y1; ++y) {
+				for (int32_t x = x0; x < x1; ++x) {
+					mask[y * cellsPerChunk + x] = 1;
+				}
+			}
+		}
+		return mask;
+	}
+
+	int32_t margin;
+	int32_t maxChunks;
+	Area area;
+	Area pending; // What prepare() was last given
+	bool dirty{false};
+	uint64_t builds{0};
+	std::vector<uint32_t> goalCells; // Sorted
+	std::vector<uint32_t> pendingGoals;
+	std::vector<uint32_t> cells;
+	std::unordered_map<uint64_t, std::vector<uint8_t>> masks;
+	std::vector<uint16_t> distances; // With a ring of walls around
+	std::vector<uint32_t> queue;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "vec.h"
+
+
+// Broadphase for many moving points: a uniform grid rebuilt from scratch
+// every tick with a counting sort, so building is linear in the number of
+// points. The grid wraps around, cells further apart than its size share a
+// bucket, so the world can be any size.
+class SpatialGrid {
+public:
+	SpatialGrid(float cellSize)
+	: cellSize{cellSize}
+	{}
+
+	void build(const Vec2* points, size_t n) {
+		// At least 8x8, so the cells around any cell are in different buckets
+		width = 8;
+		height = 8;
+		while (width * height < 2 * n) {
+			(width == height ? width : height) *= 2;
+		}
+		starts.assign(width * height + 1, 0);
+		bucketOf.resize(n);
+		items.resize(n);
+		sorted.resize(n);
+
+		for (size_t i = 0; i < n; ++i) {
+			bucketOf[i] = bucket(cellOf(points[i].x), cellOf(points[i].y));
+			starts[bucketOf[i] + 1]++;
+		}
+		for (size_t b = 0; b < width * height; ++b) {
+			starts[b + 1] += starts[b];
+		}
+		// Filled in index order, so queries visit points in a fixed order
+		next.assign(starts.begin(), starts.end() - 1);
+		for (size_t i = 0; i < n; ++i) {
+			const uint32_t k = next[bucketOf[i]]++;
+			items[k] = uint32_t(i);
+			sorted[k] = points[i];
+		}
+	}
+
+	// Calls fn(index) for every point within radius of pos, which can be at
+	// most the cell size. Stops early when fn returns false.
+	template <typename F>
+	void query(Vec2 pos, float radius, F fn) const {
+		const int32_t cx = cellOf(pos.x);
+		const int32_t cy = cellOf(pos.y);
+		const float r2 = radius * radius;
+
+		auto scan = [&](uint32_t from, uint32_t to) {
+			for (uint32_t k = starts[from]; k < starts[to]; ++k) {
+				if (distanceSquared(pos, sorted[k]) <= r2 && !fn(items[k])) {
+					return false;
+				}
+			}
+			return true;
+		};
+
+		// The three cells of a row are next to each other unless the row
+		// wraps around between them
+		for (int32_t dy = -1; dy <= 1; ++dy) {
+			const uint32_t row = uint32_t(cy + dy) % height * width;
+			const uint32_t x = uint32_t(cx - 1) % width;
+			if (x + 3 <= width) {
+				if (!scan(row + x, row + x + 3)) {
+					return;
+				}
+				continue;
+			}
+			for (uint32_t dx = 0; dx < 3; ++dx) {
+				const uint32_t b = row + (x + dx) % width;
+				if (!scan(b, b + 1)) {
+					return;
+				}
+			}
+		}
+	}
+
+private:
+	int32_t cellOf(float v) const {
+		return int32_t(std::floor(v / cellSize));
+	}
+
+	uint32_t bucket(int32_t x, int32_t y) const {
+		return uint32_t(y) % height * width + uint32_t(x) % width;
+	}
+
+	float cellSize;
+	uint32_t width{0};  // In cells, a power of two
+	uint32_t height{0};
+	std::vector<uint32_t> starts; // Of each bucket in items, plus the end
+	std::vector<uint32_t> items;
+	std::vector<Vec2> sorted; // Points in the order of items
+	std::vector<uint32_t> bucketOf;
+	std::vector<uint32_t> next;
+};
+
+#endif
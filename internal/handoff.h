@@ -0,0 +1,50 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+// Passing data from one thread to one other without locks.
+
+// Bounded first in, first out queue for exactly one pushing and one popping
+// thread. Capacity is a power of two.
+template <typename T>
+class SpscQueue {
+public:
+	SpscQueue(size_t capacity)
+	: slots(capacity)
+	{}
+
+	SpscQueue(const SpscQueue&) = delete;
+	SpscQueue& operator=(const SpscQueue&) = delete;
+
+	// Leaves v alone and returns false when the queue is full
+	bool push(T& v) {
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == slots.size()) {
+			return false;
+		}
+		slots[t & (slots.size() - 1)] = std::move(v);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& v) {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+		v = std::move(slots[h & (slots.size() - 1)]);
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	std::vector<T> slots;
+	alignas(64) std::atomic<size_t> head{0}; // Popped so far
+	alignas(64) std::atomic<size_t> tail{0}; // Pushed so far
+};
+
+#endif
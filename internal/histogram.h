@@ -0,0 +1,101 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <algorithm>
+
+
+// Log-linear histogram of non-negative integer samples in the spirit of
+// HdrHistogram. Values below 64 are exact, larger ones land in buckets that
+// are at most ~3% wide, which keeps recording O(1) and the size fixed.
+class Histogram {
+	static constexpr int subBits = 5;
+	static constexpr uint64_t subCount = 1 << subBits;
+	static constexpr size_t bucketCount = (64 - subBits + 1) * subCount;
+
+public:
+	void record(uint64_t value, uint64_t n = 1) {
+		buckets[index(value)] += n;
+		count_ += n;
+		sum += value * n;
+		min_ = std::min(min_, value);
+		max_ = std::max(max_, value);
+	}
+
+	void merge(const Histogram& other) {
+		for (size_t i = 0; i < bucketCount; ++i) {
+			buckets[i] += other.buckets[i];
+		}
+		count_ += other.count_;
+		sum += other.sum;
+		min_ = std::min(min_, other.min_);
+		max_ = std::max(max_, other.max_);
+	}
+
+	void reset() {
+		*this = Histogram{};
+	}
+
+	// Value at the given percentile in range [0, 100]
+	uint64_t percentile(double p) const {
+		if (count_ == 0) {
+			return 0;
+		}
+
+		const uint64_t rank = std::max<uint64_t>(1, p / 100 * count_ + 0.5);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucketCount; ++i) {
+			seen += buckets[i];
+			if (seen >= rank) {
+				return std::clamp(value(i), min_, max_);
+			}
+		}
+		return max_;
+	}
+
+	uint64_t count() const {
+		return count_;
+	}
+
+	uint64_t min() const {
+		return count_ > 0 ? min_ : 0;
+	}
+
+	uint64_t max() const {
+		return max_;
+	}
+
+	double mean() const {
+		return count_ > 0 ? 1.0 * sum / count_ : 0;
+	}
+
+private:
+	static size_t index(uint64_t v) {
+		if (v < 2 * subCount) {
+			return v;
+		}
+		const int msb = std::bit_width(v) - 1;
+		const int shift = msb - subBits;
+		return (shift + 1) * subCount + (v >> shift) - subCount;
+	}
+
+	// Middle of the bucket
+	static uint64_t value(size_t idx) {
+		if (idx < 2 * subCount) {
+			return idx;
+		}
+		const int shift = idx / subCount - 1;
+		const uint64_t lower = (idx % subCount + subCount) << shift;
+		return lower + ((uint64_t(1) << shift) >> 1);
+	}
+
+	std::array<uint64_t, bucketCount> buckets{};
+	uint64_t count_{0};
+	uint64_t sum{0};
+	uint64_t min_{UINT64_MAX};
+	uint64_t max_{0};
+};
+
+#endif
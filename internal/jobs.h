@@ -0,0 +1,260 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+// Small work-stealing job system. Every worker has its own deque and takes
+// work from its back, idle workers steal from the front of the others. The
+// thread that waits for jobs runs them as well, so a JobSystem with no
+// workers runs everything on the caller inside wait().
+class JobSystem {
+	struct Job;
+
+public:
+	// Counts unfinished jobs. Jobs started after a counter wait for it to
+	// reach zero, so all jobs of a counter have to be started before anything
+	// that depends on it.
+	class Counter {
+	public:
+		Counter() = default;
+		Counter(const Counter&) = delete;
+		Counter& operator=(const Counter&) = delete;
+
+		// The last job to finish holds the mutex while it reaches zero, so
+		// once this is true the counter can go out of scope
+		bool done() const {
+			if (pending.load(std::memory_order_acquire) != 0) {
+				return false;
+			}
+			std::lock_guard lock{m};
+			return true;
+		}
+
+	private:
+		friend class JobSystem;
+
+		std::atomic<int> pending{0};
+		mutable std::mutex m;
+		std::vector<Job> waiting; // Started after this, released when it reaches zero
+	};
+
+	JobSystem(unsigned workers)
+	: queues(workers + 1)
+	{
+		for (auto& q : queues) {
+			q = std::make_unique<Queue>();
+		}
+		for (unsigned i = 1; i <= workers; ++i) {
+			threads.emplace_back([this, i] { work(i); });
+		}
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard lock{sleepMutex};
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& t : threads) {
+			t.join();
+		}
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	unsigned workers() const {
+		return threads.size();
+	}
+
+	// Runs fn once after has reached zero, counting it in done
+	void run(Counter* after, Counter& done, std::function<void()> fn) {
+		done.pending.fetch_add(1, std::memory_order_relaxed);
+		Job job{std::move(fn), &done};
+
+		if (after) {
+			std::lock_guard lock{after->m};
+			if (after->pending.load(std::memory_order_acquire) != 0) {
+				after->waiting.push_back(std::move(job));
+				return;
+			}
+		}
+		push(std::move(job));
+	}
+
+	void run(Counter& done, std::function<void()> fn) {
+		run(nullptr, done, std::move(fn));
+	}
+
+	// Splits [0, n) into chunks of grain indices and runs fn(chunk, begin, end)
+	// for each of them after has reached zero. The chunks only depend on n and
+	// grain, so results collected per chunk can be merged in a deterministic
+	// order. Returns the number of chunks.
+	template <typename F>
+	size_t parallelFor(Counter* after, Counter& done, size_t n, size_t grain, F fn) {
+		const size_t count = chunks(n, grain);
+		for (size_t c = 0; c < count; ++c) {
+			const size_t begin = c * grain;
+			const size_t end = std::min(n, begin + grain);
+			run(after, done, [fn, c, begin, end] { fn(c, begin, end); });
+		}
+		return count;
+	}
+
+	// Number of chunks parallelFor() makes, to size per chunk results up front
+	static size_t chunks(size_t n, size_t grain) {
+		grain = std::max<size_t>(grain, 1);
+		return (n + grain - 1) / grain;
+	}
+
+	// Runs jobs until counter reaches zero, rethrows the first exception a
+	// job threw since the last wait
+	void wait(const Counter& counter) {
+		const unsigned self = current == this ? index : 0;
+		while (!counter.done()) {
+			if (!runOne(self)) {
+				std::this_thread::yield();
+			}
+		}
+
+		std::lock_guard lock{errorMutex};
+		if (error) {
+			std::rethrow_exception(std::exchange(error, nullptr));
+		}
+	}
+
+private:
+	struct Job {
+		std::function<void()> fn;
+		Counter* done;
+	};
+
+	struct Queue {
+		std::mutex m;
+		std::deque<Job> jobs;
+	};
+
+	// Jobs started by a worker go to its own deque, everything else to the
+	// deque of the waiting thread at index 0
+	void push(Job job) {
+		auto& q = *queues[current == this ? index : 0];
+		{
+			std::lock_guard lock{q.m};
+			q.jobs.push_back(std::move(job));
+		}
+		queued.fetch_add(1, std::memory_order_release);
+
+		if (!threads.empty()) {
+			{ std::lock_guard lock{sleepMutex}; }
+			wake.notify_one();
+		}
+	}
+
+	bool pop(unsigned i, Job& job) {
+		auto& q = *queues[i];
+		std::lock_guard lock{q.m};
+		if (q.jobs.empty()) {
+			return false;
+		}
+		job = std::move(q.jobs.back());
+		q.jobs.pop_back();
+		return true;
+	}
+
+	bool steal(unsigned i, Job& job) {
+		auto& q = *queues[i];
+		std::lock_guard lock{q.m};
+		if (q.jobs.empty()) {
+			return false;
+		}
+		job = std::move(q.jobs.front());
+		q.jobs.pop_front();
+		return true;
+	}
+
+	bool runOne(unsigned self) {
+		Job job;
+		bool found = pop(self, job);
+		for (unsigned k = 1; !found && k < queues.size(); ++k) {
+			found = steal((self + k) % queues.size(), job);
+		}
+		if (!found) {
+			return false;
+		}
+		queued.fetch_sub(1, std::memory_order_relaxed);
+
+		try {
+			job.fn();
+		} catch (...) {
+			std::lock_guard lock{errorMutex};
+			if (!error) {
+				error = std::current_exception();
+			}
+		}
+		finish(*job.done);
+		return true;
+	}
+
+	void finish(Counter& counter) {
+		int n = counter.pending.load(std::memory_order_relaxed);
+		while (n > 1) {
+			if (counter.pending.compare_exchange_weak(n, n - 1, std::memory_order_acq_rel)) {
+				return;
+			}
+		}
+
+		std::vector<Job> released;
+		{
+			std::lock_guard lock{counter.m};
+			if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				released.swap(counter.waiting);
+			}
+		}
+		for (auto& job : released) {
+			push(std::move(job));
+		}
+	}
+
+	void work(unsigned i) {
+		current = this;
+		index = i;
+		while (true) {
+			if (runOne(i)) {
+				continue;
+			}
+
+			std::unique_lock lock{sleepMutex};
+			wake.wait(lock, [this] {
+				return stopping || queued.load(std::memory_order_acquire) > 0;
+			});
+			if (stopping) {
+				return;
+			}
+		}
+	}
+
+	static inline thread_local JobSystem* current{nullptr};
+	static inline thread_local unsigned index{0};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> queued{0};
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool stopping{false};
+	std::mutex errorMutex;
+	std::exception_ptr error;
+};
+
+#endif
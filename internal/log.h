@@ -0,0 +1,248 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+
+// Asynchronous logging. LOG_* calls copy the format string pointer and the
+// arguments into a ring owned by the calling thread and return, a background
+// thread does the formatting and the writing. A full ring drops the record
+// instead of blocking the caller.
+//
+// Formats use printf syntax and are checked at compile time. The format must
+// be a string literal, strings passed for %s are copied up to maxString.
+// Levels below LOG_LEVEL are compiled out along with their arguments.
+
+namespace logging {
+
+enum Level {
+	Debug,
+	Info,
+	Warn,
+	Error
+};
+
+}
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL logging::Info
+#endif
+
+#define LOG_AT(level, ...) do { \
+	if constexpr (level >= LOG_LEVEL) { \
+		if (false) { std::printf(__VA_ARGS__); } \
+		logging::write(level, __VA_ARGS__); \
+	} \
+} while (0)
+
+#define LOG_DEBUG(...) LOG_AT(logging::Debug, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(logging::Info, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(logging::Warn, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(logging::Error, __VA_ARGS__)
+
+namespace logging {
+
+constexpr size_t maxString = 96;
+constexpr size_t maxArgs = 224;
+constexpr size_t ringSize = 1024;
+
+struct Record {
+	using Format = int(*)(const Record&, char*, size_t);
+
+	Format format;
+	const char* fmt;
+	Level level;
+	alignas(8) char args[maxArgs];
+};
+
+// Strings can't be referenced after the call returns so they are copied
+struct String {
+	char s[maxString];
+};
+
+template <typename T>
+struct Stored {
+	using type = T;
+	static T store(T v) { return v; }
+	static T load(const T& v) { return v; }
+};
+
+template <>
+struct Stored<const char*> {
+	using type = String;
+
+	static String store(const char* v) {
+		String str;
+		std::strncpy(str.s, v ? v : "(null)", maxString - 1);
+		str.s[maxString - 1] = '\0';
+		return str;
+	}
+
+	static const char* load(const String& v) { return v.s; }
+};
+
+template <>
+struct Stored<char*> : Stored<const char*> {};
+
+template <typename T>
+using Arg = Stored<std::decay_t<T>>;
+
+template <typename... Args>
+int format(const Record& r, char* buf, size_t n) {
+	using Packed = std::tuple<typename Arg<Args>::type...>;
+	const auto& packed = *std::launder(reinterpret_cast<const Packed*>(r.args));
+	return std::apply([&](const auto&... args) {
+		return std::snprintf(buf, n, r.fmt, Arg<Args>::load(args)...);
+	}, packed);
+}
+
+// Single producer single consumer queue, the producer is the owning thread
+// and the consumer is the logger thread
+class Ring {
+public:
+	Record* claim() {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == ringSize) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		return &records[h % ringSize];
+	}
+
+	void commit() {
+		head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	const Record* front() {
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+		return &records[t % ringSize];
+	}
+
+	void pop() {
+		tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	std::atomic<uint64_t> dropped{0};
+
+private:
+	std::array<Record, ringSize> records;
+	alignas(64) std::atomic<size_t> head{0};
+	alignas(64) std::atomic<size_t> tail{0};
+};
+
+class Logger {
+public:
+	static Logger& instance() {
+		static Logger logger;
+		return logger;
+	}
+
+	Ring& ring() {
+		thread_local std::shared_ptr<Ring> ring = add();
+		return *ring;
+	}
+
+	~Logger() {
+		running = false;
+		thread.join();
+		drain();
+	}
+
+private:
+	Logger()
+	: thread{[this] { run(); }}
+	{}
+
+	std::shared_ptr<Ring> add() {
+		auto ring = std::make_shared<Ring>();
+		std::lock_guard lock{mtx};
+		rings.push_back(ring);
+		return ring;
+	}
+
+	void run() {
+		while (running) {
+			if (!drain()) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	// Returns true if anything was written
+	bool drain() {
+		static constexpr const char* names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+		std::lock_guard lock{mtx};
+		bool wrote = false;
+		char buf[512];
+
+		for (auto it = rings.begin(); it != rings.end();) {
+			Ring& ring = **it;
+			while (const Record* r = ring.front()) {
+				r->format(*r, buf, sizeof buf);
+				std::fprintf(r->level >= Warn ? stderr : stdout, "%s\t %s\n", names[r->level], buf);
+				ring.pop();
+				wrote = true;
+			}
+
+			if (const auto n = ring.dropped.exchange(0, std::memory_order_relaxed); n > 0) {
+				std::fprintf(stderr, "WARN\t dropped %lu log records\n", (unsigned long)n);
+				wrote = true;
+			}
+
+			// Owning thread has exited and everything it wrote is out
+			if (it->use_count() == 1) {
+				it = rings.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		if (wrote) {
+			std::fflush(stdout);
+			std::fflush(stderr);
+		}
+		return wrote;
+	}
+
+	std::mutex mtx;
+	std::vector<std::shared_ptr<Ring>> rings;
+	std::atomic<bool> running{true};
+	std::thread thread;
+};
+
+template <typename... Args>
+void write(Level level, const char* fmt, const Args&... args) {
+	using Packed = std::tuple<typename Arg<Args>::type...>;
+	static_assert(sizeof (Packed) <= maxArgs, "too many log arguments");
+	static_assert(std::is_trivially_destructible_v<Packed>, "log arguments must be trivial");
+
+	Ring& ring = Logger::instance().ring();
+	Record* r = ring.claim();
+	if (!r) {
+		return;
+	}
+
+	r->format = &format<Args...>;
+	r->fmt = fmt;
+	r->level = level;
+	new (r->args) Packed{Arg<Args>::store(args)...};
+	ring.commit();
+}
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <format>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Read only view of a whole file. Memory mapped where we know how, read into
+// memory elsewhere.
+class MappedFile {
+public:
+	MappedFile(const char* path) {
+#ifdef _WIN32
+		std::ifstream in{path, std::ios::binary};
+		if (!in) {
+			throw std::runtime_error(std::format("unable to open {}", path));
+		}
+		contents.assign(std::istreambuf_iterator<char>{in}, {});
+		data = contents.data();
+		size = contents.size();
+#else
+		const int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error(std::format("unable to open {}", path));
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				data = static_cast<const char*>(p);
+				size = st.st_size;
+			}
+		}
+		close(fd);
+
+		if (!data) {
+			throw std::runtime_error(std::format("unable to map {}", path));
+		}
+#endif
+	}
+
+	~MappedFile() {
+#ifndef _WIN32
+		munmap(const_cast<char*>(data), size);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* data{nullptr};
+	size_t size{0};
+
+private:
+#ifdef _WIN32
+	std::vector<char> contents;
+#endif
+};
+
+#endif
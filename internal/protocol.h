@@ -2,14 +2,17 @@
 #define PROTOCOL_H
 
 #include <cstdint>
+#include <chrono>
 #include <memory>
 #include <cstring>
-#include "rl.h"
+#include "vec.h"
+#include "world.h"
 #include "connection.h"
 
 namespace proto {
 
 using ID = uint32_t;
+using Tick = uint32_t;
 
 constexpr float playerSpeed = 15.f;
 constexpr float bulletSpeed = 100.0f;
@@ -17,11 +20,39 @@ constexpr float playerRadius = 5.f / 6;
 constexpr float enemyRadius = 1.f;
 constexpr float bulletRadius = 0.1f;
 constexpr uint32_t maxHealth{100};
+constexpr auto bulletLifetime = std::chrono::milliseconds(1000);
+// Snapshots are filled up to this many bytes so they fit a single datagram
+constexpr size_t maxSnapshotSize = 1200;
 
 constexpr Channel moveChannel = openChannelStart + 1;
 constexpr Channel shootChannel = openChannelStart + 2;
 constexpr Channel updateChannel = openChannelStart + 3;
 constexpr Channel mouseMoveChannel = openChannelStart + 4;
+constexpr Channel eventChannel = openChannelStart + 5;
+constexpr Channel chunkChannel = openChannelStart + 6;
+constexpr Channel hitscanChannel = openChannelStart + 7;
+constexpr Channel spectateChannel = openChannelStart + 8;
+
+constexpr float hitscanRange = 60.f;
+constexpr uint32_t bulletDamage = 20;
+constexpr uint32_t hitscanDamage = 35;
+
+constexpr float npcSpeed = 8.f;
+constexpr uint32_t npcHealth = 40;
+constexpr uint32_t npcDamage = 10;
+constexpr auto npcAttackInterval = std::chrono::milliseconds(1000);
+
+// Clients get sent the world chunks within chunkViewRadius of their player
+// and the server forgets having sent those beyond chunkKeepRadius. Clients
+// drop chunks a chunk further out, so nothing the server thinks they have
+// is gone. Radii are in chunks in either direction.
+constexpr int32_t chunkViewRadius = 2;
+constexpr int32_t chunkKeepRadius = 4;
+
+// Entities within this distance are left out of snapshots while a block hides
+// them from the player, further ones are off its screen anyway. Clients drop
+// them as soon as they are hidden rather than wait for them to go stale.
+constexpr float occlusionDistance = 60.f;
 
 struct Header {
 	ID playerId;
@@ -33,42 +64,90 @@ struct Stats {
 	uint32_t deaths{0};
 };
 
+// Kinematic state only, everything else changes rarely and is sent as Events
 struct Player {
 	ID id;
-	rl::Vector2 pos{0, 0};
-	rl::Vector2 velo{0, 0};
-	Stats stats;
-	Clock::time_point createdAt{Clock::now()};
-	rl::Vector2 target{0, 0};
-	uint32_t health{maxHealth};
+	Vec2 pos{0, 0};
+	Vec2 velo{0, 0};
+	Vec2 target{0, 0};
 };
 
 struct Bullet {
-	rl::Vector2 pos;
-	rl::Vector2 velo;
+	Vec2 pos;
+	Vec2 velo;
 	ID shooterID;
-	Clock::time_point createdAt{Clock::now()};
+	ID id{0};
+};
+
+// Server controlled enemies of everyone, with enemyRadius
+struct Npc {
+	ID id;
+	Vec2 pos;
+	Vec2 velo;
 };
 
-struct GameState {
-	Player players[64];
-	uint64_t numPlayers;
-	Bullet bullets[128];
-	uint64_t numBullets;
+// Snapshots are sent on the updateChannel as a Snapshot followed by
+// numPlayers Players, numBullets Bullets and numNpcs Npcs. A snapshot only
+// carries the entities the server considered most relevant to the receiver
+// this time.
+struct Snapshot {
+	Tick tick;
+	uint16_t numPlayers;
+	uint16_t numBullets;
+	uint16_t numNpcs;
+};
+
+// Events are sent reliably and in order on the eventChannel, a Header is
+// followed by one or more Events.
+struct Event {
+	enum class Type : uint32_t {
+		Join,   // subject joined with stats and health
+		Leave,  // subject left, or was an npc that died
+		Damage, // other hit subject leaving it with health
+		Kill    // other killed subject, subject respawned with full health
+	};
+	Type type;
+	ID subject;
+	ID other{0};
+	Stats stats{};
+	uint32_t health{maxHealth};
+};
+
+// Chunks are sent reliably and in order on the chunkChannel, a Header is
+// followed by a ChunkPart and its numBlocks Blocks. Chunks too big for one
+// message come in parts, a part at offset 0 replaces what the client had.
+struct ChunkPart {
+	ChunkCoord coord;
+	uint32_t offset;
+	uint32_t numBlocks;
 };
 
 struct Move {
-	rl::Vector2 velo;
+	Vec2 velo;
 };
 
 struct MouseMove {
-	rl::Vector2 pos;
+	Vec2 pos;
 };
 
 struct Shoot {
 	Bullet bullet;
 };
 
+// Sent reliably on the spectateChannel to watch instead of play, to the
+// server or to a relay of it. Snapshots, events and chunks then come as they
+// would to the followed player, 0 follows whoever is playing. Sending it
+// again switches players.
+struct Spectate {
+	ID follow{0};
+};
+
+// An instant shot from the shooter's position along dir, hitting the first
+// player within hitscanRange that no block is in front of
+struct Hitscan {
+	Vec2 dir;
+};
+
 static std::pair<char*, size_t> makeMessage(Header header, const void* data) {
 	const size_t n = sizeof header + header.payloadSize;
 	char* buf = new char[n];
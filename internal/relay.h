@@ -0,0 +1,206 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <cstring>
+#include <deque>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "protocol.h"
+#include "scoreboard.h"
+#include "server.h"
+
+
+// Sends what one spectator of a match gets on to many spectators of its own,
+// held back by the delay. Keeps the scoreboard and the chunks around the
+// followed player it has sent, so spectators that come later are caught up
+// before anything else goes to them.
+class Relay {
+public:
+	Relay(Server& server, Clock::duration delay)
+	: server{server},
+	  delay{delay}
+	{}
+
+	Relay(const Relay&) = delete;
+	Relay& operator=(const Relay&) = delete;
+
+	// A snapshot, events or a chunk part from upstream
+	void receive(Channel channel, const char* data, size_t n, Clock::time_point now) {
+		delayed.push_back({now + delay, channel, {data, data + n}});
+	}
+
+	// Sends on everything whose delay is over
+	void release(Clock::time_point now) {
+		while (!delayed.empty() && delayed.front().releaseAt <= now) {
+			release(delayed.front());
+			delayed.pop_front();
+		}
+	}
+
+	// Which player to follow is up to the upstream subscription, what
+	// spectators ask for is only for the server
+	void subscribe(const udp::endpoint& ep) {
+		if (spectators.insert(ep).second) {
+			catchUp(ep);
+			LOG_INFO("spectator connected %s:%d, %lu watching", ep.address().to_string().c_str(), ep.port(),
+			         spectators.size());
+		}
+	}
+
+	void dropTimedOut(Clock::duration timeout) {
+		for (auto it = spectators.begin(); it != spectators.end();) {
+			if (server.getPing(*it) > timeout) {
+				LOG_INFO("spectator %s:%d timed out", it->address().to_string().c_str(), it->port());
+				server.disconnect(*it);
+				it = spectators.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+
+	size_t getSpectators() const {
+		return spectators.size();
+	}
+
+	proto::ID getFollowed() const {
+		return followed;
+	}
+
+	// Messages waiting for their delay to pass
+	size_t getHeld() const {
+		return delayed.size();
+	}
+
+	size_t getChunks() const {
+		return chunks.size();
+	}
+
+private:
+	struct Message {
+		Clock::time_point releaseAt;
+		Channel channel;
+		std::vector<char> data;
+	};
+
+	// The scoreboard as Join events and the kept chunks, sent reliably
+	void catchUp(const udp::endpoint& ep) {
+		constexpr size_t maxEvents = (proto::maxSnapshotSize - sizeof (proto::Header)) / sizeof (proto::Event);
+		char buf[sizeof (proto::Header) + maxEvents * sizeof (proto::Event)];
+
+		const auto joins = scoreboard.joins();
+		for (size_t i = 0; i < joins.size(); i += maxEvents) {
+			const size_t count = std::min(maxEvents, joins.size() - i);
+			const proto::Header h{followed, count * sizeof (proto::Event)};
+			std::memcpy(buf, &h, sizeof h);
+			std::memcpy(buf + sizeof h, joins.data() + i, h.payloadSize);
+			server.writeReliable(proto::eventChannel, ep, buf, sizeof h + h.payloadSize);
+		}
+
+		for (const auto& [_, parts] : chunks) {
+			for (const auto& part : parts) {
+				server.writeReliable(proto::chunkChannel, ep, part.data(), part.size());
+			}
+		}
+	}
+
+	// Sends the message on to every spectator, keeping track of what they
+	// have. Malformed messages go no further.
+	void release(const Message& m) {
+		const char* data = m.data.data();
+		const size_t n = m.data.size();
+		proto::Header h;
+		if (n < sizeof h) {
+			LOG_ERROR("message on channel %d shorter than its header", m.channel);
+			return;
+		}
+		std::memcpy(&h, data, sizeof h);
+		if (h.payloadSize != n - sizeof h) {
+			LOG_ERROR("invalid payload size on channel %d", m.channel);
+			return;
+		}
+
+		if (m.channel == proto::updateChannel) {
+			proto::Snapshot snapshot;
+			if (n < sizeof h + sizeof snapshot) {
+				LOG_ERROR("invalid snapshot");
+				return;
+			}
+			std::memcpy(&snapshot, data + sizeof h, sizeof snapshot);
+			if (h.payloadSize != sizeof snapshot + snapshot.numPlayers * sizeof (proto::Player)
+					+ snapshot.numBullets * sizeof (proto::Bullet) + snapshot.numNpcs * sizeof (proto::Npc)) {
+				LOG_ERROR("invalid snapshot");
+				return;
+			}
+			followed = h.playerId;
+
+			// Upstream forgets having sent chunks this far from the player, and
+			// sends them again if it comes back
+			for (int i = 0; i < snapshot.numPlayers; ++i) {
+				proto::Player p;
+				std::memcpy(&p, data + sizeof h + sizeof snapshot + i * sizeof p, sizeof p);
+				if (p.id == followed) {
+					const ChunkCoord center = World::chunkOf(p.pos);
+					std::erase_if(chunks, [center](const auto& item) {
+						const ChunkCoord c = World::coordOf(item.first);
+						return std::abs(c.x - center.x) > proto::chunkKeepRadius
+							|| std::abs(c.y - center.y) > proto::chunkKeepRadius;
+					});
+					break;
+				}
+			}
+
+			for (const auto& ep : spectators) {
+				server.write(proto::updateChannel, ep, data, n);
+			}
+			return;
+		}
+
+		if (m.channel == proto::eventChannel) {
+			if (h.payloadSize % sizeof (proto::Event) != 0) {
+				LOG_ERROR("invalid events");
+				return;
+			}
+			for (size_t i = 0; i < h.payloadSize / sizeof (proto::Event); ++i) {
+				proto::Event e;
+				std::memcpy(&e, data + sizeof h + i * sizeof e, sizeof e);
+				scoreboard.apply(e);
+			}
+		} else if (m.channel == proto::chunkChannel) {
+			proto::ChunkPart part;
+			if (n < sizeof h + sizeof part) {
+				LOG_ERROR("invalid chunk");
+				return;
+			}
+			std::memcpy(&part, data + sizeof h, sizeof part);
+			if (h.payloadSize != sizeof part + part.numBlocks * sizeof (Block)) {
+				LOG_ERROR("invalid chunk");
+				return;
+			}
+			// A part at offset 0 replaces the chunk
+			auto& parts = chunks[World::key(part.coord)];
+			if (part.offset == 0) {
+				parts.clear();
+			}
+			parts.push_back(m.data);
+		} else {
+			LOG_ERROR("nothing to relay on channel %d", m.channel);
+			return;
+		}
+
+		for (const auto& ep : spectators) {
+			server.writeReliable(m.channel, ep, data, n);
+		}
+	}
+
+	Server& server;
+	Clock::duration delay;
+	std::set<udp::endpoint> spectators;
+	std::deque<Message> delayed;
+	Scoreboard scoreboard; // Of the events sent on
+	std::unordered_map<uint64_t, std::vector<std::vector<char>>> chunks; // Messages of each chunk, in order
+	proto::ID followed{0};
+};
+
+#endif
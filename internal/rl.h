@@ -1,8 +1,19 @@
 #ifndef RL_H
 #define RL_H
 
+#include "vec.h"
+
 namespace rl {
 #include <raylib.h>
 }
 
+// Game code works in Vec2, raylib only sees its own type at the draw calls
+inline rl::Vector2 toRl(Vec2 v) {
+	return {v.x, v.y};
+}
+
+inline Vec2 fromRl(rl::Vector2 v) {
+	return {v.x, v.y};
+}
+
 #endif
@@ -0,0 +1,118 @@
+#ifndef SCOREBOARD_H
+#define SCOREBOARD_H
+
+#include <algorithm>
+#include <format>
+#include <string>
+#include <vector>
+#include "protocol.h"
+
+// Scoreboard kept up to date from the server's events. Rows stay sorted and
+// the text is only rebuilt when something on it changed.
+class Scoreboard {
+	struct Row {
+		proto::ID id;
+		proto::Stats stats;
+		uint32_t health;
+	};
+
+public:
+	void apply(const proto::Event& e) {
+		switch (e.type) {
+		case proto::Event::Type::Join:
+			if (Row* row = find(e.subject)) {
+				row->stats = e.stats;
+				row->health = e.health;
+			} else {
+				rows.push_back({e.subject, e.stats, e.health});
+			}
+			break;
+		case proto::Event::Type::Leave:
+			std::erase_if(rows, [&e](const Row& row) {
+				return row.id == e.subject;
+			});
+			break;
+		case proto::Event::Type::Damage:
+			if (Row* row = find(e.subject)) {
+				row->health = e.health;
+			}
+			// Health is not on the scoreboard
+			return;
+		case proto::Event::Type::Kill:
+			if (Row* row = find(e.subject)) {
+				row->stats = e.stats;
+				row->health = e.health;
+			}
+			if (Row* row = find(e.other)) {
+				row->stats.kills++;
+			}
+			break;
+		}
+
+		// Ties stay in join order
+		std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+			return score(a) > score(b);
+		});
+		dirty = true;
+	}
+
+	uint32_t health(proto::ID id) const {
+		auto it = std::find_if(rows.begin(), rows.end(), [id](const Row& row) {
+			return row.id == id;
+		});
+		return it != rows.end() ? it->health : proto::maxHealth;
+	}
+
+	proto::Stats stats(proto::ID id) const {
+		auto it = std::find_if(rows.begin(), rows.end(), [id](const Row& row) {
+			return row.id == id;
+		});
+		return it != rows.end() ? it->stats : proto::Stats{};
+	}
+
+	// Brings a scoreboard that missed the events so far up to this one
+	std::vector<proto::Event> joins() const {
+		std::vector<proto::Event> events;
+		for (const auto& row : rows) {
+			events.push_back({proto::Event::Type::Join, row.id, 0, row.stats, row.health});
+		}
+		return events;
+	}
+
+	const std::string& text(proto::ID self) {
+		if (dirty || self != textFor) {
+			text_.clear();
+			for (const auto& row : rows) {
+				const float kd = row.stats.deaths > 0 ? 1.0f * row.stats.kills / row.stats.deaths : row.stats.kills;
+				text_ += std::format("ID: {:<6}\tKILLS: {:<6}\tDEATHS: {:<6}\tK/D: {:<6.1f}",
+					row.id, row.stats.kills, row.stats.deaths, kd);
+				if (row.id == self) {
+					text_ += " <--- YOU";
+				}
+				text_ += '\n';
+			}
+			textFor = self;
+			dirty = false;
+		}
+		return text_;
+	}
+
+private:
+	static int64_t score(const Row& row) {
+		return int64_t(row.stats.kills) - row.stats.deaths;
+	}
+
+	Row* find(proto::ID id) {
+		auto it = std::find_if(rows.begin(), rows.end(), [id](const Row& row) {
+			return row.id == id;
+		});
+		return it != rows.end() ? &*it : nullptr;
+	}
+
+	std::vector<Row> rows;
+	std::string text_;
+	proto::ID textFor{0};
+	bool dirty{true};
+};
+
+#endif
@@ -3,11 +3,29 @@
 
 #include <asio.hpp>
 #include "connection.h"
+#include "log.h"
+#include "histogram.h"
+#include "archive.h"
+#include <optional>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
 
 using udp = asio::ip::udp;
 
+// The server only speaks IPv4
+static void writeEndpoint(Writer& w, const udp::endpoint& ep) {
+	w.write(ep.address().to_v4().to_uint());
+	w.write(ep.port());
+}
+
+static udp::endpoint readEndpoint(Reader& r) {
+	const auto address = r.read<asio::ip::address_v4::uint_type>();
+	return {asio::ip::address_v4{address}, r.read<unsigned short>()};
+}
+
 
 class Server {
 	struct Message {
@@ -18,6 +36,17 @@ class Server {
 	struct ReliableMessage {
 		Header h;
 		Message msg;
+		Clock::time_point sentAt{Clock::now()};
+	};
+
+	struct ChannelStats {
+		uint64_t packetsIn{0};
+		uint64_t bytesIn{0};
+		uint64_t packetsOut{0};
+		uint64_t bytesOut{0};
+		uint64_t resends{0};
+		uint64_t duplicates{0};  // Reliable messages we had already received
+		uint64_t outOfOrder{0};  // Messages dropped for arriving after a newer one
 	};
 
 	struct ChannelInfo {
@@ -27,6 +56,7 @@ class Server {
 		uint32_t receiveReliableID{0};
 
 		std::map<uint32_t, ReliableMessage> unConfirmed;
+		ChannelStats stats;
 	};
 
 	struct PeerInfo {
@@ -35,26 +65,61 @@ class Server {
 		Clock::time_point prevPing{Clock::now()};
 		uint32_t prevPingID{0};
 		uint32_t prevReceivedPingID{0};
+
+		// Congestion control, estimated from the ping round trips
+		Clock::duration rttVar{0};
+		Clock::duration minRtt{Clock::duration::max()};
+		float loss{0};                 // Smoothed fraction of lost pings
+		uint64_t bytesSent{0};
+		uint64_t bytesDelivered{0};    // Sent bytes scaled by the loss estimate
+		uint64_t bytesSentAtPing{0};
+		float throughput{0};           // Smoothed delivered bytes per second
+		float budget{initialBudget};   // Allowed bytes per second
+		float tokens{initialBudget / 10};
+		Clock::time_point tokensAt{Clock::now()};
+		Clock::time_point prevDecrease{Clock::now()};
+
+		Histogram rtt;  // Microseconds, every ping round trip since connecting
+		Clock::time_point connectedAt{Clock::now()};
 	};
 
 public:
 	using Listener = std::function<void(const udp::endpoint& ep, char* data, size_t datalen)>;
-	Server(unsigned short port)
-	: socket{ioc, udp::endpoint{udp::v4(), port}},
-	  pingTimer{ioc}
+
+	struct Stats {
+		uint64_t packetsIn{0};
+		uint64_t bytesIn{0};
+		uint64_t packetsOut{0};
+		uint64_t bytesOut{0};
+		uint64_t resends{0};
+		uint64_t duplicates{0};
+		uint64_t outOfOrder{0};
+	};
+
+	Server(unsigned short port, const Conditions& conditions = {})
+	: socket{ioc, udp::endpoint{udp::v4(), port}, conditions},
+	  pingTimer{ioc},
+	  resendTimer{ioc}
 	{
 		start();
 	}
 
+	~Server() {
+		if (adminThread.joinable()) {
+			adminIoc.stop();
+			adminThread.join();
+		}
+	}
+
 	void write(Channel ch, const udp::endpoint& peer, const void* data, size_t datalen) {
 		if (!peers.contains(peer)) {
 			peers[peer] = PeerInfo{{{ch, ChannelInfo{}}}};
-			fprintf(stderr, "ERROR\t peerinfo did not exist for %s:%d\n",
+			LOG_ERROR("peerinfo did not exist for %s:%d",
 					peer.address().to_string().c_str(), peer.port());
 		}
 		if (!peers[peer].chInfo.contains(ch)) {
 			peers[peer].chInfo[ch] = ChannelInfo{};
-			fprintf(stderr, "ERROR\t ChannelInfo on channel %d did not exist for %s:%d\n",
+			LOG_ERROR("ChannelInfo on channel %d did not exist for %s:%d",
 					ch, peer.address().to_string().c_str(), peer.port());
 
 		}
@@ -66,17 +131,21 @@ public:
 	void writeReliable(Channel ch, const udp::endpoint& peer, const void* data, size_t datalen) {
 		if (!peers.contains(peer)) {
 			peers[peer] = PeerInfo{{{ch, ChannelInfo{}}}};
-			fprintf(stderr, "ERROR\t peerinfo did not exist for %s:%d\n",
+			LOG_ERROR("peerinfo did not exist for %s:%d",
 					peer.address().to_string().c_str(), peer.port());
 		}
 		if (!peers[peer].chInfo.contains(ch)) {
 			peers[peer].chInfo[ch] = ChannelInfo{};
-			fprintf(stderr, "ERROR\t ChannelInfo on channel %d did not exist for %s:%d\n",
+			LOG_ERROR("ChannelInfo on channel %d did not exist for %s:%d",
 					ch, peer.address().to_string().c_str(), peer.port());
 		}
 
-		send({ch, datalen, Header::Type::Reliable, peers[peer].chInfo[ch].writeReliableID++},
-		     {peer, {(const char*)data, (const char*)data + datalen}});
+		auto& chInfo = peers[peer].chInfo[ch];
+		const Header h{ch, datalen, Header::Type::Reliable, ++chInfo.writeReliableID};
+		const auto& msg = (chInfo.unConfirmed[h.id] = ReliableMessage{
+			h, {peer, {(const char*)data, (const char*)data + datalen}}
+		});
+		send(msg.h, msg.msg);
 	}
 
 	void listen(Channel ch, Listener listener) {
@@ -93,18 +162,154 @@ public:
 			}
 			return info.ping;
 		} else {
-			fprintf(stderr, "ERROR\t unable to peerinfo for %s:%d\n",
+			LOG_ERROR("unable to peerinfo for %s:%d",
 					peer.address().to_string().c_str(), peer.port());
 			return Clock::duration::max();
 		}
 	}
 
-	void poll() {
-		ioc.poll_one();
+	// Forgets the peer along with its unconfirmed messages
+	void disconnect(const udp::endpoint& peer) {
+		peers.erase(peer);
+	}
+
+	// Bytes per second the link to the peer is estimated to carry
+	float getBudget(const udp::endpoint& peer) const {
+		if (auto it = peers.find(peer); it != peers.end()) {
+			return it->second.budget;
+		}
+		return initialBudget;
+	}
+
+	const Stats& getStats() const {
+		return stats;
+	}
+
+	// Answers any datagram to the port on loopback with report(). Receiving,
+	// the percentiles and formatting run on a thread of its own, the thread
+	// polling only copies the stats for it. Throws if the port can't be bound.
+	void enableAdmin(unsigned short port) {
+		admin.emplace(adminIoc, udp::endpoint{asio::ip::address_v4::loopback(), port});
+		receiveAdmin();
+		adminThread = std::thread{[this] {
+			adminIoc.run();
+		}};
+	}
+
+	// Transport statistics in total and per peer and channel as text
+	std::string report() const {
+		return format(snapshot());
+	}
+
+	// Session state of every peer, for a restarted server to carry on where
+	// this one left. Time points are stored as ages so they survive the restart.
+	void save(Writer& w) const {
+		const auto now = Clock::now();
+		w.write(stats);
+		w.write<uint64_t>(peers.size());
+		for (const auto& [peer, info] : peers) {
+			writeEndpoint(w, peer);
+			w.write<uint64_t>(info.chInfo.size());
+			for (const auto& [ch, chInfo] : info.chInfo) {
+				w.write(ch);
+				w.write(chInfo.writeID);
+				w.write(chInfo.writeReliableID);
+				w.write(chInfo.receiveID);
+				w.write(chInfo.receiveReliableID);
+				w.write(chInfo.stats);
+				w.write<uint64_t>(chInfo.unConfirmed.size());
+				for (const auto& [id, rmsg] : chInfo.unConfirmed) {
+					w.write(rmsg.h);
+					w.write(rmsg.msg.payload);
+					w.write(now - rmsg.sentAt);
+				}
+			}
+
+			w.write(info.ping);
+			w.write(now - info.prevPing);
+			w.write(info.prevPingID);
+			w.write(info.prevReceivedPingID);
+			w.write(info.rttVar);
+			w.write(info.minRtt);
+			w.write(info.loss);
+			w.write(info.bytesSent);
+			w.write(info.bytesDelivered);
+			w.write(info.bytesSentAtPing);
+			w.write(info.throughput);
+			w.write(info.budget);
+			w.write(info.tokens);
+			w.write(now - info.tokensAt);
+			w.write(now - info.prevDecrease);
+			w.write(info.rtt);
+			w.write(now - info.connectedAt);
+		}
+	}
+
+	void restore(Reader& r) {
+		const auto now = Clock::now();
+		const auto restoredStats = r.read<Stats>();
+		std::map<udp::endpoint, PeerInfo> restored;
+		for (auto n = r.read<uint64_t>(); n > 0; --n) {
+			const auto peer = readEndpoint(r);
+			auto& info = restored[peer];
+			for (auto channels = r.read<uint64_t>(); channels > 0; --channels) {
+				auto& chInfo = info.chInfo[r.read<Channel>()];
+				chInfo.writeID = r.read<uint32_t>();
+				chInfo.writeReliableID = r.read<uint32_t>();
+				chInfo.receiveID = r.read<uint32_t>();
+				chInfo.receiveReliableID = r.read<uint32_t>();
+				chInfo.stats = r.read<ChannelStats>();
+				for (auto messages = r.read<uint64_t>(); messages > 0; --messages) {
+					ReliableMessage rmsg;
+					rmsg.h = r.read<Header>();
+					r.read(rmsg.msg.payload);
+					rmsg.sentAt = now - r.read<Clock::duration>();
+					rmsg.msg.peer = peer;
+					chInfo.unConfirmed[rmsg.h.id] = std::move(rmsg);
+				}
+			}
+
+			info.ping = r.read<Clock::duration>();
+			info.prevPing = now - r.read<Clock::duration>();
+			info.prevPingID = r.read<uint32_t>();
+			info.prevReceivedPingID = r.read<uint32_t>();
+			info.rttVar = r.read<Clock::duration>();
+			info.minRtt = r.read<Clock::duration>();
+			info.loss = r.read<float>();
+			info.bytesSent = r.read<uint64_t>();
+			info.bytesDelivered = r.read<uint64_t>();
+			info.bytesSentAtPing = r.read<uint64_t>();
+			info.throughput = r.read<float>();
+			info.budget = r.read<float>();
+			info.tokens = r.read<float>();
+			info.tokensAt = now - r.read<Clock::duration>();
+			info.prevDecrease = now - r.read<Clock::duration>();
+			info.rtt = r.read<Histogram>();
+			info.connectedAt = now - r.read<Clock::duration>();
+		}
+
+		stats = restoredStats;
+		peers = std::move(restored);
+	}
+
+	// Returns the number of handlers run
+	size_t poll() {
+		return ioc.poll_one();
 	}
 private:
 	void send(Header h, const Message& msg) {
 		const size_t n = sizeof h + msg.payload.size();
+		stats.packetsOut++;
+		stats.bytesOut += n;
+
+		if (auto it = peers.find(msg.peer); it != peers.end()) {
+			it->second.bytesSent += n;
+			it->second.tokens -= n;
+			auto& c = it->second.chInfo[h.channel].stats;
+			c.packetsOut++;
+			c.bytesOut += n;
+		}
+
 		char* buf = new char[n];
 		std::memcpy(buf, &h, sizeof h);
 		std::memcpy(buf + sizeof h, msg.payload.data(), msg.payload.size());
@@ -114,15 +319,118 @@ private:
 			msg.peer,
 			[buf](std::error_code ec, size_t n) {
 				if (ec) {
-					fprintf(stderr, "ERROR\t send(): %s\n", ec.message().c_str());
+					LOG_ERROR("send(): %s", ec.message().c_str());
 				}
 				delete[] buf;
 		});
 	}
 
+	// What report() shows, copied so it can be put together elsewhere
+	struct PeerReport {
+		udp::endpoint peer;
+		Clock::duration connected;
+		Clock::duration ping;
+		Histogram rtt;
+		float loss;
+		float budget;
+		size_t unconfirmed;
+		std::vector<std::pair<Channel, ChannelStats>> channels;
+	};
+
+	struct Report {
+		Clock::duration uptime;
+		Stats stats;
+		std::vector<PeerReport> peers;
+	};
+
+	Report snapshot() const {
+		const auto now = Clock::now();
+		Report r{now - startedAt, stats, {}};
+		r.peers.reserve(peers.size());
+		for (const auto& [peer, info] : peers) {
+			PeerReport& p = r.peers.emplace_back(PeerReport{peer, now - info.connectedAt, info.ping, info.rtt, info.loss,
+			                                                info.budget, 0, {}});
+			for (const auto& [ch, chInfo] : info.chInfo) {
+				p.unconfirmed += chInfo.unConfirmed.size();
+				p.channels.emplace_back(ch, chInfo.stats);
+			}
+		}
+		return r;
+	}
+
+	static std::string format(const Report& r) {
+		const auto us = [](Clock::duration d) {
+			return (long long)std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+		};
+
+		const Stats& s = r.stats;
+		std::string out = std::format(
+			"uptime_s={} peers={} packets_in={} bytes_in={} packets_out={} bytes_out={} resends={} duplicates={} out_of_order={}\n",
+			us(r.uptime) / 1000000, r.peers.size(), s.packetsIn, s.bytesIn,
+			s.packetsOut, s.bytesOut, s.resends, s.duplicates, s.outOfOrder);
+
+		for (const auto& p : r.peers) {
+			out += std::format(
+				"peer {}:{} connected_s={} rtt_min_us={} rtt_avg_us={} rtt_p99_us={} loss={:.3f} budget_kB/s={:.1f} unconfirmed={}\n",
+				p.peer.address().to_string(), p.peer.port(), us(p.connected) / 1000000,
+				p.rtt.min(), us(p.ping), p.rtt.percentile(99), p.loss, p.budget / 1024, p.unconfirmed);
+
+			for (const auto& [ch, c] : p.channels) {
+				out += std::format(
+					"  channel {} packets_in={} bytes_in={} packets_out={} bytes_out={} resends={} duplicates={} out_of_order={}\n",
+					ch, c.packetsIn, c.bytesIn, c.packetsOut, c.bytesOut, c.resends, c.duplicates, c.outOfOrder);
+			}
+		}
+
+		return out;
+	}
+
+	// On the admin thread. The stats are copied by whoever polls, and the
+	// copy handed back to be formatted and sent.
+	void receiveAdmin() {
+		admin->async_receive_from(
+			asio::buffer(adminBuf, sizeof adminBuf),
+			adminPeer,
+			[this](std::error_code ec, size_t) {
+				if (ec) {
+					LOG_ERROR("admin receive(): %s", ec.message().c_str());
+					receiveAdmin();
+					return;
+				}
+
+				asio::post(ioc, [this, peer = adminPeer] {
+					asio::post(adminIoc, [this, peer, r = std::make_shared<Report>(snapshot())] {
+						sendReport(peer, format(*r));
+					});
+				});
+				receiveAdmin();
+		});
+	}
+
+	// Split on line boundaries so every datagram stays readable
+	void sendReport(const udp::endpoint& peer, std::string text) {
+		auto out = std::make_shared<std::string>(std::move(text));
+		for (size_t begin = 0; begin < out->size();) {
+			size_t end = std::min(out->size(), begin + maxAdminDatagram);
+			if (const size_t nl = out->rfind('\n', end - 1); end < out->size() && nl != std::string::npos && nl >= begin) {
+				end = nl + 1;
+			}
+			admin->async_send_to(
+				asio::buffer(out->data() + begin, end - begin),
+				peer,
+				[out](std::error_code ec, size_t) {
+					if (ec) {
+						LOG_ERROR("admin send(): %s", ec.message().c_str());
+					}
+			});
+			begin = end;
+		}
+	}
+
 	void start() {
 		receive();
 		ping();
+		resend();
 	}
 
 	void receive() {
@@ -131,24 +439,26 @@ private:
 			peer,
 			[this](std::error_code ec, size_t n) {
 				if (ec) {
-					fprintf(stderr, "ERROR\t receive(): %s\n", ec.message().c_str());
+					LOG_ERROR("receive(): %s", ec.message().c_str());
 					receive();
 					return;
 				}
 
 				if (n < sizeof (Header)) {
-					fprintf(stderr, "ERROR\t received less bytes than the header is in length. (%ld bytes)\n", n);
+					LOG_ERROR("received less bytes than the header is in length. (%ld bytes)", n);
 					receive();
 					return;
 				}
 
 				Header h;
 				std::memcpy(&h, bufIn, sizeof h);
+				stats.packetsIn++;
+				stats.bytesIn += n;
 
 				if (n == sizeof h + h.payloadSize) {
 					handleMessage(h);
 				} else {
-					fprintf(stderr, "ERROR\t Invalid payloadSize. (%ld bytes. Should be %ld)\n", 
+					LOG_ERROR("Invalid payloadSize. (%ld bytes. Should be %ld)",
 							h.payloadSize, n - sizeof h);
 				}
 
@@ -160,7 +470,7 @@ private:
 		pingTimer.expires_after(pingInterval);
 		pingTimer.async_wait([this](std::error_code ec) {
 			if (ec) {
-				fprintf(stderr, "ERROR\t %s\n", ec.message().c_str());
+				LOG_ERROR("%s", ec.message().c_str());
 				ping();
 			}
 
@@ -173,9 +483,80 @@ private:
 		});
 	}
 
+	void resend() {
+		resendTimer.expires_after(resendInterval);
+		resendTimer.async_wait([this](std::error_code ec) {
+			if (ec) {
+				LOG_ERROR("%s", ec.message().c_str());
+			}
+
+			const auto now = Clock::now();
+			for (auto& [peer, info] : peers) {
+				refill(info, now);
+				const auto rto = std::max<Clock::duration>(info.ping + 4 * info.rttVar, resendInterval);
+
+				// Resends wait for budget so a congested link is not made worse,
+				// the peer is done once it runs out on any channel
+				for (auto it = info.chInfo.begin(); it != info.chInfo.end() && info.tokens > 0; ++it) {
+					auto& [ch, chInfo] = *it;
+					for (auto& [id, rmsg] : chInfo.unConfirmed) {
+						if (info.tokens <= 0) {
+							break;
+						}
+						if (now - rmsg.sentAt > rto) {
+							LOG_DEBUG("resend ch: %d id: %d", ch, id);
+							send(rmsg.h, rmsg.msg);
+							rmsg.sentAt = now;
+							stats.resends++;
+							chInfo.stats.resends++;
+						}
+					}
+				}
+			}
+
+			resend();
+		});
+	}
+
+	static void refill(PeerInfo& info, Clock::time_point now) {
+		const float elapsed = std::chrono::duration<float>(now - info.tokensAt).count();
+		info.tokens = std::min(info.tokens + elapsed * info.budget, info.budget / 10);
+		info.tokensAt = now;
+	}
+
+	// AIMD on the send budget: halve it at most once per round trip when pings
+	// get lost or the round trip grows past its variance, which is what a
+	// filling queue on the path looks like. Otherwise grow it additively, but
+	// not far past what the peer has actually been delivered.
+	static void updateCongestion(PeerInfo& info, Clock::duration rtt, uint32_t lost, Clock::time_point now) {
+		info.minRtt = std::min(info.minRtt, rtt);
+		info.rtt.record(std::chrono::duration_cast<std::chrono::microseconds>(rtt).count());
+		const bool delayed = rtt > info.ping + 4 * info.rttVar && rtt > 2 * info.minRtt;
+
+		const auto err = rtt > info.ping ? rtt - info.ping : info.ping - rtt;
+		info.rttVar = (3 * info.rttVar + err) / 4;
+		info.ping = (9 * info.ping + rtt) / 10;
+
+		info.loss = 0.9f * info.loss + 0.1f * lost / (lost + 1);
+
+		const uint64_t sent = info.bytesSent - info.bytesSentAtPing;
+		const uint64_t delivered = sent * (1 - info.loss);
+		info.bytesSentAtPing = info.bytesSent;
+		info.bytesDelivered += delivered;
+		const float interval = std::chrono::duration<float>(pingInterval * (lost + 1)).count();
+		info.throughput = 0.8f * info.throughput + 0.2f * delivered / interval;
+
+		if ((lost > 0 || delayed) && now - info.prevDecrease > info.ping) {
+			info.budget = std::max(minBudget, info.budget / 2);
+			info.prevDecrease = now;
+		} else if (info.budget < 2 * info.throughput + minBudget) {
+			info.budget = std::min(maxBudget, info.budget + budgetIncrease);
+		}
+	}
+
 	void handleMessage(Header h) {
-		if (h.channel != pingChannel && !listeners.contains(h.channel)) {
-			fprintf(stderr, "ERROR: no listener for channel %d\n", h.channel);
+		if (h.channel != pingChannel && h.type != Header::Type::Confirmation && !listeners.contains(h.channel)) {
+			LOG_ERROR("no listener for channel %d", h.channel);
 			return;
 		}
 
@@ -186,12 +567,18 @@ private:
 			peers[peer].chInfo[h.channel] = ChannelInfo{};
 		}
 
+		auto& c = peers[peer].chInfo[h.channel].stats;
+		c.packetsIn++;
+		c.bytesIn += sizeof h + h.payloadSize;
+
 		switch (h.type) {
 			case Header::Type::Unreliable:
 			{
 				auto& prevID = peers[peer].chInfo[h.channel].receiveID;
 				if (h.id < prevID) {
-					printf("INFO\t received old message %d\n", h.id);
+					LOG_DEBUG("received old message %d", h.id);
+					c.outOfOrder++;
+					stats.outOfOrder++;
 					return;
 				} else {
 					prevID = h.id;
@@ -205,6 +592,16 @@ private:
 					send({h.channel, 0, Header::Type::Confirmation, h.id}, {peer, {}});						
 					prevID = h.id;
 				} else {
+					if (h.id <= prevID) {
+						// Our confirmation got lost
+						send({h.channel, 0, Header::Type::Confirmation, h.id}, {peer, {}});
+						c.duplicates++;
+						stats.duplicates++;
+					} else {
+						// Dropped, the peer resends it once the gap is filled
+						c.outOfOrder++;
+						stats.outOfOrder++;
+					}
 					return;
 				}
 				break;
@@ -212,7 +609,7 @@ private:
 			case Header::Type::Confirmation:
 				// our message got confirmed
 				if (peers[peer].chInfo[h.channel].unConfirmed.erase(h.id) != 0) {
-					printf("INFO\t message ch: %d id: %d confirmed\n", h.channel, h.id);
+					LOG_DEBUG("message ch: %d id: %d confirmed", h.channel, h.id);
 				}
 				return;
 			case Header::Type::Ping:
@@ -220,7 +617,7 @@ private:
 				if (h.id > info.prevReceivedPingID) {
 					const auto now = Clock::now();
 					const auto value = now - info.prevPing + pingInterval * (info.prevPingID - h.id);
-					info.ping =  (9 * info.ping + value) / 10;
+					updateCongestion(info, value, h.id - info.prevReceivedPingID - 1, now);
 					info.prevReceivedPingID = h.id;
 				}
 				return;
@@ -230,13 +627,27 @@ private:
 	}
 
 	asio::io_context ioc;
-	udp::socket socket;
+	ConditionedSocket socket;
 	std::map<udp::endpoint, PeerInfo> peers;
 	std::map<Channel, Listener> listeners;
 	char bufIn[10000];
 	udp::endpoint peer;
 	asio::high_resolution_timer pingTimer;
+	asio::high_resolution_timer resendTimer;
+	Stats stats;
+	Clock::time_point startedAt{Clock::now()};
+	asio::io_context adminIoc;
+	std::optional<udp::socket> admin;
+	std::thread adminThread;
+	char adminBuf[64];
+	udp::endpoint adminPeer;
+	static constexpr size_t maxAdminDatagram{8192};
 	static constexpr std::chrono::milliseconds pingInterval{200};
+	static constexpr std::chrono::milliseconds resendInterval{50};
+	static constexpr float initialBudget{256 * 1024};
+	static constexpr float minBudget{8 * 1024};
+	static constexpr float maxBudget{1024 * 1024};
+	static constexpr float budgetIncrease{8 * 1024};
 };
 
 #endif
@@ -0,0 +1,225 @@
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "util.h"
+
+
+// Named spans of time per thread, for seeing where a frame went. Each thread
+// records into a ring of its own, so recording takes no lock and only the
+// latest events of a thread are kept. Written out in the trace event format
+// of Chrome, which chrome://tracing and Perfetto open. While off, a zone is a
+// single relaxed load.
+class Timeline {
+public:
+	static constexpr size_t defaultCapacity = 1 << 16; // Events per thread
+
+	struct Event {
+		const char* name;
+		uint32_t thread; // Index in the order threads first recorded
+		Clock::duration begin; // Since the timeline was made
+		Clock::duration end;
+	};
+
+	// Records the enclosing scope if the timeline is on. The name has to
+	// outlive the timeline, a string literal does.
+	class Zone {
+	public:
+		Zone(Timeline* timeline, const char* name)
+		: timeline{timeline && timeline->isEnabled() ? timeline : nullptr},
+		  name{name}
+		{
+			if (this->timeline) {
+				t0 = Clock::now();
+			}
+		}
+
+		~Zone() {
+			if (timeline) {
+				timeline->record(name, t0, Clock::now());
+			}
+		}
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+
+	private:
+		Timeline* timeline;
+		const char* name;
+		Clock::time_point t0;
+	};
+
+	Timeline(size_t capacity = defaultCapacity)
+	: capacity{capacity},
+	  id{nextId.fetch_add(1, std::memory_order_relaxed)},
+	  epoch{Clock::now()},
+	  enabledAt{0}
+	{}
+
+	Timeline(const Timeline&) = delete;
+	Timeline& operator=(const Timeline&) = delete;
+
+	// Events from before the last time it was turned on are left out of what
+	// is collected
+	void setEnabled(bool on) {
+		if (on) {
+			enabledAt.store((Clock::now() - epoch).count(), std::memory_order_relaxed);
+		}
+		enabled.store(on, std::memory_order_relaxed);
+	}
+
+	bool isEnabled() const {
+		return enabled.load(std::memory_order_relaxed);
+	}
+
+	// Shown instead of the index of the calling thread
+	void nameThread(const char* name) {
+		ring().name.store(name, std::memory_order_relaxed);
+	}
+
+	void record(const char* name, Clock::time_point begin, Clock::time_point end) {
+		Ring& r = ring();
+		const uint64_t w = r.written.load(std::memory_order_relaxed);
+		// Pairs with the fence in collect(), which then sees a slot being
+		// overwritten as already written
+		std::atomic_thread_fence(std::memory_order_release);
+		Slot& slot = r.slots[w % (capacity + 1)];
+		slot.name.store(name, std::memory_order_relaxed);
+		slot.begin.store((begin - epoch).count(), std::memory_order_relaxed);
+		slot.end.store((end - epoch).count(), std::memory_order_relaxed);
+		r.written.store(w + 1, std::memory_order_release);
+	}
+
+	// Events of every thread since the timeline was last turned on, by the
+	// time they began. Threads may keep recording meanwhile.
+	std::vector<Event> collect() const {
+		const Clock::rep since = enabledAt.load(std::memory_order_relaxed);
+		std::vector<Event> events;
+		std::lock_guard lock{mutex};
+		for (uint32_t t = 0; t < rings.size(); ++t) {
+			const Ring& r = *rings[t];
+			const uint64_t last = r.written.load(std::memory_order_acquire);
+			const size_t first = events.size();
+			for (uint64_t i = last > capacity ? last - capacity : 0; i < last; ++i) {
+				const Slot& slot = r.slots[i % (capacity + 1)];
+				events.push_back({slot.name.load(std::memory_order_relaxed), t,
+				                  Clock::duration{slot.begin.load(std::memory_order_relaxed)},
+				                  Clock::duration{slot.end.load(std::memory_order_relaxed)}});
+			}
+
+			// Drop what got overwritten while being read. The spare slot is the
+			// one being written meanwhile, so there is nothing to drop unless
+			// the thread went on recording.
+			std::atomic_thread_fence(std::memory_order_acquire);
+			const uint64_t now = r.written.load(std::memory_order_relaxed);
+			const uint64_t start = last > capacity ? last - capacity : 0;
+			const uint64_t valid = now > capacity ? now - capacity : 0;
+			if (valid > start) {
+				events.erase(events.begin() + first, events.begin() + first + std::min(valid - start, last - start));
+			}
+		}
+
+		std::erase_if(events, [since](const Event& e) {
+			return e.begin.count() < since;
+		});
+		std::stable_sort(events.begin(), events.end(), [](const Event& a, const Event& b) {
+			return a.begin < b.begin;
+		});
+		return events;
+	}
+
+	// Returns how many events were written
+	size_t writeChrome(const char* path) const {
+		const std::vector<Event> events = collect();
+
+		std::FILE* file = std::fopen(path, "w");
+		if (!file) {
+			throw std::runtime_error(std::format("unable to open {}", path));
+		}
+
+		std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		{
+			std::lock_guard lock{mutex};
+			for (uint32_t t = 0; t < rings.size(); ++t) {
+				const char* name = rings[t]->name.load(std::memory_order_relaxed);
+				const std::string threadName = name ? escape(name) : std::format("thread {}", t);
+				std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n",
+				             t, threadName.c_str());
+			}
+		}
+		for (size_t i = 0; i < events.size(); ++i) {
+			const auto& e = events[i];
+			const double ts = std::chrono::duration<double, std::micro>(e.begin).count();
+			const double dur = std::chrono::duration<double, std::micro>(e.end - e.begin).count();
+			std::fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}%s\n",
+			             escape(e.name).c_str(), e.thread, ts, dur, i + 1 < events.size() ? "," : "");
+		}
+		std::fprintf(file, "]}\n");
+		std::fclose(file);
+		return events.size();
+	}
+
+private:
+	struct Slot {
+		std::atomic<const char*> name{nullptr};
+		std::atomic<Clock::rep> begin{0};
+		std::atomic<Clock::rep> end{0};
+	};
+
+	struct Ring {
+		Ring(size_t capacity)
+		: slots{std::make_unique<Slot[]>(capacity + 1)}
+		{}
+
+		std::unique_ptr<Slot[]> slots;
+		std::atomic<uint64_t> written{0};
+		std::atomic<const char*> name{nullptr};
+	};
+
+	static std::string escape(const char* s) {
+		std::string out;
+		for (; *s; ++s) {
+			if (*s == '"' || *s == '\\') {
+				out += '\\';
+			}
+			out += *s;
+		}
+		return out;
+	}
+
+	// The ring of the calling thread, made the first time it records. Keyed
+	// by id rather than address, which a later timeline may reuse. A thread
+	// gets a new ring every time it switches timelines, so it is meant to
+	// record into one at a time.
+	Ring& ring() {
+		thread_local uint64_t owner = 0;
+		thread_local Ring* cached = nullptr;
+		if (owner != id) {
+			std::lock_guard lock{mutex};
+			cached = rings.emplace_back(std::make_unique<Ring>(capacity)).get();
+			owner = id;
+		}
+		return *cached;
+	}
+
+	static inline std::atomic<uint64_t> nextId{1};
+
+	size_t capacity;
+	uint64_t id;
+	Clock::time_point epoch;
+	std::atomic<Clock::rep> enabledAt;
+	std::atomic<bool> enabled{false};
+	mutable std::mutex mutex; // Guards rings, not what is in them
+	std::vector<std::unique_ptr<Ring>> rings;
+};
+
+#endif
@@ -2,8 +2,9 @@
 #define UTIL_H
 
 #include <chrono>
+#include <cstring>
 #include <random>
-#include "rl.h"
+#include "vec.h"
 
 using Clock = std::chrono::high_resolution_clock;
 
@@ -26,32 +27,21 @@ static int RandSign() {
 	return val;
 }
 
-static rl::Vector2 operator-(rl::Vector2 a, rl::Vector2 b) {
-	return rl::Vector2(a.x - b.x, a.y - b.y);
-}
-
-static rl::Vector2 operator+(rl::Vector2 a, rl::Vector2 b) {
-	return rl::Vector2(a.x + b.x, a.y + b.y);
-}
-
-static rl::Vector2 operator*(float a, rl::Vector2 b) {
-	return rl::Vector2(a * b.x, a * b.y);
-}
-
-static rl::Vector2 operator/(rl::Vector2 v, float a) {
-	return rl::Vector2(v.x / a, v.y / a);
-}
-
-static float distance(rl::Vector2 a, rl::Vector2 b) {
-	return sqrt(pow(a.x - b.x, 2) + pow(a.y - b.y, 2));
-}
-
-static float length(rl::Vector2 v) {
-	return sqrt(v.x*v.x + v.y*v.y);
-}
-
-static rl::Vector2 unit(rl::Vector2 v) {
-	return v / length(v);
+// Removes "--name value" from the arguments and returns the value, or
+// nullptr if the option wasn't given. Options can go anywhere, what is left
+// are the positional arguments.
+inline const char* TakeOption(int& argc, char** argv, const char* name) {
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (argv[i][0] == '-' && argv[i][1] == '-' && std::strcmp(argv[i] + 2, name) == 0) {
+			const char* value = argv[i + 1];
+			for (int j = i; j + 2 < argc; ++j) {
+				argv[j] = argv[j + 2];
+			}
+			argc -= 2;
+			return value;
+		}
+	}
+	return nullptr;
 }
 
 #endif
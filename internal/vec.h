@@ -0,0 +1,106 @@
+#ifndef VEC_H
+#define VEC_H
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VEC_SSE 1
+#endif
+
+
+// 2D math shared by the client and the server. Vec2 has the layout of
+// raylib's Vector2, so the wire format does not change and the client
+// converts for rendering at no cost (see rl.h).
+struct Vec2 {
+	float x;
+	float y;
+};
+
+static_assert(sizeof (Vec2) == 2 * sizeof (float), "arrays of Vec2 are read as arrays of floats");
+
+constexpr Vec2 operator+(Vec2 a, Vec2 b) {
+	return {a.x + b.x, a.y + b.y};
+}
+
+constexpr Vec2 operator-(Vec2 a, Vec2 b) {
+	return {a.x - b.x, a.y - b.y};
+}
+
+constexpr Vec2 operator-(Vec2 v) {
+	return {-v.x, -v.y};
+}
+
+constexpr Vec2 operator*(float a, Vec2 v) {
+	return {a * v.x, a * v.y};
+}
+
+constexpr Vec2 operator*(Vec2 v, float a) {
+	return {a * v.x, a * v.y};
+}
+
+constexpr Vec2 operator/(Vec2 v, float a) {
+	return {v.x / a, v.y / a};
+}
+
+constexpr Vec2& operator+=(Vec2& a, Vec2 b) {
+	return a = a + b;
+}
+
+constexpr Vec2& operator-=(Vec2& a, Vec2 b) {
+	return a = a - b;
+}
+
+constexpr bool operator==(Vec2 a, Vec2 b) {
+	return a.x == b.x && a.y == b.y;
+}
+
+constexpr float dot(Vec2 a, Vec2 b) {
+	return a.x * b.x + a.y * b.y;
+}
+
+constexpr float lengthSquared(Vec2 v) {
+	return dot(v, v);
+}
+
+constexpr float distanceSquared(Vec2 a, Vec2 b) {
+	return lengthSquared(a - b);
+}
+
+// Compare squared lengths instead where only the order matters
+inline float length(Vec2 v) {
+	return std::sqrt(lengthSquared(v));
+}
+
+inline float distance(Vec2 a, Vec2 b) {
+	return length(a - b);
+}
+
+// Undefined for the zero vector
+inline Vec2 unit(Vec2 v) {
+	return (1.f / length(v)) * v;
+}
+
+// out[i] = distanceSquared(from, points[i]), four points per iteration
+// where SSE is available
+inline void distancesSquared(Vec2 from, const Vec2* points, size_t n, float* out) {
+	size_t i = 0;
+#ifdef VEC_SSE
+	const __m128 f = _mm_setr_ps(from.x, from.y, from.x, from.y);
+	for (; i + 4 <= n; i += 4) {
+		const __m128 a = _mm_sub_ps(_mm_loadu_ps(&points[i].x), f);     // x0 y0 x1 y1
+		const __m128 b = _mm_sub_ps(_mm_loadu_ps(&points[i + 2].x), f); // x2 y2 x3 y3
+		const __m128 a2 = _mm_mul_ps(a, a);
+		const __m128 b2 = _mm_mul_ps(b, b);
+		const __m128 xs = _mm_shuffle_ps(a2, b2, _MM_SHUFFLE(2, 0, 2, 0));
+		const __m128 ys = _mm_shuffle_ps(a2, b2, _MM_SHUFFLE(3, 1, 3, 1));
+		_mm_storeu_ps(out + i, _mm_add_ps(xs, ys));
+	}
+#endif
+	for (; i < n; ++i) {
+		out[i] = distanceSquared(from, points[i]);
+	}
+}
+
+#endif
@@ -1,31 +1,331 @@
 #ifndef WORLD_H
 #define WORLD_H
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
 #include <vector>
-#include <random>
-#include "rl.h"
+#include "vec.h"
+#include "collision.h"
 
 struct Block{
-	rl::Vector2 pos;
-	rl::Vector2 size;
+	Vec2 pos;
+	Vec2 size;
 };
 
+struct ChunkCoord {
+	int32_t x;
+	int32_t y;
+
+	bool operator==(const ChunkCoord&) const = default;
+};
+
+struct Ray {
+	Vec2 origin;
+	Vec2 dir;     // Unit length
+	float length; // Nothing further is looked at
+};
+
+// The first block on a ray and how far along it is. Without a block the
+// distance is the length of the ray.
+struct RayHit {
+	const Block* block;
+	float distance;
+};
+
+// The blocks of a chunkSize square. A block never reaches out of its chunk,
+// so anything at a point can only collide with the chunk the point is in.
+struct Chunk {
+	ChunkCoord coord;
+	std::vector<Block> blocks;
+	uint32_t used{0}; // Sweep of World::evictUnused() it was last needed in
+};
+
+// The world as chunks that are generated from a seed and their coordinate or
+// cut from a map file, and made only when needed. The client's copy starts
+// empty and is filled with what the server sends.
 class World {
 public:
-	World() {
-		std::mt19937 mt{1};
-		std::uniform_real_distribution<float> dist(-1000.f, 1000.f);
-		constexpr int n = 1000;
-		for (int i = 0; i < n; ++i) {
-			blocks.emplace_back(rl::Vector2{dist(mt), dist(mt)}, rl::Vector2{10, 10});
+	static constexpr float chunkSize = 32.f;
+	static constexpr float blockSize = 10.f;
+
+	// Everything the world is generated from
+	struct Params {
+		uint32_t seed{1};
+		float density{0.25f}; // Average blocks per generated chunk
+		char map[120]{};      // Map file to read instead of generating, if any
+	};
+
+	// Empty, for the client to insert() into
+	World() = default;
+
+	World(const Params& params)
+	: params{params},
+	  generated{params.map[0] == '\0'}
+	{
+		if (!generated) {
+			readMap(params.map);
 		}
 	}
 
-	const std::vector<Block>& getBlocks() const {
-		return blocks;
+	static ChunkCoord chunkOf(Vec2 pos) {
+		return {int32_t(std::floor(pos.x / chunkSize)), int32_t(std::floor(pos.y / chunkSize))};
+	}
+
+	static Vec2 origin(ChunkCoord c) {
+		return {c.x * chunkSize, c.y * chunkSize};
+	}
+
+	static uint64_t key(ChunkCoord c) {
+		return uint64_t(uint32_t(c.x)) << 32 | uint32_t(c.y);
 	}
+
+	static ChunkCoord coordOf(uint64_t key) {
+		return {int32_t(uint32_t(key >> 32)), int32_t(uint32_t(key))};
+	}
+
+	// The chunk if it has been made already
+	const Chunk* find(ChunkCoord c) const {
+		const auto it = chunks.find(key(c));
+		return it != chunks.end() ? &it->second : nullptr;
+	}
+
+	// Makes the chunk if needed and keeps it from the next evictUnused().
+	// Chunks stay where they are in memory until evicted.
+	const Chunk& load(ChunkCoord c) {
+		auto [it, inserted] = chunks.try_emplace(key(c));
+		Chunk& chunk = it->second;
+		if (inserted) {
+			chunk.coord = c;
+			if (generated) {
+				generate(chunk);
+			}
+		}
+		chunk.used = sweep;
+		return chunk;
+	}
+
+	// The first block the point is inside of, if its chunk has been made
+	const Block* blockAt(Vec2 pos) const {
+		if (const Chunk* chunk = find(chunkOf(pos))) {
+			for (const auto& block : chunk->blocks) {
+				if (CheckCollisionPointAndRec(pos.x, pos.y, block.pos.x, block.pos.y, block.size.x, block.size.y)) {
+					return &block;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	// Only chunks made so far block the ray
+	RayHit raycast(const Ray& ray) const {
+		return walk(ray, [this](ChunkCoord c) { return find(c); });
+	}
+
+	// Many rays at once, from around the same place to make the most of
+	// looking up each chunk only once
+	void raycast(const Ray* rays, size_t n, RayHit* out) const {
+		struct Slot {
+			bool set;
+			uint64_t key;
+			const Chunk* chunk;
+		};
+		std::array<Slot, 64> cache{};
+		auto lookup = [this, &cache](ChunkCoord c) {
+			const uint64_t k = key(c);
+			auto& slot = cache[(uint32_t(c.x) * 7 + uint32_t(c.y)) % cache.size()];
+			if (!slot.set || slot.key != k) {
+				slot = {true, k, find(c)};
+			}
+			return slot.chunk;
+		};
+
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = walk(rays[i], lookup);
+		}
+	}
+
+	// Drops chunks not loaded since the previous call that can be made again
+	// the same way when needed, which are all but the blocks of a map
+	void evictUnused() {
+		std::erase_if(chunks, [this](const auto& kv) {
+			return kv.second.used != sweep && (generated || kv.second.blocks.empty());
+		});
+		++sweep;
+	}
+
+	void insert(Chunk chunk) {
+		chunks[key(chunk.coord)] = std::move(chunk);
+	}
+
+	// Drops chunks further than radius chunks from center in either direction
+	void evict(ChunkCoord center, int32_t radius) {
+		std::erase_if(chunks, [center, radius](const auto& kv) {
+			const auto& c = kv.second.coord;
+			return std::abs(c.x - center.x) > radius || std::abs(c.y - center.y) > radius;
+		});
+	}
+
+	const std::unordered_map<uint64_t, Chunk>& getChunks() const {
+		return chunks;
+	}
+
+	const Params& getParams() const {
+		return params;
+	}
+
 private:
-	std::vector<Block> blocks;
+	static uint64_t mix(uint64_t z) {
+		z += 0x9e3779b97f4a7c15;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+		return z ^ (z >> 31);
+	}
+
+	// Steps through the chunks the ray crosses in order (Amanatides & Woo).
+	// Blocks don't leave their chunk, so the nearest hit in the first chunk
+	// with any is the first one on the whole ray.
+	template <typename Lookup>
+	static RayHit walk(const Ray& ray, Lookup&& lookup) {
+		constexpr float inf = std::numeric_limits<float>::infinity();
+		const Vec2 o = ray.origin;
+		const Vec2 d = ray.dir;
+
+		ChunkCoord c = chunkOf(o);
+		const int32_t stepX = d.x > 0 ? 1 : -1;
+		const int32_t stepY = d.y > 0 ? 1 : -1;
+		const float deltaX = d.x != 0 ? chunkSize / std::abs(d.x) : inf;
+		const float deltaY = d.y != 0 ? chunkSize / std::abs(d.y) : inf;
+		const Vec2 corner = origin(c);
+		float nextX = d.x > 0 ? (corner.x + chunkSize - o.x) / d.x : d.x < 0 ? (corner.x - o.x) / d.x : inf;
+		float nextY = d.y > 0 ? (corner.y + chunkSize - o.y) / d.y : d.y < 0 ? (corner.y - o.y) / d.y : inf;
+
+		float t = 0;
+		while (t <= ray.length) {
+			if (const Chunk* chunk = lookup(c)) {
+				RayHit nearest{nullptr, inf};
+				for (const auto& block : chunk->blocks) {
+					const float hit = enter(o, d, block);
+					if (hit < nearest.distance) {
+						nearest = {&block, hit};
+					}
+				}
+				if (nearest.block && nearest.distance <= ray.length) {
+					return nearest;
+				}
+			}
+
+			if (nextX < nextY) {
+				t = nextX;
+				nextX += deltaX;
+				c.x += stepX;
+			} else {
+				t = nextY;
+				nextY += deltaY;
+				c.y += stepY;
+			}
+		}
+		return {nullptr, ray.length};
+	}
+
+	// Where the ray enters the block, 0 when it starts inside, infinity if
+	// it misses
+	static float enter(Vec2 o, Vec2 d, const Block& b) {
+		constexpr float inf = std::numeric_limits<float>::infinity();
+		float from = 0;
+		float to = inf;
+		const float lo[2] = {b.pos.x, b.pos.y};
+		const float hi[2] = {b.pos.x + b.size.x, b.pos.y + b.size.y};
+		const float os[2] = {o.x, o.y};
+		const float ds[2] = {d.x, d.y};
+		for (int axis = 0; axis < 2; ++axis) {
+			if (ds[axis] == 0) {
+				if (os[axis] <= lo[axis] || os[axis] >= hi[axis]) {
+					return inf;
+				}
+				continue;
+			}
+			float t0 = (lo[axis] - os[axis]) / ds[axis];
+			float t1 = (hi[axis] - os[axis]) / ds[axis];
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			from = std::max(from, t0);
+			to = std::min(to, t1);
+		}
+		return from <= to ? from : inf;
+	}
+
+	// Integer hashing only, so every platform generates the same chunk
+	void generate(Chunk& chunk) const {
+		uint64_t h = mix(params.seed ^ mix(key(chunk.coord)));
+		auto next = [&h] {
+			h = mix(h);
+			return float(h >> 40) / float(1 << 24);
+		};
+
+		const int whole = int(params.density);
+		const int n = whole + (next() < params.density - whole);
+		const Vec2 o = origin(chunk.coord);
+		for (int i = 0; i < n; ++i) {
+			const float x = next() * (chunkSize - blockSize);
+			const float y = next() * (chunkSize - blockSize);
+			chunk.blocks.push_back({o + Vec2{x, y}, {blockSize, blockSize}});
+		}
+	}
+
+	// One block per line as "x y w h", # starts a comment. Blocks crossing
+	// chunk borders are cut into a piece per chunk.
+	void readMap(const char* path) {
+		std::ifstream in{path};
+		if (!in) {
+			throw std::runtime_error(std::format("unable to open map {}", path));
+		}
+
+		std::string line;
+		for (int n = 1; std::getline(in, line); ++n) {
+			line = line.substr(0, line.find('#'));
+			if (line.find_first_not_of(" \t\r") == std::string::npos) {
+				continue;
+			}
+
+			std::istringstream fields{line};
+			Block b;
+			if (!(fields >> b.pos.x >> b.pos.y >> b.size.x >> b.size.y) || b.size.x <= 0 || b.size.y <= 0) {
+				throw std::runtime_error(std::format("invalid block on line {} of {}", n, path));
+			}
+
+			const ChunkCoord first = chunkOf(b.pos);
+			const ChunkCoord last = chunkOf(b.pos + b.size);
+			for (int32_t cx = first.x; cx <= last.x; ++cx) {
+				for (int32_t cy = first.y; cy <= last.y; ++cy) {
+					const Vec2 lo = origin({cx, cy});
+					const Vec2 hi = lo + Vec2{chunkSize, chunkSize};
+					const Vec2 from{std::max(b.pos.x, lo.x), std::max(b.pos.y, lo.y)};
+					const Vec2 to{std::min(b.pos.x + b.size.x, hi.x), std::min(b.pos.y + b.size.y, hi.y)};
+					if (to.x > from.x && to.y > from.y) {
+						Chunk& chunk = chunks[key({cx, cy})];
+						chunk.coord = {cx, cy};
+						chunk.blocks.push_back({from, to - from});
+					}
+				}
+			}
+		}
+	}
+
+	Params params;
+	bool generated{false};
+	uint32_t sweep{0};
+	std::unordered_map<uint64_t, Chunk> chunks;
 };
 
 #endif
@@ -0,0 +1,139 @@
+#include "atlas.h"
+#include "bundle.h"
+#include "jobs.h"
+#include "rl.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Turns an asset tree into a bundle the client loads instead of the files.
+// Every directory with PNG files in it becomes an animation named by its path
+// within the tree, its frames in the order of their file names. Frames are
+// decoded on every core and packed into atlases per animation, or kept one
+// per texture with an atlas size of 0.
+
+namespace fs = std::filesystem;
+
+constexpr int32_t defaultAtlasSize = 2048;
+constexpr int32_t padding = 1; // Between frames, so filtering doesn't bleed
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc > 4) {
+        printf("usage: assetpack asset-dir bundle-file [atlas-size]\n");
+        return -1;
+    }
+
+    const int32_t atlasSize = argc > 3 ? std::atoi(argv[3]) : defaultAtlasSize;
+    if (atlasSize < 0) {
+        fprintf(stderr, "assetpack failed: invalid atlas size %d\n", atlasSize);
+        return 1;
+    }
+
+    try {
+        const fs::path root{argv[1]};
+        if (!fs::is_directory(root)) {
+            throw std::runtime_error(std::format("{} is not a directory", argv[1]));
+        }
+
+        // Sorted by name, the same order Animation reads a directory in
+        std::map<std::string, std::vector<std::string>> dirs;
+        for (const auto& entry : fs::recursive_directory_iterator{root}) {
+            if (entry.is_regular_file() && entry.path().extension() == ".png") {
+                const std::string name = fs::relative(entry.path().parent_path(), root).generic_string();
+                dirs[name].push_back(entry.path().string());
+            }
+        }
+
+        std::vector<bundle::Animation> animations;
+        std::vector<std::string> files;
+        for (auto& [name, paths] : dirs) {
+            bundle::Animation anim{};
+            if (name.size() >= sizeof anim.name) {
+                throw std::runtime_error(std::format("animation name {} is too long", name));
+            }
+            std::strcpy(anim.name, name.c_str());
+            anim.firstFrame = files.size();
+            anim.numFrames = paths.size();
+            animations.push_back(anim);
+
+            std::sort(paths.begin(), paths.end());
+            files.insert(files.end(), paths.begin(), paths.end());
+        }
+
+        std::vector<rl::Image> images(files.size());
+        {
+            JobSystem jobs{std::max(1u, std::thread::hardware_concurrency()) - 1};
+            JobSystem::Counter done;
+            jobs.parallelFor(nullptr, done, images.size(), 1, [&](size_t, size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    images[i] = rl::LoadImage(files[i].c_str());
+                }
+            });
+            jobs.wait(done);
+        }
+
+        for (size_t i = 0; i < images.size(); ++i) {
+            if (!images[i].data) {
+                throw std::runtime_error(std::format("unable to load frame {}", files[i]));
+            }
+        }
+
+        // Each animation on atlases of its own, so the client can keep any
+        // of them on the GPU without the others
+        AtlasLayout layout;
+        for (const auto& anim : animations) {
+            std::vector<AtlasSize> sizes;
+            for (uint32_t i = anim.firstFrame; i < anim.firstFrame + anim.numFrames; ++i) {
+                sizes.push_back({images[i].width, images[i].height});
+            }
+            const AtlasLayout own = packRows(sizes, atlasSize, padding);
+            for (auto place : own.places) {
+                place.page += layout.pages.size();
+                layout.places.push_back(place);
+            }
+            layout.pages.insert(layout.pages.end(), own.pages.begin(), own.pages.end());
+        }
+
+        // GenImageColor() makes 8 bit RGBA and ImageDraw() converts to it
+        std::vector<rl::Image> pages;
+        std::vector<bundle::Pixels> pixels;
+        for (const auto& page : layout.pages) {
+            pages.push_back(rl::GenImageColor(page.width, page.height, rl::BLANK));
+        }
+        std::vector<bundle::Frame> frames;
+        for (size_t i = 0; i < images.size(); ++i) {
+            const auto& place = layout.places[i];
+            const float w = images[i].width;
+            const float h = images[i].height;
+            rl::ImageDraw(&pages[place.page], images[i], {0, 0, w, h}, {float(place.x), float(place.y), w, h}, rl::WHITE);
+            frames.push_back({place.page, float(place.x), float(place.y), w, h});
+            rl::UnloadImage(images[i]);
+        }
+        for (const auto& page : pages) {
+            pixels.push_back({uint32_t(page.width), uint32_t(page.height), page.data});
+        }
+
+        bundle::write(argv[2], animations, frames, pixels);
+
+        uint64_t bytes = 0;
+        for (auto& page : pages) {
+            bytes += uint64_t(page.width) * page.height * 4;
+            rl::UnloadImage(page);
+        }
+        printf("packed %zu frames of %zu animations into %zu atlases, %.1f MiB of pixels\n",
+               frames.size(), animations.size(), pages.size(), bytes / (1024.0 * 1024.0));
+    } catch (const std::exception& e) {
+        fprintf(stderr, "assetpack failed: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,21 +1,46 @@
 #ifndef ANIMATION_H
 #define ANIMATION_H
 
+#include <algorithm>
 #include <vector>
 #include <cstdio>
+#include <string>
 #include "util.h"
-
+#include "atlas.h"
+#include "bundle.h"
+#include "jobs.h"
+#include "rl.h"
+
+// Frames of an animation packed into as few atlas textures as they fit in,
+// so drawing any frame of it binds the same texture. Loading is split in
+// two: decoding and packing needs no window and can happen on any thread,
+// only uploading the atlases has to happen on the one that draws.
 class Animation {
 public:
-	Animation(const char* dirpath, Clock::duration duration) 
-	: duration{duration}
-	{
+	static constexpr int atlasSize = 2048;
+	static constexpr int padding = 1; // Between frames, so filtering doesn't bleed
+
+	// Where a frame is in its atlas
+	struct Frame {
+		rl::Texture2D texture;
+		rl::Rectangle source;
+	};
+
+	// Atlases in memory, ready to upload
+	struct Pages {
+		std::vector<rl::Image> atlases;
+		std::vector<std::pair<uint32_t, rl::Rectangle>> frames; // Atlas and where in it
+		bool owned{true}; // Unloaded once uploaded, unlike pixels of a mapped bundle
+	};
+
+	// Decodes the PNG files of the directory as jobs and packs them
+	static Pages decode(const char* dirpath, JobSystem& jobs) {
 		rl::FilePathList files = rl::LoadDirectoryFiles(dirpath);
 
 		if (files.count > files.capacity) {
 			throw std::runtime_error(std::format("count {} > capacity {}\n", files.count, files.capacity));
 		}
-		
+
 		std::vector<std::string> filenames;
 		for (int i = 0; i < files.count; ++i) {
 			filenames.push_back(files.paths[i]);
@@ -26,34 +51,105 @@ public:
 
 		std::sort(filenames.begin(), filenames.end());
 
-		for (const auto& filename : filenames) {
-			auto texture = rl::LoadTexture(filename.c_str());
-			frames.push_back(texture);
+		std::vector<rl::Image> images(filenames.size());
+		JobSystem::Counter done;
+		jobs.parallelFor(nullptr, done, images.size(), 1, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				images[i] = rl::LoadImage(filenames[i].c_str());
+			}
+		});
+		jobs.wait(done);
+
+		Pages pages;
+		std::string error;
+		for (size_t i = 0; i < images.size() && error.empty(); ++i) {
+			if (!images[i].data) {
+				error = std::format("unable to load frame {}", filenames[i]);
+			}
+		}
+		if (images.empty()) {
+			error = std::format("no frames in {}", dirpath);
+		}
+		if (error.empty()) {
+			try {
+				pages = pack(images);
+			} catch (const std::exception& e) {
+				error = e.what();
+			}
+		}
+		for (auto& image : images) {
+			rl::UnloadImage(image);
 		}
+		if (!error.empty()) {
+			throw std::runtime_error(error);
+		}
+		return pages;
+	}
 
-		std::printf("INFO\tloaded animation containing %ud frames from %s\n", files.count, dirpath);
+	// The frames in the directory name of the asset tree a bundle was made
+	// from, pointing into the mapped file
+	static Pages decode(const Bundle& bundle, const char* name) {
+		Pages pages;
+		pages.owned = false;
+		std::vector<uint32_t> used; // Atlases of the bundle, in the order of pages.atlases
+		for (const auto& f : bundle.animation(name)) {
+			auto it = std::find(used.begin(), used.end(), f.atlas);
+			if (it == used.end()) {
+				const auto& atlas = bundle.getAtlases()[f.atlas];
+				pages.atlases.push_back({const_cast<void*>(bundle.pixels(atlas)), int(atlas.width), int(atlas.height), 1,
+				                         rl::PIXELFORMAT_UNCOMPRESSED_R8G8B8A8});
+				it = used.insert(used.end(), f.atlas);
+			}
+			pages.frames.push_back({uint32_t(it - used.begin()), {f.x, f.y, f.width, f.height}});
+		}
+		if (pages.frames.empty()) {
+			throw std::runtime_error(std::format("animation {} has no frames", name));
+		}
+		return pages;
+	}
 
-		frametime = duration / files.count;
+	// Uploads the atlases
+	Animation(Pages pages, Clock::duration duration)
+	: duration{duration}
+	{
+		for (auto& image : pages.atlases) {
+			atlases.push_back(rl::LoadTextureFromImage(image));
+			bytes += size_t(image.width) * image.height * 4;
+			if (pages.owned) {
+				rl::UnloadImage(image);
+			}
+		}
+		for (const auto& [atlas, source] : pages.frames) {
+			frames.push_back({atlases[atlas], source});
+		}
+
+		frametime = duration / frames.size();
 	}
 
-	/*
+	// Textures can only be unloaded while the window is open
 	~Animation() {
-		printf("~Animation() called\n");
-		for(auto& frame : frames) {
-			rl::UnloadTexture(frame);
+		for(auto& atlas : atlases) {
+			rl::UnloadTexture(atlas);
 		}
-		frames.clear();
+		atlases.clear();
 	}
-	*/
 
-	rl::Texture& operator[](size_t idx) {
+	Animation(const Animation&) = delete;
+	Animation& operator=(const Animation&) = delete;
+
+	const Frame& operator[](size_t idx) const {
 		return frames.at(idx);
 	}
 
-	rl::Texture2D& currentFrame() {
+	const Frame& currentFrame() const {
 		return frames[currentFrameIdx];
 	}
 
+	// Of the atlases on the GPU
+	size_t getBytes() const {
+		return bytes;
+	}
+
 	void reset() {
 		currentFrameIdx = 0;
 		fromPrev = Clock::duration{0};
@@ -70,7 +166,30 @@ public:
 		}
 	}
 private:
-	std::vector<rl::Texture2D> frames;
+	static Pages pack(const std::vector<rl::Image>& images) {
+		std::vector<AtlasSize> sizes;
+		for (const auto& image : images) {
+			sizes.push_back({image.width, image.height});
+		}
+		const AtlasLayout layout = packRows(sizes, atlasSize, padding);
+
+		Pages pages;
+		for (const auto& page : layout.pages) {
+			pages.atlases.push_back(rl::GenImageColor(page.width, page.height, rl::BLANK));
+		}
+		for (size_t i = 0; i < images.size(); ++i) {
+			const auto& image = images[i];
+			const auto& place = layout.places[i];
+			const rl::Rectangle rect{float(place.x), float(place.y), float(image.width), float(image.height)};
+			rl::ImageDraw(&pages.atlases[place.page], image, {0, 0, rect.width, rect.height}, rect, rl::WHITE);
+			pages.frames.push_back({place.page, rect});
+		}
+		return pages;
+	}
+
+	std::vector<rl::Texture2D> atlases;
+	std::vector<Frame> frames;
+	size_t bytes{0};
 	size_t currentFrameIdx{0};
 	Clock::duration duration;
 	Clock::duration frametime;
@@ -0,0 +1,193 @@
+#ifndef ANIMATION_CACHE_H
+#define ANIMATION_CACHE_H
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "animation.h"
+#include "bundle.h"
+#include "jobs.h"
+#include "timeline.h"
+
+// Animations by their directory in the asset tree, like "rifle/move". Each
+// one is loaded in the background the first time it is asked for, and the
+// fallback is drawn in its place until it is on the GPU. Least recently
+// used animations are dropped while the atlases on the GPU take more than
+// the budget.
+class AnimationCache {
+public:
+	struct Stats {
+		uint64_t hits{0};      // Asked for and on the GPU
+		uint64_t misses{0};    // Asked for while not, the fallback is drawn
+		uint64_t loads{0};
+		uint64_t evictions{0};
+		size_t resident{0};    // Animations on the GPU
+		size_t bytes{0};       // Of their atlases
+	};
+
+	// Loads from the bundle if there is one, else from the files under root.
+	// The fallback is loaded right away and never dropped.
+	AnimationCache(std::string root, const Bundle* bundle, size_t budget, const std::string& fallback,
+	               Clock::duration duration)
+	: root{std::move(root)},
+	  bundle{bundle},
+	  budget{budget},
+	  duration{duration},
+	  jobs{std::max(2u, std::thread::hardware_concurrency()) - 1}
+	{
+		auto& entry = entries[fallback];
+		entry.animation = std::make_unique<Animation>(decode(fallback), duration);
+		this->fallback = entry.animation.get();
+		stats.loads++;
+		stats.resident++;
+		stats.bytes += this->fallback->getBytes();
+	}
+
+	~AnimationCache() {
+		clear();
+	}
+
+	AnimationCache(const AnimationCache&) = delete;
+	AnimationCache& operator=(const AnimationCache&) = delete;
+
+	// The animation if it is on the GPU, else the fallback while it loads.
+	// Animations that failed to load stay the fallback.
+	Animation& get(const std::string& name) {
+		auto it = entries.find(name);
+		if (it != entries.end() && it->second.animation) {
+			it->second.usedAt = frame;
+			stats.hits++;
+			return *it->second.animation;
+		}
+
+		stats.misses++;
+		if (it == entries.end() && !failed.contains(name)) {
+			entries[name];
+			auto& load = *loading.emplace_back(std::make_unique<Load>(name));
+			jobs.run(load.done, [this, &load] {
+				try {
+					load.pages = decode(load.name);
+				} catch (const std::exception& e) {
+					load.error = e.what();
+				}
+			});
+		}
+		return *fallback;
+	}
+
+	// Uploads what has been decoded and drops animations over the budget.
+	// Once a frame, on the thread that draws.
+	void update() {
+		Timeline::Zone zone{timeline, "animations"};
+		std::erase_if(loading, [this](const auto& load) {
+			if (!load->done.done()) {
+				return false;
+			}
+			if (!load->error.empty()) {
+				fprintf(stderr, "ERROR\t unable to load animation %s: %s\n", load->name.c_str(), load->error.c_str());
+				failed.insert(load->name);
+				entries.erase(load->name);
+				return true;
+			}
+
+			Timeline::Zone upload{timeline, "upload animation"};
+			auto& entry = entries[load->name];
+			entry.animation = std::make_unique<Animation>(std::move(load->pages), duration);
+			entry.usedAt = frame;
+			stats.loads++;
+			stats.resident++;
+			stats.bytes += entry.animation->getBytes();
+			return true;
+		});
+
+		// Not what was drawn last frame, which would only come right back
+		while (stats.bytes > budget) {
+			auto victim = entries.end();
+			for (auto it = entries.begin(); it != entries.end(); ++it) {
+				const auto& e = it->second;
+				if (e.animation && e.animation.get() != fallback && e.usedAt < frame
+					&& (victim == entries.end() || e.usedAt < victim->second.usedAt)) {
+					victim = it;
+				}
+			}
+			if (victim == entries.end()) {
+				break;
+			}
+			stats.bytes -= victim->second.animation->getBytes();
+			stats.resident--;
+			stats.evictions++;
+			entries.erase(victim);
+		}
+
+		++frame;
+	}
+
+	const Stats& getStats() const {
+		return stats;
+	}
+
+	size_t getBudget() const {
+		return budget;
+	}
+
+	// Has to happen before the window closes
+	void clear() {
+		for (auto& load : loading) {
+			jobs.wait(load->done);
+			if (load->pages.owned) {
+				for (auto& image : load->pages.atlases) {
+					rl::UnloadImage(image);
+				}
+			}
+		}
+		loading.clear();
+		entries.clear();
+		fallback = nullptr;
+	}
+
+	// Loading is traced into it when set
+	Timeline* timeline{nullptr};
+
+private:
+	struct Entry {
+		std::unique_ptr<Animation> animation; // None while loading
+		uint64_t usedAt{0};                   // Frame
+	};
+
+	struct Load {
+		Load(std::string name)
+		: name{std::move(name)}
+		{}
+
+		std::string name;
+		JobSystem::Counter done;
+		Animation::Pages pages;
+		std::string error;
+	};
+
+	Animation::Pages decode(const std::string& name) {
+		if (bundle) {
+			return Animation::decode(*bundle, name.c_str());
+		}
+		return Animation::decode((root + "/" + name).c_str(), jobs);
+	}
+
+	std::string root;
+	const Bundle* bundle;
+	size_t budget;
+	Clock::duration duration;
+	uint64_t frame{1};
+	Stats stats;
+	Animation* fallback{nullptr};
+	std::unordered_map<std::string, Entry> entries;
+	std::unordered_set<std::string> failed;
+	std::vector<std::unique_ptr<Load>> loading;
+	JobSystem jobs; // Last, so it is gone before what its jobs use
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef FRAME_GRAPH_H
+#define FRAME_GRAPH_H
+
+#include <algorithm>
+#include <array>
+#include <format>
+#include "rl.h"
+#include "util.h"
+
+// Bars of how long the latest frames took, newest on the right, with lines
+// at the budget of 60 and 30 frames per second. Bars over the first one are
+// yellow, over the second one red.
+class FrameGraph {
+public:
+	static constexpr size_t frameCount = 240;
+
+	void add(Clock::duration frametime) {
+		frames[next] = std::chrono::duration<float, std::milli>(frametime).count();
+		next = (next + 1) % frameCount;
+		count = std::min(count + 1, frameCount);
+	}
+
+	// Scaled so 50ms fills the height
+	void draw(int x, int y, int width, int height) const {
+		constexpr float fullMs = 50.f;
+		constexpr float budget60 = 1000.f / 60;
+		constexpr float budget30 = 1000.f / 30;
+
+		rl::DrawRectangle(x, y, width, height, {0, 0, 0, 160});
+		const float barWidth = float(width) / frameCount;
+		float worst = 0;
+		float sum = 0;
+		for (size_t i = 0; i < count; ++i) {
+			const float ms = frames[(next + frameCount - count + i) % frameCount];
+			const int h = int(std::min(ms / fullMs, 1.f) * height);
+			const int left = x + int((frameCount - count + i) * barWidth);
+			const int right = x + int((frameCount - count + i + 1) * barWidth);
+			rl::DrawRectangle(left, y + height - h, std::max(right - left, 1), h,
+			                  ms > budget30 ? rl::RED : ms > budget60 ? rl::YELLOW : rl::GREEN);
+			worst = std::max(worst, ms);
+			sum += ms;
+		}
+
+		for (const float ms : {budget60, budget30}) {
+			const int ly = y + height - int(ms / fullMs * height);
+			rl::DrawLine(x, ly, x + width, ly, rl::WHITE);
+		}
+
+		const float mean = count > 0 ? sum / count : 0;
+		rl::DrawText(std::format("frame {:.1f}ms mean {:.1f}ms max", mean, worst).c_str(), x + 4, y + 4, 14, rl::WHITE);
+	}
+
+private:
+	std::array<float, frameCount> frames{}; // Milliseconds
+	size_t next{0};
+	size_t count{0};
+};
+
+#endif
@@ -1,6 +1,7 @@
 #include "game.h"
 #include <chrono>
 #include <cstring>
+#include <filesystem>
 #include "util.h"
 #include <format>
 #include "protocol.h"
@@ -13,6 +14,33 @@
 
 using namespace std::chrono_literals;
 
+constexpr auto enemyStaleDuration = 1000ms;
+constexpr auto tracerDuration = 100ms;
+constexpr auto attackAnimationDuration = 300ms;
+constexpr const char* bundlePath = "assets.bundle";
+constexpr const char* tracePath = "client-trace.json";
+constexpr const char* assetRoot = "assets/Top_Down_Survivor";
+// Messages between the game loop and the network thread that fit in the
+// queues at once
+constexpr size_t snapshotCapacity = 64;
+constexpr size_t receivedCapacity = 1024;
+constexpr size_t outgoingCapacity = 256;
+constexpr size_t pendingCapacity = 4096;
+constexpr auto handOverRetry = 2ms;
+
+// What the number keys pick, and the animation each one attacks with
+struct Weapon {
+    const char* name;
+    const char* attack;
+};
+
+constexpr Weapon weapons[] = {
+    {"rifle", "shoot"},
+    {"handgun", "shoot"},
+    {"shotgun", "shoot"},
+    {"knife", "meleeattack"},
+    {"flashlight", "meleeattack"},
+};
 
 int renderWidth = 1280;
 int renderHeight = 960;
@@ -23,65 +51,246 @@ float aspectRatio() {
     return 1.0f * renderWidth / renderHeight;
 }
 
-rl::Vector2 screenCenter() {
-    return rl::Vector2{renderWidth/2.f, renderHeight/2.f};
+Vec2 screenCenter() {
+    return Vec2{renderWidth/2.f, renderHeight/2.f};
 }
 
 float hpx() {
     return renderHeight / viewHeight;
 }
 
-rl::Vector2 Game::worldPosToScreenCoord(rl::Vector2 pos) {
-    const rl::Vector2 d = pos - player.pos;
+Vec2 Game::worldPosToScreenCoord(Vec2 pos) {
+    const Vec2 d = pos - player.pos;
     return screenCenter() + hpx() * d;
 }
 
-rl::Vector2 Game::screenCoordToWorldPos(rl::Vector2 coord) {
+Vec2 Game::screenCoordToWorldPos(Vec2 coord) {
     const auto d = coord - screenCenter();
     return player.pos + d / hpx();
 }
 
-Game::Game(const char* serverAddr)
-    : con{udp::endpoint{asio::ip::make_address(serverAddr), 6969}}
+// The listeners run on the network thread and only hand data over to the
+// game loop, which takes it in at the start of update()
+Game::Game(const char* serverAddr, unsigned short port, size_t textureBudget, bool spectating)
+    : con{udp::endpoint{asio::ip::make_address(serverAddr), port}},
+      handOverTimer{con.get_executor()},
+      snapshots{snapshotCapacity},
+      received{receivedCapacity},
+      outgoing{outgoingCapacity},
+      spectating{spectating},
+      textureBudget{textureBudget}
 {
     con.listen(proto::updateChannel, [this](char* data, size_t n) {
         proto::Header h;
-        proto::GameState state;
+        proto::Snapshot snapshot;
 
-        if (n != sizeof h + sizeof state) {
+        if (n < sizeof h + sizeof snapshot) {
             fprintf(stderr, "ERROR\t invalid datalen\n");
             return;
         }
 
         std::memcpy(&h, data, sizeof h);
-        if (player.id != h.playerId) {
-            player.id = h.playerId;
-        }
+        std::memcpy(&snapshot, data + sizeof h, sizeof snapshot);
 
-        if (h.payloadSize != sizeof state) {
+        const size_t expected = sizeof snapshot 
+            + snapshot.numPlayers * sizeof (proto::Player) 
+            + snapshot.numBullets * sizeof (proto::Bullet)
+            + snapshot.numNpcs * sizeof (proto::Npc);
+        if (h.payloadSize != n - sizeof h || h.payloadSize != expected) {
             fprintf(stderr, "ERROR\t, invalid payloadsize\n");
             return;
         }
 
-        std::memcpy(&state, data + sizeof h, sizeof state);
+        Timeline::Zone zone{&timeline, "decode snapshot"};
+        if (snapshot.tick < serverTick) {
+            // Stale snapshot that got reordered on the way
+            return;
+        }
+        serverTick = snapshot.tick;
+
+        // Each snapshot only has the entities the server ranked highest this
+        // time, so every one of them is applied
+        DecodedSnapshot s;
+        s.playerId = h.playerId;
+        s.receivedAt = Clock::now();
+        const char* it = data + sizeof h + sizeof snapshot;
+        s.players.resize(snapshot.numPlayers);
+        std::memcpy(s.players.data(), it, snapshot.numPlayers * sizeof (proto::Player));
+        it += snapshot.numPlayers * sizeof (proto::Player);
+        s.bullets.resize(snapshot.numBullets);
+        std::memcpy(s.bullets.data(), it, snapshot.numBullets * sizeof (proto::Bullet));
+        it += snapshot.numBullets * sizeof (proto::Bullet);
+        s.npcs.resize(snapshot.numNpcs);
+        std::memcpy(s.npcs.data(), it, snapshot.numNpcs * sizeof (proto::Npc));
+        pendingSnapshot = std::move(s);
+
+        ping.store(con.getPing().count(), std::memory_order_relaxed);
+        handOver();
+    });
 
-        enemies.clear();
-        for (int i = 0; i < state.numPlayers; ++i) {
-            proto::Player& p = state.players[i];
-            if (p.id == player.id) {
-                player.pos = p.pos;
-                player.velo = p.velo;
-                player.stats = p.stats;
-                player.target = p.target;
-            } else {
-                enemies.push_back(p);
+    for (const Channel channel : {proto::eventChannel, proto::chunkChannel}) {
+        con.listen(channel, [this, channel](char* data, size_t n) {
+            if (pending.size() >= pendingCapacity) {
+                fprintf(stderr, "ERROR\t game loop is not keeping up, dropping a message on channel %d\n", channel);
+                return;
+            }
+            pending.push_back({channel, false, {data, data + n}});
+            handOver();
+        });
+    }
+}
+
+Game::~Game() {
+    if (network.joinable()) {
+        con.get_executor().stop();
+        network.join();
+    }
+}
+
+// What the game loop has no room for is tried again shortly, rather than
+// waiting for the next message. A snapshot that doesn't fit replaces the one
+// before it, the newer one matters more.
+void Game::handOver() {
+    if (pendingSnapshot && snapshots.push(*pendingSnapshot)) {
+        pendingSnapshot.reset();
+    }
+    while (!pending.empty() && received.push(pending.front())) {
+        pending.pop_front();
+    }
+
+    if ((pendingSnapshot || !pending.empty()) && !handOverScheduled) {
+        handOverScheduled = true;
+        handOverTimer.expires_after(handOverRetry);
+        handOverTimer.async_wait([this](std::error_code ec) {
+            handOverScheduled = false;
+            if (!ec) {
+                handOver();
             }
+        });
+    }
+}
+
+void Game::applySnapshot(const DecodedSnapshot& s) {
+    if (player.id != s.playerId) {
+        player.id = s.playerId;
+    }
+
+    const auto now = s.receivedAt;
+    for (const auto& p : s.players) {
+        if (p.id == player.id) {
+            player.pos = p.pos;
+            player.velo = p.velo;
+            player.target = p.target;
+        } else {
+            enemies[p.id] = {p, now};
         }
+    }
+
+    predictedBullets.clear();
+    for (const auto& b : s.bullets) {
+        bullets[b.id] = {b, now};
+    }
+
+    for (const auto& npc : s.npcs) {
+        npcs[npc.id] = {npc, now};
+    }
+
+    std::erase_if(enemies, [this, now](const auto& item) {
+        return now - item.second.seenAt > enemyStaleDuration || (item.second.seenAt != now && hidden(item.second.value.pos));
+    });
+    std::erase_if(bullets, [now](const auto& item) {
+        return now - item.second.seenAt > proto::bulletLifetime;
+    });
+    std::erase_if(npcs, [this, now](const auto& item) {
+        return now - item.second.seenAt > enemyStaleDuration || (item.second.seenAt != now && hidden(item.second.value.pos));
+    });
+}
+
+// Whether the server leaves the position out of our snapshots for being
+// behind a block
+bool Game::hidden(Vec2 pos) const {
+    const Vec2 diff = pos - player.pos;
+    const float d2 = lengthSquared(diff);
+    if (d2 <= 0 || d2 >= proto::occlusionDistance * proto::occlusionDistance) {
+        return false;
+    }
+    const float d = std::sqrt(d2);
+    return world.raycast({player.pos, (1 / d) * diff, d}).block != nullptr;
+}
 
-        bullets.clear();
-        for (int i = 0; i < state.numBullets; ++i) {
-            bullets.push_back(state.bullets[i]);
+void Game::applyEvents(const char* data, size_t n) {
+    proto::Header h;
+    if (n < sizeof h) {
+        fprintf(stderr, "ERROR\t invalid datalen\n");
+        return;
+    }
+
+    std::memcpy(&h, data, sizeof h);
+    if (h.payloadSize != n - sizeof h || h.payloadSize % sizeof (proto::Event) != 0) {
+        fprintf(stderr, "ERROR\t, invalid payloadsize\n");
+        return;
+    }
+
+    for (size_t i = 0; i < h.payloadSize / sizeof (proto::Event); ++i) {
+        proto::Event e;
+        std::memcpy(&e, data + sizeof h + i * sizeof e, sizeof e);
+        scoreboard.apply(e);
+        if (e.type == proto::Event::Type::Leave) {
+            enemies.erase(e.subject);
+            npcs.erase(e.subject);
+        }
+    }
+}
+
+void Game::applyChunk(const char* data, size_t n) {
+    proto::Header h;
+    proto::ChunkPart part;
+    if (n < sizeof h + sizeof part) {
+        fprintf(stderr, "ERROR\t invalid datalen\n");
+        return;
+    }
+
+    std::memcpy(&h, data, sizeof h);
+    std::memcpy(&part, data + sizeof h, sizeof part);
+    if (h.payloadSize != n - sizeof h || h.payloadSize != sizeof part + part.numBlocks * sizeof (Block)) {
+        fprintf(stderr, "ERROR\t, invalid payloadsize\n");
+        return;
+    }
+
+    // Parts after the first one add to the chunk
+    Chunk chunk{part.coord};
+    if (part.offset > 0) {
+        if (const Chunk* have = world.find(part.coord)) {
+            chunk.blocks = have->blocks;
+        }
+    }
+    const size_t first = chunk.blocks.size();
+    chunk.blocks.resize(first + part.numBlocks);
+    std::memcpy(chunk.blocks.data() + first, data + sizeof h + sizeof part, part.numBlocks * sizeof (Block));
+    world.insert(std::move(chunk));
+    tiles.invalidate(part.coord);
+}
+
+// Queued for the network thread, which is woken up to send it right away
+void Game::send(Channel channel, bool reliable, std::pair<char*, size_t> message) {
+    Packet packet{channel, reliable, {message.first, message.first + message.second}};
+    delete[] message.first;
+    if (!outgoing.push(packet)) {
+        fprintf(stderr, "ERROR\t too many inputs queued, dropping one\n");
+        return;
+    }
+
+    asio::post(con.get_executor(), [this] {
+        Timeline::Zone zone{&timeline, "send"};
+        Packet p;
+        while (outgoing.pop(p)) {
+            if (p.reliable) {
+                con.writeReliable(p.channel, p.data.data(), p.data.size());
+            } else {
+                con.write(p.channel, p.data.data(), p.data.size());
+            }
         }
+        ping.store(con.getPing().count(), std::memory_order_relaxed);
     });
 }
 
@@ -90,7 +299,11 @@ void Game::init() {
     rl::SetTargetFPS(144);
     rl::HideCursor();
 
-    moveAnimation = std::make_unique<Animation>("assets/Top_Down_Survivor/rifle/move", 1000ms);
+    // assetpack makes the bundle, the files are only read without one
+    if (std::filesystem::exists(bundlePath)) {
+        bundle = std::make_unique<Bundle>(bundlePath);
+    }
+    animations = std::make_unique<AnimationCache>(assetRoot, bundle.get(), textureBudget, "rifle/move", 1000ms);
 
     prevUpdate = Clock::now();
     player.pos.x = 0;
@@ -99,22 +312,15 @@ void Game::init() {
     player.velo.y = 0;
 }
 
-void Game::update() {
-    renderWidth = rl::GetRenderWidth();
-    renderHeight = rl::GetRenderHeight();
-
-    const auto now = Clock::now();
-    const auto dt = now - prevUpdate;
-    const float dtf = std::chrono::duration_cast<std::chrono::duration<float>>(dt).count();
-    prevUpdate = now;
-
+// Moves and shots of the player, sent to the server as they happen
+void Game::input() {
     const auto prevVelo = player.velo;
     player.velo.x = (rl::IsKeyDown(rl::KEY_D) - rl::IsKeyDown(rl::KEY_A)) * proto::playerSpeed;
     player.velo.y = (rl::IsKeyDown(rl::KEY_S) - rl::IsKeyDown(rl::KEY_W)) * proto::playerSpeed;
 
     const float velo = length(player.velo);
     if (velo > 0) {
-        player.velo = proto::playerSpeed * player.velo / length(player.velo);
+        player.velo = (proto::playerSpeed / velo) * player.velo;
     }
 
     if (std::abs(player.velo.x - prevVelo.x) > std::numeric_limits<float>::epsilon() || 
@@ -128,9 +334,12 @@ void Game::update() {
         eventShoot();
     }
 
+    if (rl::IsMouseButtonPressed(rl::MOUSE_BUTTON_RIGHT)) {
+        eventHitscan();
+    }
+
     {
-        const auto pos = rl::GetMousePosition();
-        const auto wpos = screenCoordToWorldPos(pos);
+        const auto wpos = screenCoordToWorldPos(fromRl(rl::GetMousePosition()));
         if (wpos.x != player.target.x || wpos.y != player.target.y) {
             player.target = wpos;
             static Clock::time_point prevEvent{};
@@ -140,89 +349,182 @@ void Game::update() {
         }
 
     }
+}
+
+void Game::update() {
+    Timeline::Zone zone{&timeline, "update"};
+    {
+        Timeline::Zone zone{&timeline, "apply snapshots"};
+        DecodedSnapshot s;
+        while (snapshots.pop(s)) {
+            applySnapshot(s);
+        }
+    }
+    {
+        Timeline::Zone zone{&timeline, "apply received"};
+        Packet p;
+        while (received.pop(p)) {
+            if (p.channel == proto::eventChannel) {
+                applyEvents(p.data.data(), p.data.size());
+            } else {
+                applyChunk(p.data.data(), p.data.size());
+            }
+        }
+    }
+
+    renderWidth = rl::GetRenderWidth();
+    renderHeight = rl::GetRenderHeight();
+
+    const auto now = Clock::now();
+    const auto dt = now - prevUpdate;
+    const float dtf = std::chrono::duration_cast<std::chrono::duration<float>>(dt).count();
+    frameGraph.add(dt);
+    prevUpdate = now;
+
+    if (!spectating) {
+        input();
+    }
 
     viewStats = rl::IsKeyDown(rl::KEY_TAB);
 
+    if (rl::IsKeyPressed(rl::KEY_F3)) {
+        viewFrameGraph = !viewFrameGraph;
+    }
+
+    // Written out when turned off again
+    if (rl::IsKeyPressed(rl::KEY_F2)) {
+        timeline.setEnabled(!timeline.isEnabled());
+        if (!timeline.isEnabled()) {
+            try {
+                const size_t n = timeline.writeChrome(tracePath);
+                fprintf(stderr, "INFO\t wrote %zu trace events to %s\n", n, tracePath);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "ERROR\t unable to write the trace: %s\n", e.what());
+            }
+        }
+    }
+
+    for (size_t i = 0; i < std::size(weapons); ++i) {
+        if (rl::IsKeyPressed(rl::KEY_ONE + int(i))) {
+            weapon = i;
+        }
+    }
+    animations->update();
+
+    world.evict(World::chunkOf(player.pos), proto::chunkKeepRadius + 1);
+
     player.pos = player.pos + dtf * player.velo;
 
-    for (auto& enemy : enemies) {
-        enemy.pos = enemy.pos + dtf * enemy.velo;
+    for (auto& [_, enemy] : enemies) {
+        enemy.value.pos = enemy.value.pos + dtf * enemy.value.velo;
+    }
+
+    // The server takes out bullets that hit a block without telling us
+    for (auto& [_, bullet] : bullets) {
+        bullet.value.pos = bullet.value.pos + dtf * bullet.value.velo;
+    }
+    std::erase_if(bullets, [this](const auto& item) {
+        return world.blockAt(item.second.value.pos) != nullptr;
+    });
+
+    for (auto& [_, npc] : npcs) {
+        npc.value.pos = npc.value.pos + dtf * npc.value.velo;
     }
 
-    for (auto& bullet : bullets) {
+    for (auto& bullet : predictedBullets) {
         bullet.pos = bullet.pos + dtf * bullet.velo;
     }
+    std::erase_if(predictedBullets, [this](const auto& b) {
+        return world.blockAt(b.pos) != nullptr;
+    });
+
+    std::erase_if(tracers, [now](const auto& t) {
+        return now - t.firedAt > tracerDuration;
+    });
 
 //    moveAnimation->update(dt);
-    con.poll();
 }
 
 void Game::renderPlayer(const proto::Player& player, Animation& animation) {
         const auto pos = (player.id == this->player.id ? screenCenter() : worldPosToScreenCoord(player.pos));
-        auto& frame = animation.currentFrame();
+        const auto& frame = animation.currentFrame();
         const auto diff = player.target - player.pos;
         const float rotation =  RAD2DEG * std::atan2(diff.y, diff.x);
-        const float w = (float)frame.width / 6;
-        const float h = (float)frame.height / 6;
-        const rl::Vector2 origin{3 * w / 8.f, 5 * h / 8.f};
+        const float w = frame.source.width / 6;
+        const float h = frame.source.height / 6;
+        const Vec2 origin{3 * w / 8.f, 5 * h / 8.f};
 
-        rl::DrawTexturePro(frame, 
-                           {0, 0, (float)frame.width, (float)frame.height},
+        rl::DrawTexturePro(frame.texture, 
+                           frame.source,
                            {pos.x, pos.y, w, h}, 
-                           origin,
+                           toRl(origin),
                            rotation, 
                            rl::WHITE);
+}
+
+// Enemies don't tell which weapon they carry, so they get the rifle
+Animation& Game::animationOf(const proto::Player& p) {
+    const bool self = p.id == player.id;
+    const Weapon& w = weapons[self ? weapon : 0];
+    const char* state = p.velo == Vec2{0, 0} ? "idle" : "move";
+    if (self && Clock::now() - attackedAt < attackAnimationDuration) {
+        state = w.attack;
+    }
+    return animations->get(std::format("{}/{}", w.name, state));
+}
 
-        rl::DrawText(std::format("HEALTH {}", player.health).c_str(), pos.x + origin.x, pos.y - origin.y, 14, player.health > 25 ? rl::WHITE : rl::RED);
+// Apart from the sprites, which then all come from the same atlas and get
+// drawn together
+void Game::renderHealth(const proto::Player& player, Animation& animation) {
+        const auto pos = (player.id == this->player.id ? screenCenter() : worldPosToScreenCoord(player.pos));
+        const auto& frame = animation.currentFrame();
+        const Vec2 origin{3 * frame.source.width / 48.f, 5 * frame.source.height / 48.f};
+
+        const auto health = scoreboard.health(player.id);
+        rl::DrawText(std::format("HEALTH {}", health).c_str(), pos.x + origin.x, pos.y - origin.y, 14, health > 25 ? rl::WHITE : rl::RED);
 }
 
+// Only the chunks on the screen, each one a texture with its blocks in it
 void Game::renderMatrix() {
-    const int n = 5;
-    const float w = aspectRatio() * viewHeight + 4 * n;
-    const float h = viewHeight + 4 * n;
-    const int px = std::floor(player.pos.x - n);
-    const int py = std::floor(player.pos.y - n);
-    const rl::Vector2 origin{(px - px % n) - w / 2, (py - py % n) - h / 2};
-
-    for (int i = 0; i < h; i += n) {
-        const float y = origin.y + i;
-        auto start = worldPosToScreenCoord({origin.x, y});
-        auto end = worldPosToScreenCoord({origin.x + w, y});
-        rl::DrawLineV(start, end, rl::GREEN);
-    }
-
-    for (int j = 0; j < w; j += n) {
-        const float x = origin.x + j;
-        auto start = worldPosToScreenCoord({x, origin.y});
-        auto end = worldPosToScreenCoord({x, origin.y + h});
-        rl::DrawLineV(start, end, rl::GREEN);
-    }
-
-    const auto center = screenCenter();
-    for (const auto& block : world.getBlocks()) {
-        const auto size = hpx() * block.size;
-        const auto pos = worldPosToScreenCoord(block.pos);
-        //if (std::abs(pos.x - center.x) < (renderWidth / 2.f + size.x) && std::abs(pos.y - center.y) < (renderHeight / 2.f + size.y)) {
-            rl::DrawRectangleV(pos, size, rl::GREEN);
-        //}
-    }
+    Timeline::Zone zone{&timeline, "world"};
+    tiles.draw([this](Vec2 pos) {
+        return worldPosToScreenCoord(pos);
+    });
 }
 
 
 void Game::render() {
+    Timeline::Zone zone{&timeline, "render"};
+    const Vec2 screen{float(renderWidth), float(renderHeight)};
+    {
+        Timeline::Zone zone{&timeline, "tiles"};
+        tiles.update(world, screenCoordToWorldPos({0, 0}), screenCoordToWorldPos(screen), hpx());
+    }
+
     rl::BeginDrawing();
     rl::ClearBackground(rl::BLACK);
 
     renderMatrix();
 
-    for(auto& enemy : enemies) {
-        renderPlayer(enemy, *moveAnimation);
-    }
+    {
+        Timeline::Zone zone{&timeline, "sprites"};
+        for (const auto& [_, npc] : npcs) {
+            rl::DrawCircleV(toRl(worldPosToScreenCoord(npc.value.pos)), proto::enemyRadius * hpx(), rl::RED);
+        }
 
-    renderPlayer(player, *moveAnimation);
+        for(auto& [_, enemy] : enemies) {
+            renderPlayer(enemy.value, animationOf(enemy.value));
+        }
+        renderPlayer(player, animationOf(player));
+
+        for(auto& [_, enemy] : enemies) {
+            renderHealth(enemy.value, animationOf(enemy.value));
+        }
+        renderHealth(player, animationOf(player));
+    }
 
     {
-        const auto pos = rl::GetMousePosition();
+        const auto pos = fromRl(rl::GetMousePosition());
         const auto wpos = screenCoordToWorldPos(pos);
         const float w = 20.0f;
         rl::DrawLine(pos.x - w/2, pos.y, pos.x + w/2, pos.y, rl::GREEN);
@@ -231,42 +533,43 @@ void Game::render() {
     }
 
     {
-        for(auto& bullet : bullets) {
-            const auto pos = worldPosToScreenCoord(bullet.pos);
-            const float r = proto::bulletRadius * hpx();
-            rl::DrawCircleV(pos, r, rl::GOLD);
+        const float r = proto::bulletRadius * hpx();
+        for(auto& [_, bullet] : bullets) {
+            rl::DrawCircleV(toRl(worldPosToScreenCoord(bullet.value.pos)), r, rl::GOLD);
+        }
+        for(auto& bullet : predictedBullets) {
+            rl::DrawCircleV(toRl(worldPosToScreenCoord(bullet.pos)), r, rl::GOLD);
+        }
+        for (const auto& t : tracers) {
+            rl::DrawLineV(toRl(worldPosToScreenCoord(t.from)), toRl(worldPosToScreenCoord(t.to)), rl::GOLD);
         }
     }
 
+    Timeline::Zone text{&timeline, "text"};
     rl::DrawFPS(10, 10);
 
     {
-        const float ping = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(con.getPing()).count();
-        rl::DrawText(std::format("ping {:.3f}ms", ping).c_str(), 10, 30, 16, rl::WHITE);
+        const float ms = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(
+            Clock::duration{ping.load(std::memory_order_relaxed)}).count();
+        rl::DrawText(std::format("ping {:.3f}ms", ms).c_str(), 10, 30, 16, rl::WHITE);
     }
 
     if (viewStats) {
-        std::vector<proto::Player> players{enemies.begin(), enemies.end()};
-        players.push_back(player);
-        std::sort(players.begin(), players.end(), [](const proto::Player& a, const proto::Player& b) {
-            return (a.stats.kills - a.stats.deaths) > (b.stats.kills - b.stats.kills);
-        });
-        std::stringstream ss;
-        for (const auto& p : players) {
-                ss << std::format("ID: {:<6}\tKILLS: {:<6}\tDEATHS: {:<6}\tK/D: {:<6.1f}",
-                              p.id, p.stats.kills, p.stats.deaths, 1.0f * p.stats.kills / p.stats.deaths);
-
-            if (p.id == player.id) {
-                ss << " <--- YOU";
-            }
-
-            ss << '\n';
-        }
+        rl::DrawText(scoreboard.text(player.id).c_str(), 10, 50, 18, rl::GREEN);
 
-        rl::DrawText(ss.str().c_str(), 10, 50, 18, rl::GREEN);
+        const auto& s = animations->getStats();
+        const double mib = 1024.0 * 1024.0;
+        rl::DrawText(std::format("textures {:.1f}/{:.1f} MiB in {} animations, {} hits {} misses {} loads {} evictions",
+                                 s.bytes / mib, textureBudget / mib, s.resident, s.hits, s.misses, s.loads, s.evictions).c_str(),
+                     10, renderHeight - 26, 16, rl::WHITE);
     }
 
+    if (viewFrameGraph) {
+        frameGraph.draw(renderWidth - 370, 10, 360, 120);
+    }
 
+    // Waits for the frame to be shown too
+    Timeline::Zone present{&timeline, "present"};
     rl::EndDrawing();
 }
 
@@ -274,11 +577,30 @@ void Game::run() {
 
     init();
 
+    timeline.nameThread("main");
+    animations->timeline = &timeline;
+
+    if (spectating) {
+        const proto::Spectate spectate{};
+        send(proto::spectateChannel, true, proto::makeMessage({0, sizeof spectate}, &spectate));
+    }
+
+    network = std::thread{[this] {
+        timeline.nameThread("network");
+        auto work = asio::make_work_guard(con.get_executor());
+        con.get_executor().run();
+    }};
+
     while (!rl::WindowShouldClose()) {
         update();
         render();
     }
 
+    con.get_executor().stop();
+    network.join();
+
+    tiles.clear();
+    animations.reset();
     rl::CloseWindow();
 }
 
@@ -287,9 +609,7 @@ void Game::eventMove() {
     proto::Header h{player.id, sizeof move};
     auto [bufOut, n] = proto::makeMessage(h, &move);
 
-    con.writeReliable(proto::moveChannel, bufOut, n, [bufOut](auto, auto) {
-        delete[] bufOut;
-    });
+    send(proto::moveChannel, true, {bufOut, n});
 }
 
 void Game::eventMouseMove() {
@@ -297,10 +617,7 @@ void Game::eventMouseMove() {
     proto::Header h{player.id, sizeof mouseMove};
     auto [bufOut, n] = proto::makeMessage(h, &mouseMove);
 
-    con.write(proto::mouseMoveChannel, bufOut, n, [bufOut](auto, auto) {
-        delete[] bufOut;
-    });
-
+    send(proto::mouseMoveChannel, false, {bufOut, n});
 }
 
 
@@ -311,6 +628,7 @@ void Game::eventShoot() {
         fprintf(stderr, "ERROR\t can't shoot yourself\n");
         return;
     }
+    attackedAt = Clock::now();
 
     diff = (diff / length(diff));
 
@@ -320,7 +638,7 @@ void Game::eventShoot() {
         player.id
     );
 
-    bullets.push_back(bullet);
+    predictedBullets.push_back(bullet);
 
     proto::Shoot shoot{bullet};
     auto [bufOut, n] = proto::makeMessage(
@@ -328,7 +646,28 @@ void Game::eventShoot() {
         &shoot
     );
 
-    con.write(proto::shootChannel, bufOut, n, [bufOut](auto, auto) {
-        delete[] bufOut;
-    });
+    send(proto::shootChannel, false, {bufOut, n});
+}
+
+void Game::eventHitscan() {
+    const auto diff = player.target - player.pos;
+    if (diff.x == 0 && diff.y == 0) {
+        fprintf(stderr, "ERROR\t can't shoot yourself\n");
+        return;
+    }
+    attackedAt = Clock::now();
+
+    // The server decides what was hit, the tracer only stops at the blocks
+    // we know of
+    const Vec2 dir = unit(diff);
+    const RayHit hit = world.raycast({player.pos, dir, proto::hitscanRange});
+    tracers.push_back({player.pos, player.pos + hit.distance * dir, Clock::now()});
+
+    proto::Hitscan shot{dir};
+    auto [bufOut, n] = proto::makeMessage(
+        {player.id, sizeof shot},
+        &shot
+    );
+
+    send(proto::hitscanChannel, false, {bufOut, n});
 }
@@ -1,7 +1,11 @@
 #ifndef GAME_H
 #define GAME_H
 
+#include <atomic>
 #include <chrono>
+#include <deque>
+#include <optional>
+#include <thread>
 #include <vector>
 #include <asio.hpp>
 // Hack to make build work with mingw compiler
@@ -10,45 +14,126 @@
 #endif
 #include "protocol.h"
 #include "connection.h"
-#include "animation.h"
+#include "handoff.h"
+#include "animation_cache.h"
+#include "bundle.h"
+#include "frame_graph.h"
+#include "scoreboard.h"
+#include "tiles.h"
+#include "timeline.h"
 #include "world.h"
 
 
 using udp = asio::ip::udp;
 
-struct Message {
-	proto::Header header;
-	std::vector<char> payload;
+// A message between the game loop and the network thread
+struct Packet {
+	Channel channel;
+	bool reliable; // Only when sending
+	std::vector<char> data;
+};
+
+// Snapshot taken apart on the network thread
+struct DecodedSnapshot {
+	proto::ID playerId;
+	Clock::time_point receivedAt;
+	std::vector<proto::Player> players;
+	std::vector<proto::Bullet> bullets;
+	std::vector<proto::Npc> npcs;
+};
+
+// Snapshots only carry the entities most relevant to us, so entities are
+// kept around until the server has not mentioned them for a while, or until
+// it can't have for them being hidden behind a block.
+template <typename T>
+struct Replicated {
+	T value;
+	Clock::time_point seenAt;
+};
+
+// Line drawn for a hitscan shot, which has no bullet to show
+struct Tracer {
+	Vec2 from;
+	Vec2 to;
+	Clock::time_point firedAt;
 };
 
 class Game {
 public:
-	Game(const char* serverAddr);
+	// Animations are kept on the GPU while their atlases take at most
+	// textureBudget bytes. Spectating watches the followed player of the
+	// server or relay without playing.
+	Game(const char* serverAddr, unsigned short port, size_t textureBudget, bool spectating);
+	~Game();
 	void run();
 private:
 	void init();
+	void input();
 	void update();
 	void render();
 
+	// Game loop side of the network thread
+	void applySnapshot(const DecodedSnapshot& s);
+	bool hidden(Vec2 pos) const;
+	void applyEvents(const char* data, size_t n);
+	void applyChunk(const char* data, size_t n);
+	void send(Channel channel, bool reliable, std::pair<char*, size_t> message);
+	// Network thread side
+	void handOver();
+
 	void eventMove();
 	void eventShoot();
+	void eventHitscan();
 	void eventMouseMove();
 
-	rl::Vector2 worldPosToScreenCoord(rl::Vector2 pos);
-	rl::Vector2 screenCoordToWorldPos(rl::Vector2 coord);
+	Vec2 worldPosToScreenCoord(Vec2 pos);
+	Vec2 screenCoordToWorldPos(Vec2 coord);
 	void renderPlayer(const proto::Player& player, Animation& animation);
+	void renderHealth(const proto::Player& player, Animation& animation);
+	Animation& animationOf(const proto::Player& p);
 	void renderMatrix();
 
+	// First, so it outlives every thread recording into it
+	Timeline timeline;
+	FrameGraph frameGraph;
+	bool viewFrameGraph{false};
+
 	Clock::time_point prevUpdate;
 	Clock::time_point prevServerUpdate;
-	Connection con;
+	Connection con; // Only touched by the network thread once it runs
+
+	// Owned by the network thread
+	proto::Tick serverTick{0};
+	// Received, but their queue was full. Only the newest snapshot is kept,
+	// events and chunk parts up to pendingCapacity.
+	std::optional<DecodedSnapshot> pendingSnapshot;
+	std::deque<Packet> pending;
+	asio::steady_timer handOverTimer; // Tries again while anything is pending
+	bool handOverScheduled{false};
+
+	// Between the threads
+	SpscQueue<DecodedSnapshot> snapshots;
+	SpscQueue<Packet> received; // Events and chunk parts, in order
+	SpscQueue<Packet> outgoing;
+	std::atomic<Clock::rep> ping{0};
+	std::thread network;
 
 	proto::Player player;
-	std::vector<proto::Player> enemies;
-	std::vector<proto::Bullet> bullets;
+	std::map<proto::ID, Replicated<proto::Player>> enemies;
+	std::map<proto::ID, Replicated<proto::Bullet>> bullets;
+	std::map<proto::ID, Replicated<proto::Npc>> npcs;
+	std::vector<proto::Bullet> predictedBullets;
+	Scoreboard scoreboard;
+	std::vector<Tracer> tracers;
 	bool viewStats{false};
-	std::unique_ptr<Animation> moveAnimation;
+	bool spectating;
+	size_t textureBudget;
+	std::unique_ptr<Bundle> bundle;
+	std::unique_ptr<AnimationCache> animations;
+	size_t weapon{0};
+	Clock::time_point attackedAt{};
 	World world;
+	ChunkTiles tiles;
 };
 
 
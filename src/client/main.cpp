@@ -1,18 +1,25 @@
 #include "game.h"
 #include <stdio.h>
+#include <stdlib.h>
 
+constexpr size_t defaultTextureBudgetMiB = 64;
+constexpr unsigned short serverPort = 6969;
 
 int main(int argc, char** argv) {
     const char* addr;
-    if (argc != 2) {
-        printf("usage: app server-address\n");
+    if (argc < 2 || argc > 4) {
+        printf("usage: app server-address [texture-budget-MiB] [spectate-port]\n");
         addr = "109.204.231.229";
     } else {
         addr = argv[1];
     }
+    const size_t budgetMiB = argc >= 3 ? strtoull(argv[2], nullptr, 10) : defaultTextureBudgetMiB;
+    // Watching goes through a relay, or the server itself, on that port
+    const bool spectating = argc == 4;
+    const unsigned short port = spectating ? atoi(argv[3]) : serverPort;
 
     try {
-        Game g(addr);
+        Game g(addr, port, budgetMiB * 1024 * 1024, spectating);
         g.run();
     } catch(const std::exception& e) {
         fprintf(stderr, "Game failed: %s\n", e.what());
@@ -0,0 +1,126 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <cmath>
+#include <unordered_map>
+#include "rl.h"
+#include "world.h"
+
+// The grid and blocks of each chunk on the screen drawn once into a texture
+// of its own, so a frame draws a textured quad per chunk however many blocks
+// there are. Tiles are drawn again when their chunk changes or the scale
+// does, and dropped once they are off the screen.
+class ChunkTiles {
+public:
+	static constexpr float gridSpacing = 5.f;
+
+	ChunkTiles() = default;
+	ChunkTiles(const ChunkTiles&) = delete;
+	ChunkTiles& operator=(const ChunkTiles&) = delete;
+
+	~ChunkTiles() {
+		clear();
+	}
+
+	// Makes the tiles the view from its top left to its bottom right corner
+	// needs at scale pixels per unit. Draws into textures, so it has to be
+	// called outside of BeginDrawing().
+	void update(const World& world, Vec2 from, Vec2 to, float scale) {
+		if (scale != this->scale) {
+			clear();
+			this->scale = scale;
+		}
+		lo = World::chunkOf(from);
+		hi = World::chunkOf(to);
+
+		std::erase_if(tiles, [this](auto& kv) {
+			if (visible(World::coordOf(kv.first))) {
+				return false;
+			}
+			rl::UnloadRenderTexture(kv.second.texture);
+			return true;
+		});
+		for (int32_t x = lo.x; x <= hi.x; ++x) {
+			for (int32_t y = lo.y; y <= hi.y; ++y) {
+				const ChunkCoord c{x, y};
+				auto [it, inserted] = tiles.try_emplace(World::key(c));
+				if (inserted || it->second.stale) {
+					render(world, c, it->second);
+				}
+			}
+		}
+	}
+
+	// The chunk changed and its tile has to be drawn again
+	void invalidate(ChunkCoord c) {
+		if (auto it = tiles.find(World::key(c)); it != tiles.end()) {
+			it->second.stale = true;
+		}
+	}
+
+	// toScreen maps a world position to the screen
+	template <typename F>
+	void draw(F toScreen) const {
+		const float size = World::chunkSize * scale;
+		for (const auto& [key, tile] : tiles) {
+			const auto& t = tile.texture.texture;
+			const Vec2 pos = toScreen(World::origin(World::coordOf(key)));
+			// Render textures are upside down
+			rl::DrawTexturePro(t, {0, 0, float(t.width), -float(t.height)}, {pos.x, pos.y, size, size},
+			                   {0, 0}, 0, rl::WHITE);
+		}
+	}
+
+	// Has to happen before the window closes
+	void clear() {
+		for (auto& [_, tile] : tiles) {
+			rl::UnloadRenderTexture(tile.texture);
+		}
+		tiles.clear();
+	}
+
+private:
+	struct Tile {
+		rl::RenderTexture2D texture{};
+		bool stale{false};
+	};
+
+	bool visible(ChunkCoord c) const {
+		return c.x >= lo.x && c.y >= lo.y && c.x <= hi.x && c.y <= hi.y;
+	}
+
+	// Grid lines fall on multiples of gridSpacing, so they carry on across
+	// tiles although the chunk size isn't one
+	void render(const World& world, ChunkCoord c, Tile& tile) {
+		const int px = int(std::ceil(World::chunkSize * scale));
+		if (tile.texture.id == 0) {
+			tile.texture = rl::LoadRenderTexture(px, px);
+		}
+		const Vec2 o = World::origin(c);
+
+		rl::BeginTextureMode(tile.texture);
+		rl::ClearBackground(rl::BLANK);
+		for (int k = int(std::ceil(o.x / gridSpacing)); k * gridSpacing < o.x + World::chunkSize; ++k) {
+			const float x = (k * gridSpacing - o.x) * scale;
+			rl::DrawLineV({x, 0}, {x, float(px)}, rl::GREEN);
+		}
+		for (int k = int(std::ceil(o.y / gridSpacing)); k * gridSpacing < o.y + World::chunkSize; ++k) {
+			const float y = (k * gridSpacing - o.y) * scale;
+			rl::DrawLineV({0, y}, {float(px), y}, rl::GREEN);
+		}
+		if (const Chunk* chunk = world.find(c)) {
+			for (const auto& block : chunk->blocks) {
+				rl::DrawRectangleV(toRl(scale * (block.pos - o)), toRl(scale * block.size), rl::GREEN);
+			}
+		}
+		rl::EndTextureMode();
+		tile.stale = false;
+	}
+
+	float scale{0};
+	ChunkCoord lo{0, 0};
+	ChunkCoord hi{-1, -1};
+	std::unordered_map<uint64_t, Tile> tiles;
+};
+
+#endif
@@ -0,0 +1,396 @@
+#include "protocol.h"
+#include "util.h"
+#include "histogram.h"
+#include "log.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <numbers>
+#include <optional>
+
+
+// Headless load generator: simulates many clients against a server to find
+// out how many players one instance can handle. Spectators only watch, to
+// load a server or relay with an audience.
+
+using namespace std::chrono_literals;
+
+constexpr auto mouseMoveInterval = 30ms;
+constexpr auto reportInterval = 1s;
+
+class Bot {
+public:
+    Bot(const udp::endpoint& server, uint32_t seed, bool spectator, const Conditions& conditions)
+    : con{server, conditions},
+      spectator{spectator},
+      mt{seed}
+    {
+        con.listen(proto::updateChannel, [this](char* data, size_t n) {
+            onSnapshot(data, n);
+        });
+
+        con.listen(proto::eventChannel, [this](char* data, size_t n) {
+            proto::Header h;
+            if (n < sizeof h || (n - sizeof h) % sizeof (proto::Event) != 0) {
+                invalid++;
+                return;
+            }
+            events += (n - sizeof h) / sizeof (proto::Event);
+        });
+
+        con.listen(proto::chunkChannel, [this](char* data, size_t n) {
+            proto::Header h;
+            proto::ChunkPart part;
+            if (n < sizeof h + sizeof part) {
+                invalid++;
+                return;
+            }
+            std::memcpy(&part, data + sizeof h, sizeof part);
+            if (n - sizeof h - sizeof part != part.numBlocks * sizeof (Block)) {
+                invalid++;
+                return;
+            }
+            chunks += part.offset == 0;
+
+            // Kept to only take hitscan shots at enemies in sight
+            Chunk chunk{part.coord};
+            if (part.offset > 0) {
+                if (const Chunk* have = world.find(part.coord)) {
+                    chunk.blocks = have->blocks;
+                }
+            }
+            const size_t first = chunk.blocks.size();
+            chunk.blocks.resize(first + part.numBlocks);
+            std::memcpy(chunk.blocks.data() + first, data + sizeof h + sizeof part, part.numBlocks * sizeof (Block));
+            world.insert(std::move(chunk));
+        });
+
+        if (spectator) {
+            const proto::Spectate spectate{};
+            auto [buf, n] = proto::makeMessage({0, sizeof spectate}, &spectate);
+            con.writeReliable(proto::spectateChannel, buf, n);
+            delete[] buf;
+            return;
+        }
+
+        // Moving is what makes the server notice us
+        sendMove({0, 0});
+    }
+
+    void update(Clock::time_point now) {
+        con.poll();
+
+        if (id == 0 || spectator) {
+            return;
+        }
+
+        if (now > nextMove) {
+            const float angle = std::uniform_real_distribution<float>(0, 2 * std::numbers::pi_v<float>)(mt);
+            const bool stop = std::uniform_int_distribution<int>(0, 4)(mt) == 0;
+            sendMove(stop ? Vec2{0, 0} : Vec2{std::cos(angle), std::sin(angle)});
+            nextMove = now + std::chrono::milliseconds(std::uniform_int_distribution<int>(500, 2000)(mt));
+        }
+
+        if (now - prevMouseMove > mouseMoveInterval) {
+            std::uniform_real_distribution<float> dist(-20.f, 20.f);
+            target = pos + Vec2{dist(mt), dist(mt)};
+            proto::MouseMove move{target};
+            auto [buf, n] = proto::makeMessage({id, sizeof move}, &move);
+            con.write(proto::mouseMoveChannel, buf, n, [buf](auto, auto) {
+                delete[] buf;
+            });
+            prevMouseMove = now;
+        }
+
+        if (std::uniform_int_distribution<int>(0, 999)(mt) < 5) {
+            shoot();
+        }
+
+        if (enemy && std::uniform_int_distribution<int>(0, 999)(mt) < 2) {
+            hitscan(*enemy);
+        }
+    }
+
+    Connection con;
+    const bool spectator;
+    proto::ID id{0}; // Followed player of a spectator
+    uint64_t snapshots{0};
+    uint64_t events{0};
+    uint64_t chunks{0};
+    uint64_t invalid{0};
+    Histogram interarrival; // Microseconds between snapshots
+
+private:
+    void onSnapshot(char* data, size_t n) {
+        proto::Header h;
+        proto::Snapshot snapshot;
+        if (n < sizeof h + sizeof snapshot) {
+            invalid++;
+            return;
+        }
+
+        std::memcpy(&h, data, sizeof h);
+        std::memcpy(&snapshot, data + sizeof h, sizeof snapshot);
+
+        const size_t expected = sizeof snapshot
+            + snapshot.numPlayers * sizeof (proto::Player)
+            + snapshot.numBullets * sizeof (proto::Bullet)
+            + snapshot.numNpcs * sizeof (proto::Npc);
+        if (h.payloadSize != n - sizeof h || h.payloadSize != expected || h.payloadSize > proto::maxSnapshotSize) {
+            invalid++;
+            return;
+        }
+
+        // Spectators are switched to another player when theirs leaves
+        if (snapshot.tick < tick || (!spectator && id != 0 && h.playerId != id)) {
+            invalid++;
+            return;
+        }
+        tick = snapshot.tick;
+        id = h.playerId;
+
+        // The server always includes our own player, the followed one of a
+        // spectator while anyone plays
+        bool self = id == 0;
+        enemy.reset();
+        float nearest = proto::hitscanRange * proto::hitscanRange;
+        const char* it = data + sizeof h + sizeof snapshot;
+        for (int i = 0; i < snapshot.numPlayers; ++i) {
+            proto::Player p;
+            std::memcpy(&p, it + i * sizeof p, sizeof p);
+            if (p.id == id) {
+                pos = p.pos;
+                self = true;
+            } else if (distanceSquared(pos, p.pos) < nearest) {
+                nearest = distanceSquared(pos, p.pos);
+                enemy = p.pos;
+            }
+        }
+        if (!self) {
+            invalid++;
+        }
+
+        it += snapshot.numPlayers * sizeof (proto::Player) + snapshot.numBullets * sizeof (proto::Bullet);
+        for (int i = 0; i < snapshot.numNpcs; ++i) {
+            proto::Npc npc;
+            std::memcpy(&npc, it + i * sizeof npc, sizeof npc);
+            if (distanceSquared(pos, npc.pos) < nearest) {
+                nearest = distanceSquared(pos, npc.pos);
+                enemy = npc.pos;
+            }
+        }
+        world.evict(World::chunkOf(pos), proto::chunkKeepRadius + 1);
+
+        const auto now = Clock::now();
+        if (snapshots++ > 0) {
+            interarrival.record(std::chrono::duration_cast<std::chrono::microseconds>(now - prevSnapshot).count());
+        }
+        prevSnapshot = now;
+    }
+
+    void sendMove(Vec2 velo) {
+        proto::Move move{velo};
+        auto [buf, n] = proto::makeMessage({id, sizeof move}, &move);
+        // Kept until confirmed as a copy, the handler of a reliable message
+        // never runs
+        con.writeReliable(proto::moveChannel, buf, n);
+        delete[] buf;
+    }
+
+    void shoot() {
+        auto diff = target - pos;
+        if (diff.x == 0 && diff.y == 0) {
+            return;
+        }
+        diff = unit(diff);
+
+        proto::Shoot shoot{{pos + proto::playerRadius * diff, proto::bulletSpeed * diff, id}};
+        auto [buf, n] = proto::makeMessage({id, sizeof shoot}, &shoot);
+        con.write(proto::shootChannel, buf, n, [buf](auto, auto) {
+            delete[] buf;
+        });
+    }
+
+    void hitscan(Vec2 at) {
+        const Vec2 diff = at - pos;
+        const float d = length(diff);
+        if (d == 0) {
+            return;
+        }
+        const Vec2 dir = (1 / d) * diff;
+        if (world.raycast({pos, dir, d}).block) {
+            return;
+        }
+
+        proto::Hitscan shot{dir};
+        auto [buf, n] = proto::makeMessage({id, sizeof shot}, &shot);
+        con.write(proto::hitscanChannel, buf, n, [buf](auto, auto) {
+            delete[] buf;
+        });
+    }
+
+    std::mt19937 mt;
+    proto::Tick tick{0};
+    Vec2 pos{0, 0};
+    Vec2 target{0, 0};
+    std::optional<Vec2> enemy; // Nearest player or npc in hitscan range
+    World world;
+    Clock::time_point nextMove{};
+    Clock::time_point prevMouseMove{};
+    Clock::time_point prevSnapshot{};
+};
+
+struct Totals {
+    uint64_t connected{0};
+    uint64_t snapshots{0};
+    uint64_t events{0};
+    uint64_t chunks{0};
+    uint64_t invalid{0};
+    uint64_t packetsIn{0};
+    uint64_t bytesIn{0};
+    uint64_t packetsOut{0};
+    uint64_t bytesOut{0};
+    uint64_t lost{0};
+    uint64_t resends{0};
+    Histogram confirmRtt;
+    Histogram interarrival;
+};
+
+void collect(const std::vector<std::unique_ptr<Bot>>& bots, bool histograms, Totals& t) {
+    for (const auto& bot : bots) {
+        const auto& stats = bot->con.getStats();
+        t.connected += bot->spectator ? bot->snapshots > 0 : bot->id != 0;
+        t.snapshots += bot->snapshots;
+        t.events += bot->events;
+        t.chunks += bot->chunks;
+        t.invalid += bot->invalid;
+        t.packetsIn += stats.packetsIn;
+        t.bytesIn += stats.bytesIn;
+        t.packetsOut += stats.packetsOut;
+        t.bytesOut += stats.bytesOut;
+        t.lost += stats.lost;
+        t.resends += stats.resends;
+        if (histograms) {
+            t.confirmRtt.merge(stats.confirmRtt);
+            t.interarrival.merge(bot->interarrival);
+        }
+    }
+}
+
+void printPercentiles(const char* name, const Histogram& h) {
+    printf("%s_us count=%lu mean=%.0f p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n",
+        name, h.count(), h.mean(), h.percentile(50), h.percentile(90), h.percentile(99), h.percentile(99.9), h.max());
+}
+
+int main(int argc, char** argv) {
+    const auto usage = [] {
+        LOG_ERROR("usage: loadgen address port clients [threads] [seconds] [spectators] [--latency ms] [--jitter ms] [--loss fraction]");
+    };
+
+    Conditions conditions;
+    try {
+        conditions = takeConditions(argc, argv, 0);
+    } catch (const std::exception& e) {
+        LOG_ERROR("invalid link conditions: %s", e.what());
+        return -1;
+    }
+    if (argc < 4 || argc > 7) {
+        usage();
+        return -1;
+    }
+
+    const udp::endpoint server{asio::ip::make_address(argv[1]), (unsigned short)std::atoi(argv[2])};
+    const int numClients = std::atoi(argv[3]);
+    const int numThreads = argc > 4 ? std::atoi(argv[4]) : 4;
+    const int seconds = argc > 5 ? std::atoi(argv[5]) : 10;
+    const int numSpectators = argc > 6 ? std::atoi(argv[6]) : 0;
+    // No clients is fine as long as there are spectators
+    if (numClients < 0 || numSpectators < 0 || numClients + numSpectators <= 0 || numThreads <= 0 || seconds <= 0) {
+        usage();
+        LOG_ERROR("threads, seconds and clients plus spectators must be positive");
+        return -1;
+    }
+
+    LOG_INFO("%d clients and %d spectators on %d threads against %s:%d for %ds",
+        numClients, numSpectators, numThreads, server.address().to_string().c_str(), server.port(), seconds);
+    if (conditions.in.enabled()) {
+        LOG_INFO("conditioning every link with %ldms latency, %ldms jitter and %.1f%% loss each way",
+            (long)std::chrono::duration_cast<std::chrono::milliseconds>(conditions.in.latency).count(),
+            (long)std::chrono::duration_cast<std::chrono::milliseconds>(conditions.in.jitter).count(),
+            100 * conditions.in.loss);
+    }
+
+    // Bots are only touched by their own thread while running, the main
+    // thread reads their counters under the lock to report progress.
+    std::vector<std::vector<std::unique_ptr<Bot>>> shards(numThreads);
+    std::vector<std::mutex> locks(numThreads);
+    for (int i = 0; i < numClients + numSpectators; ++i) {
+        try {
+            // Every bot's link gets the same conditions but its own luck
+            conditions.seed = i + 1;
+            shards[i % numThreads].push_back(std::make_unique<Bot>(server, i + 1, i >= numClients, conditions));
+        } catch (const std::exception& e) {
+            LOG_ERROR("unable to create client %d: %s (check ulimit -n)", i, e.what());
+            return -1;
+        }
+    }
+
+    std::atomic<bool> running{true};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&, i] {
+            while (running) {
+                {
+                    std::lock_guard lock{locks[i]};
+                    const auto now = Clock::now();
+                    for (auto& bot : shards[i]) {
+                        bot->update(now);
+                    }
+                }
+                std::this_thread::sleep_for(1ms);
+            }
+        });
+    }
+
+    auto collectAll = [&](bool histograms) {
+        Totals total;
+        for (int i = 0; i < numThreads; ++i) {
+            std::lock_guard lock{locks[i]};
+            collect(shards[i], histograms, total);
+        }
+        return total;
+    };
+
+    const auto start = Clock::now();
+    Totals prev;
+    while (Clock::now() - start < std::chrono::seconds(seconds)) {
+        std::this_thread::sleep_for(reportInterval);
+        const auto t = collectAll(false);
+        const float s = std::chrono::duration<float>(reportInterval).count();
+        printf("connected=%lu snapshots/s=%.0f events/s=%.0f in_kB/s=%.1f out_kB/s=%.1f loss=%.2f%% invalid=%lu\n",
+            t.connected,
+            (t.snapshots - prev.snapshots) / s,
+            (t.events - prev.events) / s,
+            (t.bytesIn - prev.bytesIn) / s / 1024,
+            (t.bytesOut - prev.bytesOut) / s / 1024,
+            100.0 * (t.lost - prev.lost) / std::max<uint64_t>(1, t.packetsIn - prev.packetsIn + t.lost - prev.lost),
+            t.invalid);
+        prev = t;
+    }
+
+    running = false;
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    const auto t = collectAll(true);
+    const float elapsed = std::chrono::duration<float>(Clock::now() - start).count();
+    printf("total connected=%lu snapshots=%lu events=%lu chunks=%lu invalid=%lu packets_in=%lu packets_out=%lu resends=%lu loss=%.2f%% in_kB/s=%.1f out_kB/s=%.1f\n",
+        t.connected, t.snapshots, t.events, t.chunks, t.invalid, t.packetsIn, t.packetsOut, t.resends,
+        100.0 * t.lost / std::max<uint64_t>(1, t.packetsIn + t.lost),
+        t.bytesIn / elapsed / 1024, t.bytesOut / elapsed / 1024);
+    printPercentiles("reliable_rtt", t.confirmRtt);
+    printPercentiles("snapshot_interval", t.interarrival);
+
+    return 0;
+}
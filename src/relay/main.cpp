@@ -0,0 +1,112 @@
+#include "protocol.h"
+#include "relay.h"
+#include "server.h"
+#include "util.h"
+#include <chrono>
+#include <csignal>
+#include <thread>
+
+// Watches a match once, as a spectator of the server or of another relay, and
+// sends what it gets on to spectators of its own. They subscribe the same way
+// the relay does upstream, so relays chain and the server only ever pays for
+// the relays subscribed to it. Every spectator of a relay sees the player the
+// relay follows.
+
+using namespace std::chrono_literals;
+
+constexpr auto spectatorTimeout = 500ms;
+// Subscribing again when nothing has come for this long, in case upstream
+// timed us out or restarted without a checkpoint
+constexpr auto resubscribeInterval = 2s;
+constexpr auto reportInterval = 10s;
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void subscribe(Connection& upstream, proto::ID follow) {
+    const proto::Spectate spectate{follow};
+    auto [buf, n] = proto::makeMessage({0, sizeof spectate}, &spectate);
+    // Kept until confirmed as a copy
+    upstream.writeReliable(proto::spectateChannel, buf, n);
+    delete[] buf;
+}
+
+int main(int argc, char** argv) {
+    // Off unless asked for, anyone on this machine can read it
+    const char* adminArg = TakeOption(argc, argv, "admin-port");
+    if (argc < 4 || argc > 6) {
+        LOG_ERROR("usage: relay upstream-address upstream-port port [delay-ms] [follow-id] [--admin-port port]");
+        return -1;
+    }
+
+    const udp::endpoint upstreamEndpoint{asio::ip::make_address(argv[1]), (unsigned short)std::atoi(argv[2])};
+    const unsigned short port = std::atoi(argv[3]);
+    const int adminPort = adminArg ? std::atoi(adminArg) : 0;
+    if (adminArg && (adminPort <= 0 || adminPort > 65535 || adminPort == port)) {
+        LOG_ERROR("admin port must be in range [1, 65535] and differ from the game port");
+        return -1;
+    }
+    const auto delay = std::chrono::milliseconds(argc > 4 ? std::atoi(argv[4]) : 0);
+    const proto::ID follow = argc > 5 ? std::atoi(argv[5]) : 0;
+    if (delay < 0ms) {
+        LOG_ERROR("delay can't be negative");
+        return -1;
+    }
+
+    Server server{port};
+    if (adminPort > 0) {
+        try {
+            server.enableAdmin(adminPort);
+        } catch (const std::exception& e) {
+            LOG_ERROR("unable to serve transport stats on port %d: %s", adminPort, e.what());
+            return -1;
+        }
+        LOG_INFO("transport stats on 127.0.0.1:%d/udp", adminPort);
+    }
+
+    Relay relay{server, delay};
+    server.listen(proto::spectateChannel, [&relay](const udp::endpoint& ep, char*, size_t) {
+        relay.subscribe(ep);
+    });
+
+    Connection upstream{upstreamEndpoint};
+    Clock::time_point lastReceived = Clock::now();
+    for (const Channel channel : {proto::updateChannel, proto::eventChannel, proto::chunkChannel}) {
+        upstream.listen(channel, [channel, &relay, &lastReceived](char* data, size_t n) {
+            lastReceived = Clock::now();
+            relay.receive(channel, data, n, lastReceived);
+        });
+    }
+    subscribe(upstream, follow);
+    LOG_INFO("relaying %s:%d on port %d with a delay of %ldms", argv[1], upstreamEndpoint.port(), port, (long)delay.count());
+
+    std::signal(SIGTERM, [](int) { stopRequested = 1; });
+    std::signal(SIGINT, [](int) { stopRequested = 1; });
+
+    Clock::time_point prevReport = Clock::now();
+    while (!stopRequested) {
+        upstream.poll();
+        while (server.poll() > 0) {
+        }
+
+        const auto now = Clock::now();
+        relay.release(now);
+        relay.dropTimedOut(spectatorTimeout);
+
+        if (now - lastReceived > resubscribeInterval) {
+            LOG_WARN("nothing from upstream for %lds, subscribing again",
+                (long)std::chrono::duration_cast<std::chrono::seconds>(resubscribeInterval).count());
+            subscribe(upstream, follow);
+            lastReceived = now;
+        }
+
+        if (now - prevReport > reportInterval) {
+            LOG_INFO("%lu watching player %d, %lu messages held back, %lu chunks kept",
+                relay.getSpectators(), relay.getFollowed(), relay.getHeld(), relay.getChunks());
+            prevReport = now;
+        }
+
+        std::this_thread::sleep_for(1ms);
+    }
+
+    return 0;
+}
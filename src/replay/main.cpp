@@ -0,0 +1,305 @@
+#include "replay.h"
+#include "snapshot.h"
+#include "histogram.h"
+#include "util.h"
+#include "mapped_file.h"
+#include <cstring>
+#include <map>
+
+
+// Runs a recorded match again with the server's tick logic as fast as it
+// goes and checks the result against the keyframes on the way. As the
+// inputs are real match traffic it doubles as a throughput benchmark.
+
+// Walks the records after the file header, stops at the first one that is cut short
+class RecordReader {
+public:
+    RecordReader(const char* begin, const char* end)
+    : it{begin},
+      end{end}
+    {}
+
+    bool next(replay::Record& r, const char*& payload) {
+        if (end - it < (ptrdiff_t)sizeof r) {
+            return false;
+        }
+        std::memcpy(&r, it, sizeof r);
+        if ((size_t)(end - it) - sizeof r < r.size) {
+            return false;
+        }
+
+        payload = it + sizeof r;
+        it += sizeof r + r.size;
+        return true;
+    }
+
+    const char* it;
+    const char* end;
+};
+
+struct KeyframeState {
+    proto::Tick tick;
+    Simulation::State state;
+    std::vector<Player> players;
+    std::vector<Bullet> bullets;
+    std::vector<Npc> npcs;
+};
+
+KeyframeState parseKeyframe(const replay::Record& r, const char* payload) {
+    replay::Keyframe k;
+    std::memcpy(&k, payload, sizeof k);
+    const size_t expected = sizeof k + k.numPlayers * sizeof (Player) + k.numBullets * sizeof (Bullet)
+        + k.numNpcs * sizeof (Npc) + k.rngSize;
+    if (r.size != expected) {
+        throw std::runtime_error(std::format("invalid keyframe at tick {}", r.tick));
+    }
+
+    KeyframeState s{r.tick, {k.nextID, {}}, std::vector<Player>(k.numPlayers), std::vector<Bullet>(k.numBullets),
+                    std::vector<Npc>(k.numNpcs)};
+    const char* it = payload + sizeof k;
+    std::memcpy(s.players.data(), it, k.numPlayers * sizeof (Player));
+    it += k.numPlayers * sizeof (Player);
+    std::memcpy(s.bullets.data(), it, k.numBullets * sizeof (Bullet));
+    it += k.numBullets * sizeof (Bullet);
+    std::memcpy(s.npcs.data(), it, k.numNpcs * sizeof (Npc));
+    it += k.numNpcs * sizeof (Npc);
+    s.state.rng.assign(it, k.rngSize);
+    return s;
+}
+
+bool matches(const Simulation& sim, const KeyframeState& k) {
+    if (sim.players.size() != k.players.size() || sim.bullets.size() != k.bullets.size() || sim.npcs.size() != k.npcs.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < k.players.size(); ++i) {
+        const auto& a = sim.players[i];
+        const auto& b = k.players[i];
+        if (a.id != b.id || a.pos.x != b.pos.x || a.pos.y != b.pos.y || a.velo.x != b.velo.x || a.velo.y != b.velo.y
+            || a.health != b.health || a.stats.kills != b.stats.kills || a.stats.deaths != b.stats.deaths) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < k.bullets.size(); ++i) {
+        const auto& a = sim.bullets[i];
+        const auto& b = k.bullets[i];
+        if (a.id != b.id || a.pos.x != b.pos.x || a.pos.y != b.pos.y) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < k.npcs.size(); ++i) {
+        const auto& a = sim.npcs[i];
+        const auto& b = k.npcs[i];
+        if (a.id != b.id || a.pos.x != b.pos.x || a.pos.y != b.pos.y || a.health != b.health) {
+            return false;
+        }
+    }
+
+    return sim.saveState().nextID == k.state.nextID;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2 || argc > 3) {
+        printf("usage: replay file [start-tick]\n");
+        return -1;
+    }
+
+    const proto::Tick startTick = argc > 2 ? std::atoi(argv[2]) : 0;
+
+    try {
+        const MappedFile file{argv[1]};
+
+        replay::FileHeader h;
+        if (file.size < sizeof h) {
+            throw std::runtime_error("file is too short");
+        }
+        std::memcpy(&h, file.data, sizeof h);
+        if (h.magic != replay::magic || h.version != replay::version) {
+            throw std::runtime_error("not a replay file or of an unsupported version");
+        }
+
+        Simulation sim{h.tickrate, h.seed, World{h.world}, h.hordeSize};
+        const proto::Tick sendInterval = std::max(1, h.tickrate / h.sendrate);
+        std::map<proto::ID, Client> clients;
+
+        SnapshotEncoder encoder;
+        char buf[proto::maxSnapshotSize];
+
+        Histogram tickTimes; // Microseconds of step() and snapshots per tick
+        uint64_t ticks = 0;
+        uint64_t inputs = 0;
+        uint64_t checked = 0;
+        uint64_t diverged = 0;
+        size_t maxPlayers = 0;
+        size_t maxNpcs = 0;
+        bool stepped = false;
+
+        auto restore = [&](const KeyframeState& k) {
+            sim.tick = k.tick;
+            sim.players = k.players;
+            sim.bullets = k.bullets;
+            sim.npcs = k.npcs;
+            sim.restoreState(k.state);
+            clients.clear();
+            for (const auto& p : sim.players) {
+                clients[p.id] = Client{p.id, sendInterval};
+            }
+        };
+
+        auto step = [&] {
+            const auto t0 = Clock::now();
+            sim.step();
+            sim.events.clear();
+
+            bool encoded = false;
+            for (auto& [id, client] : clients) {
+                if (sim.tick < client.nextSend) {
+                    continue;
+                }
+                if (!encoded) {
+                    encoder.encodeEntities(sim);
+                    encoded = true;
+                }
+                encoder.fill(sim, client, buf, sizeof buf);
+                const auto slowdown = farFromAction(sim, id) ? farFromActionSlowdown : 1;
+                client.nextSend = sim.tick + client.sendInterval * slowdown;
+            }
+
+            tickTimes.record(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+            maxPlayers = std::max(maxPlayers, sim.players.size());
+            maxNpcs = std::max(maxNpcs, sim.npcs.size());
+            stepped = true;
+        };
+
+        auto advanceTo = [&](proto::Tick tick) {
+            while (sim.tick < tick) {
+                if (!stepped) {
+                    step();
+                }
+                ++sim.tick;
+                ++ticks;
+                stepped = false;
+            }
+        };
+
+        // Starting later means starting from the last keyframe before it
+        RecordReader reader{file.data + sizeof h, file.data + file.size};
+        if (startTick > 0) {
+            const char* from = nullptr;
+            RecordReader scan = reader;
+            replay::Record r;
+            const char* payload;
+            for (const char* at = scan.it; scan.next(r, payload) && r.tick <= startTick; at = scan.it) {
+                if (r.type == replay::Type::Keyframe) {
+                    from = at;
+                }
+            }
+            if (!from) {
+                throw std::runtime_error(std::format("no keyframe before tick {}", startTick));
+            }
+            reader.it = from;
+        }
+
+        const auto start = Clock::now();
+        bool first = true;
+        replay::Record r;
+        const char* payload;
+        while (reader.next(r, payload)) {
+            if (first && r.type == replay::Type::Keyframe) {
+                restore(parseKeyframe(r, payload));
+                first = false;
+                continue;
+            }
+            first = false;
+
+            switch (r.type) {
+                case replay::Type::Keyframe:
+                {
+                    advanceTo(r.tick);
+                    const auto k = parseKeyframe(r, payload);
+                    checked++;
+                    if (!matches(sim, k)) {
+                        printf("diverged from the recording at tick %u, continuing from its keyframe\n", r.tick);
+                        diverged++;
+                        restore(k);
+                    }
+                    break;
+                }
+                case replay::Type::Leave:
+                    advanceTo(r.tick);
+                    std::erase_if(sim.players, [id = r.id](const Player& p) { return p.id == id; });
+                    clients.erase(r.id);
+                    break;
+                default:
+                    advanceTo(r.tick);
+                    if (!stepped) {
+                        step();
+                    }
+                    inputs++;
+
+                    try {
+                        switch (r.type) {
+                            case replay::Type::Join:
+                                if (const auto id = sim.addPlayer().id; id != r.id) {
+                                    printf("player joined as %u but was recorded as %u at tick %u\n", id, r.id, r.tick);
+                                }
+                                clients[r.id] = Client{r.id, sendInterval};
+                                break;
+                            case replay::Type::Move:
+                            {
+                                proto::Move move;
+                                std::memcpy(&move, payload, sizeof move);
+                                sim.applyMove(r.id, move);
+                                break;
+                            }
+                            case replay::Type::MouseMove:
+                            {
+                                proto::MouseMove move;
+                                std::memcpy(&move, payload, sizeof move);
+                                sim.applyMouseMove(r.id, move);
+                                break;
+                            }
+                            case replay::Type::Shoot:
+                            {
+                                proto::Shoot shoot;
+                                std::memcpy(&shoot, payload, sizeof shoot);
+                                sim.applyShoot(r.id, shoot);
+                                break;
+                            }
+                            case replay::Type::Hitscan:
+                            {
+                                proto::Hitscan shot;
+                                std::memcpy(&shot, payload, sizeof shot);
+                                sim.applyHitscan(r.id, shot);
+                                break;
+                            }
+                            default:
+                                printf("unknown record type %d at tick %u\n", int(r.type), r.tick);
+                                break;
+                        }
+                    } catch (const std::exception& e) {
+                        printf("tick %u: %s\n", r.tick, e.what());
+                    }
+                    break;
+            }
+        }
+        advanceTo(sim.tick + 1);
+
+        const float elapsed = std::chrono::duration<float>(Clock::now() - start).count();
+        const float played = float(ticks) / h.tickrate;
+        printf("replayed %lu ticks (%.1fs of play) in %.3fs, %.0f ticks/s, %.0fx realtime\n",
+            ticks, played, elapsed, ticks / elapsed, played / elapsed);
+        printf("players_max=%lu npcs_max=%lu inputs=%lu keyframes_checked=%lu diverged=%lu\n",
+            maxPlayers, maxNpcs, inputs, checked, diverged);
+        printf("tick_us count=%lu mean=%.1f p50=%lu p90=%lu p99=%lu p999=%lu max=%lu\n",
+            tickTimes.count(), tickTimes.mean(), tickTimes.percentile(50), tickTimes.percentile(90),
+            tickTimes.percentile(99), tickTimes.percentile(99.9), tickTimes.max());
+
+        return diverged == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "ERROR\t %s\n", e.what());
+        return -1;
+    }
+}
@@ -0,0 +1,106 @@
+#include "checkpoint.h"
+#include <cstdio>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include "archive.h"
+#include "mapped_file.h"
+
+
+namespace checkpoint {
+
+void save(const char* path, const Simulation& sim, const std::map<udp::endpoint, Client>& clients,
+          const Server& server, int sendrate) {
+    Writer w;
+    w.write(FileHeader{.tickrate = sim.tickrate, .sendrate = sendrate});
+
+    const auto state = sim.saveState();
+    w.write(sim.world.getParams());
+    w.write(sim.hordeSize);
+    w.write(sim.tick);
+    w.write(sim.players);
+    w.write(sim.bullets);
+    w.write(sim.npcs);
+    w.write(state.nextID);
+    w.write(state.rng);
+
+    w.write<uint64_t>(clients.size());
+    for (const auto& [ep, client] : clients) {
+        writeEndpoint(w, ep);
+        w.write(client.id);
+        w.write(client.sendInterval);
+        w.write(client.nextSend);
+        w.write(client.prevSend);
+        w.write<uint64_t>(client.priorities.size());
+        for (const auto& [key, priority] : client.priorities) {
+            w.write(key);
+            w.write(priority);
+        }
+        w.write(client.events);
+        w.write(client.spectator);
+        w.write(client.follow);
+    }
+
+    server.save(w);
+
+    const std::string tmp = std::format("{}.tmp", path);
+    std::FILE* file = std::fopen(tmp.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error(std::format("unable to open {}", tmp));
+    }
+    const bool written = std::fwrite(w.data().data(), 1, w.data().size(), file) == w.data().size();
+    if (std::fclose(file) != 0 || !written || std::rename(tmp.c_str(), path) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error(std::format("unable to write {}", path));
+    }
+}
+
+void restore(const char* path, std::unique_ptr<Simulation>& sim, std::map<udp::endpoint, Client>& clients,
+             Server& server) {
+    const MappedFile file{path};
+    Reader r{file.data, file.size};
+
+    const auto h = r.read<FileHeader>();
+    if (h.magic != magic || h.version != version) {
+        throw std::runtime_error(std::format("{} is not a checkpoint or of an unsupported version", path));
+    }
+    if (h.tickrate != sim->tickrate) {
+        throw std::runtime_error(std::format("{} was made with tickrate {}", path, h.tickrate));
+    }
+
+    const auto world = r.read<World::Params>();
+    const auto hordeSize = r.read<uint32_t>();
+    auto restored = std::make_unique<Simulation>(h.tickrate, 0, World{world}, hordeSize);
+    restored->tick = r.read<proto::Tick>();
+    r.read(restored->players);
+    r.read(restored->bullets);
+    r.read(restored->npcs);
+    Simulation::State state;
+    state.nextID = r.read<proto::ID>();
+    r.read(state.rng);
+    restored->restoreState(state);
+
+    std::map<udp::endpoint, Client> restoredClients;
+    for (auto n = r.read<uint64_t>(); n > 0; --n) {
+        const auto ep = readEndpoint(r);
+        Client client{r.read<proto::ID>()};
+        client.sendInterval = r.read<proto::Tick>();
+        client.nextSend = r.read<proto::Tick>();
+        client.prevSend = r.read<proto::Tick>();
+        for (auto priorities = r.read<uint64_t>(); priorities > 0; --priorities) {
+            const auto key = r.read<uint64_t>();
+            client.priorities[key] = r.read<Priority>();
+        }
+        r.read(client.events);
+        client.spectator = r.read<bool>();
+        client.follow = r.read<proto::ID>();
+        restoredClients[ep] = std::move(client);
+    }
+
+    server.restore(r);
+
+    sim = std::move(restored);
+    clients = std::move(restoredClients);
+}
+
+}
@@ -0,0 +1,39 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <map>
+#include <memory>
+#include "server.h"
+#include "simulation.h"
+#include "snapshot.h"
+
+
+// Everything a server needs to carry on with a running match after a
+// restart: the simulation, the replication state of every client and the
+// transport session of every peer.
+namespace checkpoint {
+
+constexpr uint32_t magic = 0x50434c42; // "BLCP"
+constexpr uint32_t version = 4;
+
+struct FileHeader {
+	uint32_t magic{checkpoint::magic};
+	uint32_t version{checkpoint::version};
+	int32_t tickrate;
+	int32_t sendrate;
+};
+
+// Written to a temporary file that is then renamed over path, so a crash
+// halfway does not leave a broken checkpoint behind
+void save(const char* path, const Simulation& sim, const std::map<udp::endpoint, Client>& clients,
+          const Server& server, int sendrate);
+
+// Replaces sim, clients and the session state of server with the ones in
+// the checkpoint. Throws if it can't be read or was made with another
+// tickrate, leaving everything as it was.
+void restore(const char* path, std::unique_ptr<Simulation>& sim, std::map<udp::endpoint, Client>& clients,
+             Server& server);
+
+}
+
+#endif
@@ -3,70 +3,79 @@
 #include <chrono>
 #include "util.h"
 #include <set>
-#include "world.h"
-#include "collision.h"
+#include <cstring>
+#include "simulation.h"
+#include "snapshot.h"
+#include "profiler.h"
+#include "replay.h"
+#include "checkpoint.h"
+#include <csignal>
+#include <filesystem>
 
 
 using namespace std::chrono_literals;
 
-static proto::ID nextID() {
-    static proto::ID id{1};
-    return id++;
-}
-
-constexpr auto bulletLiveDuration = 1000ms;
+constexpr auto playerGraceDuration = 1000ms;
+constexpr auto keyframeInterval = 10s;
 
-std::map<udp::endpoint, proto::ID> playerIDs;
-std::vector<proto::Bullet> bullets;
-std::vector<proto::Player> players;
-proto::GameState state;
+std::map<udp::endpoint, Client> clients;
 int tickrate;
-World world;
-
-proto::Player& findPlayer(proto::ID id) {
-        auto it = std::find_if(players.begin(), players.end(), [id](const proto::Player& p) {
-                return p.id == id;
-            }
-        );
-
-        if (it == players.end()) {
-            throw std::runtime_error(std::format("ERROR\t unable to find player {}", id));
-        }
-
-        return *it;
+int sendrate;
+std::unique_ptr<Simulation> sim;
+SnapshotEncoder encoder;
+std::unique_ptr<replay::Recorder> recorder;
+volatile std::sig_atomic_t stopRequested = 0;
+
+void broadcast(const proto::Event& event) {
+    for (auto& [_, client] : clients) {
+        client.events.push_back(event);
+    }
 }
 
-rl::Vector2 spawnPos() {
-    return {RandFloat(100)-50, RandFloat(100)-50};
+proto::Event joinEvent(const Player& p) {
+    return {proto::Event::Type::Join, p.id, 0, p.stats, p.health};
 }
 
 template <typename T>
 std::pair<proto::Header, T> parseMessage(const udp::endpoint& ep, const char* data, size_t n) {
         if (n < sizeof (proto::Header)) {
-            throw std::runtime_error("ERROR\t payloadsize smaller than header size");
+            throw std::runtime_error("payloadsize smaller than header size");
         }
 
         proto::Header h;
         std::memcpy(&h, data, sizeof h);
 
-        if (!playerIDs.contains(ep)) {
-            const proto::ID id = nextID();
-            playerIDs[ep] = id;
-            players.push_back(proto::Player{id, spawnPos()});
+        if (!clients.contains(ep)) {
+            std::vector<proto::Event> joins;
+            for (const auto& p : sim->players) {
+                joins.push_back(joinEvent(p));
+            }
+            const Player& player = sim->addPlayer();
+            const proto::ID id = player.id;
+            if (recorder) {
+                recorder->record(replay::Type::Join, sim->tick, id);
+            }
+            clients[ep] = Client{id, proto::Tick(std::max(1, tickrate / sendrate))};
+            clients[ep].events = std::move(joins);
+            broadcast(joinEvent(player));
             h.playerId = id;
-            printf("INFO\t new player connected %s:%d id %d\n", ep.address().to_string().c_str(), ep.port(), id);
+            LOG_INFO("new player connected %s:%d id %d", ep.address().to_string().c_str(), ep.port(), id);
+        }
+
+        if (clients[ep].spectator) {
+            throw std::runtime_error("spectators can't play");
         }
 
-        if (const auto id = playerIDs[ep]; id != h.playerId) {
-            throw std::runtime_error(std::format("ERROR\t invalid id {} should be {}", h.playerId, id));
+        if (const auto id = clients[ep].id; id != h.playerId) {
+            throw std::runtime_error(std::format("invalid id {} should be {}", h.playerId, id));
         }
 
         if (h.payloadSize != n - sizeof h) {
-            throw std::runtime_error("ERROR\t invalid message size");
+            throw std::runtime_error("invalid message size");
         }
 
         if (h.payloadSize != sizeof (T)) {
-            throw std::runtime_error("ERROR\t invalid payload size");
+            throw std::runtime_error("invalid payload size");
         }
 
         T t;
@@ -74,57 +83,272 @@ std::pair<proto::Header, T> parseMessage(const udp::endpoint& ep, const char* da
         return {h, t};
 }
 
+// Points a spectator at the player it asked for, or whoever is playing when
+// that one isn't. Another player means another view, sent from scratch.
+void follow(Client& client) {
+    const auto& players = sim->players;
+    proto::ID id = client.follow;
+    if (std::none_of(players.begin(), players.end(), [id](const Player& p) { return p.id == id; })) {
+        id = players.empty() ? 0 : players.front().id;
+    }
+    if (id != client.id) {
+        client.id = id;
+        client.priorities.clear();
+        client.chunks.clear();
+        client.chunkCenter.reset();
+    }
+}
+
+void sendEvents(Server& server) {
+    constexpr size_t maxEvents = (proto::maxSnapshotSize - sizeof (proto::Header)) / sizeof (proto::Event);
+    static char buf[sizeof (proto::Header) + maxEvents * sizeof (proto::Event)];
+
+    for (auto& [ep, client] : clients) {
+        for (size_t i = 0; i < client.events.size(); i += maxEvents) {
+            const size_t count = std::min(maxEvents, client.events.size() - i);
+            const proto::Header h{client.id, count * sizeof (proto::Event)};
+            std::memcpy(buf, &h, sizeof h);
+            std::memcpy(buf + sizeof h, client.events.data() + i, h.payloadSize);
+            server.writeReliable(proto::eventChannel, ep, buf, sizeof h + h.payloadSize);
+        }
+        client.events.clear();
+    }
+}
+
 void sendUpdate(Server& server) {
+    static char buf[sizeof (proto::Header) + proto::maxSnapshotSize];
+    bool encoded = false;
+
+    for (auto& [ep, client] : clients) {
+        if (sim->tick < client.nextSend) {
+            continue;
+        }
 
-    for (const auto& [ep, id] : playerIDs) {
-        // TODO: Serialization
-        const proto::Header h{id, sizeof state};
-        constexpr size_t n = sizeof h + sizeof state;
-        char buf[n];
+        if (!encoded) {
+            encoder.encodeEntities(*sim);
+            encoded = true;
+        }
+
+        // Each snapshot gets the share of the link budget of its send interval
+        const float linkBudget = server.getBudget(ep);
+        const size_t budget = std::clamp<size_t>(linkBudget * client.sendInterval / tickrate,
+                                                 minSnapshotSize, proto::maxSnapshotSize);
+        const size_t n = encoder.fill(*sim, client, buf + sizeof (proto::Header), budget);
+
+        const proto::Header h{client.id, n};
         std::memcpy(buf, &h, sizeof h);
-        std::memcpy(buf + sizeof h, &state, sizeof state);
+        server.write(proto::updateChannel, ep, buf, sizeof h + n);
+
+        // Never send faster than the estimated budget of the link allows
+        const auto slowdown = farFromAction(*sim, client.id) ? farFromActionSlowdown : 1;
+        const auto budgetInterval = proto::Tick(std::ceil(tickrate * (sizeof h + n) / linkBudget));
+        client.nextSend = sim->tick + std::max(client.sendInterval * slowdown, budgetInterval);
+    }
+}
+
+// Sends every client the chunks around its player it doesn't have yet, once
+// the player has moved to another chunk
+void sendChunks(Server& server) {
+    constexpr size_t maxBlocks = (proto::maxSnapshotSize - sizeof (proto::Header) - sizeof (proto::ChunkPart)) / sizeof (Block);
+    static char buf[sizeof (proto::Header) + sizeof (proto::ChunkPart) + maxBlocks * sizeof (Block)];
 
-        server.write(proto::updateChannel, ep, buf, n);
+    static std::unordered_map<proto::ID, Vec2> positions;
+    positions.clear();
+    for (const auto& p : sim->players) {
+        positions[p.id] = p.pos;
+    }
+
+    for (auto& [ep, client] : clients) {
+        const auto it = positions.find(client.id);
+        if (it == positions.end()) {
+            continue;
+        }
+
+        const ChunkCoord center = World::chunkOf(it->second);
+        if (client.chunkCenter == center) {
+            continue;
+        }
+        client.chunkCenter = center;
+
+        std::erase_if(client.chunks, [center](uint64_t key) {
+            const ChunkCoord c = World::coordOf(key);
+            return std::abs(c.x - center.x) > proto::chunkKeepRadius || std::abs(c.y - center.y) > proto::chunkKeepRadius;
+        });
+
+        for (int32_t dx = -proto::chunkViewRadius; dx <= proto::chunkViewRadius; ++dx) {
+            for (int32_t dy = -proto::chunkViewRadius; dy <= proto::chunkViewRadius; ++dy) {
+                const ChunkCoord c{center.x + dx, center.y + dy};
+                if (!client.chunks.insert(World::key(c)).second) {
+                    continue;
+                }
+
+                const Chunk& chunk = sim->world.load(c);
+                size_t offset = 0;
+                do {
+                    const proto::ChunkPart part{c, uint32_t(offset), uint32_t(std::min(maxBlocks, chunk.blocks.size() - offset))};
+                    const proto::Header h{client.id, sizeof part + part.numBlocks * sizeof (Block)};
+                    std::memcpy(buf, &h, sizeof h);
+                    std::memcpy(buf + sizeof h, &part, sizeof part);
+                    std::memcpy(buf + sizeof h + sizeof part, chunk.blocks.data() + offset, part.numBlocks * sizeof (Block));
+                    server.writeReliable(proto::chunkChannel, ep, buf, sizeof h + h.payloadSize);
+                    offset += part.numBlocks;
+                } while (offset < chunk.blocks.size());
+            }
+        }
     }
 }
 
 int main(int argc, char** argv) 
 {
+    const char* sendrateArg = TakeOption(argc, argv, "sendrate");
+    const char* profilePath = TakeOption(argc, argv, "profile");
+    const char* replayPath = TakeOption(argc, argv, "replay");
+    // A checkpoint left by the previous process continues its match
+    const char* checkpointPath = TakeOption(argc, argv, "checkpoint");
+    const char* mapPath = TakeOption(argc, argv, "map");
+    const char* hordeArg = TakeOption(argc, argv, "horde-size");
+    // Off unless asked for, anyone on this machine can read it
+    const char* adminArg = TakeOption(argc, argv, "admin-port");
+    // Applied to everything the server sends and receives, for trying out
+    // a bad network without one. The same seed loses the same datagrams.
+    const char* seedArg = TakeOption(argc, argv, "seed");
+    Conditions conditions;
+    try {
+        conditions = takeConditions(argc, argv, seedArg ? std::stoul(seedArg) : 1);
+    } catch (const std::exception& e) {
+        LOG_ERROR("invalid link conditions: %s", e.what());
+        return -1;
+    }
     if (argc != 3) {
-        printf("usage: app port tickrate\n");
+        LOG_ERROR("usage: app port tickrate [--sendrate rate] [--profile file] [--replay file] [--checkpoint file] [--map file] "
+                  "[--horde-size n] [--admin-port port] [--latency ms] [--jitter ms] [--loss fraction] [--seed n]");
         return -1;
     }
 
     unsigned short port = std::atoi(argv[1]);
+    const int adminPort = adminArg ? std::atoi(adminArg) : 0;
+    if (adminArg && (adminPort <= 0 || adminPort > 65535 || adminPort == port)) {
+        LOG_ERROR("admin port must be in range [1, 65535] and differ from the game port");
+        return -1;
+    }
     tickrate = std::atoi(argv[2]);
+    sendrate = sendrateArg ? std::atoi(sendrateArg) : tickrate;
 
-    printf("server listening on port %d with tickrate %d\n", port, tickrate);
+    if (tickrate <= 0 || sendrate <= 0) {
+        LOG_ERROR("tickrate and sendrate must be positive");
+        return -1;
+    }
 
-    Server server{port};
+    const uint32_t seed = std::random_device{}();
+
+    // Every match gets a world of its own unless it is played on a map
+    World::Params world{.seed = seed};
+    if (mapPath) {
+        if (std::strlen(mapPath) >= sizeof world.map) {
+            LOG_ERROR("map path %s is too long", mapPath);
+            return -1;
+        }
+        std::strcpy(world.map, mapPath);
+    }
+
+    const int hordeSize = hordeArg ? std::atoi(hordeArg) : 0;
+    if (hordeSize < 0) {
+        LOG_ERROR("horde size can't be negative");
+        return -1;
+    }
+
+    try {
+        sim = std::make_unique<Simulation>(tickrate, seed, World{world}, hordeSize);
+    } catch (const std::exception& e) {
+        LOG_ERROR("%s", e.what());
+        return -1;
+    }
+    LOG_INFO("world %s", mapPath ? mapPath : std::format("generated from seed {}", seed).c_str());
+    if (hordeSize > 0) {
+        LOG_INFO("hordes of up to %d npcs", hordeSize);
+    }
+
+    LOG_INFO("server listening on port %d with tickrate %d and sendrate %d", port, tickrate, sendrate);
+
+    Server server{port, conditions};
+    if (conditions.in.enabled()) {
+        LOG_INFO("conditioning the link with %ldms latency, %ldms jitter and %.1f%% loss each way, seed %u",
+            (long)std::chrono::duration_cast<std::chrono::milliseconds>(conditions.in.latency).count(),
+            (long)std::chrono::duration_cast<std::chrono::milliseconds>(conditions.in.jitter).count(),
+            100 * conditions.in.loss, conditions.seed);
+    }
+    if (adminPort > 0) {
+        try {
+            server.enableAdmin(adminPort);
+        } catch (const std::exception& e) {
+            LOG_ERROR("unable to serve transport stats on port %d: %s", adminPort, e.what());
+            return -1;
+        }
+        LOG_INFO("transport stats on 127.0.0.1:%d/udp", adminPort);
+    }
+
+    if (checkpointPath && std::filesystem::exists(checkpointPath)) {
+        try {
+            const auto t0 = Clock::now();
+            checkpoint::restore(checkpointPath, sim, clients, server);
+            std::remove(checkpointPath);
+            LOG_INFO("restored tick %u with %lu players from %s in %.2fms", sim->tick, sim->players.size(), checkpointPath,
+                std::chrono::duration<float, std::milli>(Clock::now() - t0).count());
+        } catch (const std::exception& e) {
+            LOG_ERROR("%s, starting a new match", e.what());
+        }
+    }
+
+    // The tick phases run on every core, this thread included
+    JobSystem jobs{std::max(1u, std::thread::hardware_concurrency()) - 1};
+    sim->jobs = &jobs;
+    LOG_INFO("running the tick on %u threads", jobs.workers() + 1);
+
+    std::unique_ptr<Profiler> profiler;
+    if (profilePath) {
+        profiler = std::make_unique<Profiler>(profilePath);
+        sim->profiler = profiler.get();
+        LOG_INFO("writing tick profile to %s", profilePath);
+    }
+
+    const proto::Tick keyframeTicks = sim->toTicks(keyframeInterval);
+    if (replayPath) {
+        recorder = std::make_unique<replay::Recorder>(replayPath,
+            replay::FileHeader{.tickrate = tickrate, .sendrate = sendrate, .seed = seed, .world = sim->world.getParams(),
+                               .hordeSize = sim->hordeSize});
+        LOG_INFO("recording replay to %s", replayPath);
+
+        // A restored match has to start from its state
+        if (sim->tick % keyframeTicks != 0) {
+            recorder->keyframe(*sim);
+        }
+    }
+
+    std::signal(SIGTERM, [](int) { stopRequested = 1; });
+
+    const proto::Tick playerGraceTicks = sim->toTicks(playerGraceDuration);
 
     server.listen(proto::moveChannel, [](const udp::endpoint& ep, char* data, size_t n) {
         try {
             const auto [h, move] = parseMessage<proto::Move>(ep, data, n);
-            proto::Player& p = findPlayer(h.playerId);
-            float velo = length(move.velo);
-            printf("move.velo %.2f, %.2f\n", move.velo.x, move.velo.y);
-            if (velo > 0) {
-                p.velo = proto::playerSpeed * move.velo / length(move.velo);
-            } else {
-                p.velo = move.velo;
+            sim->applyMove(h.playerId, move);
+            if (recorder) {
+                recorder->record(replay::Type::Move, sim->tick, h.playerId, move);
             }
         } catch(const std::exception& e) {
-            fprintf(stderr, "%s\n", e.what());
+            LOG_ERROR("%s", e.what());
         }
     });
 
     server.listen(proto::mouseMoveChannel, [](const udp::endpoint& ep, char* data, size_t n) {
         try {
             const auto [h, move] = parseMessage<proto::MouseMove>(ep, data, n);
-            proto::Player& p = findPlayer(h.playerId);
-            p.target = move.pos;
+            sim->applyMouseMove(h.playerId, move);
+            if (recorder) {
+                recorder->record(replay::Type::MouseMove, sim->tick, h.playerId, move);
+            }
         } catch(const std::exception& e) {
-            fprintf(stderr, "%s\n", e.what());
+            LOG_ERROR("%s", e.what());
         }
     });
 
@@ -132,129 +356,158 @@ int main(int argc, char** argv)
     server.listen(proto::shootChannel, [](const udp::endpoint& ep, char* data, size_t n) {
         try {
             const auto [h, shoot] = parseMessage<proto::Shoot>(ep, data, n);
-            proto::Player& p = findPlayer(h.playerId);
-            bullets.push_back(shoot.bullet);
-            bullets.back().createdAt = Clock::now();
+            sim->applyShoot(h.playerId, shoot);
+            if (recorder) {
+                recorder->record(replay::Type::Shoot, sim->tick, h.playerId, shoot);
+            }
         } catch(const std::exception& e) {
-            fprintf(stderr, "%s\n", e.what());
+            LOG_ERROR("%s", e.what());
         }
     });
 
-    auto prevUpdate = Clock::now();
-    const std::chrono::duration<float> dt(1.0f/tickrate);
-    for(;;) {
-        const auto t0 = Clock::now();
-
-        {
-            std::set<proto::ID> killed;
-            for (const auto& b : bullets) {
-                for (auto& p : players) {
-                    const float dist = distance(p.pos, b.pos);
-                    if (dist < proto::playerRadius && !killed.contains(p.id) && p.id != b.shooterID) {
-                        const int damage = 20;
-                        if (p.health <= damage) {
-                            p.stats.deaths++;
-                            p.pos = spawnPos();
-                            p.velo = rl::Vector2{0, 0};
-                            p.health = proto::maxHealth;
-                            killed.insert(p.id);
-                            findPlayer(b.shooterID).stats.kills++;
-                        } else {
-                            p.health -= damage;
-                        }
-                    }
-                }
+    server.listen(proto::hitscanChannel, [](const udp::endpoint& ep, char* data, size_t n) {
+        try {
+            const auto [h, shot] = parseMessage<proto::Hitscan>(ep, data, n);
+            sim->applyHitscan(h.playerId, shot);
+            if (recorder) {
+                recorder->record(replay::Type::Hitscan, sim->tick, h.playerId, shot);
             }
+        } catch(const std::exception& e) {
+            LOG_ERROR("%s", e.what());
         }
+    });
 
-        bullets.erase(std::remove_if(bullets.begin(), bullets.end(), [](const auto& bullet) {
-            const auto expired = Clock::now() - bullet.createdAt > bulletLiveDuration;
-            if (expired) {
-                return true;
-            } else {
-                for (const auto& block : world.getBlocks()) {
-                    if (CheckCollisionPointAndRec(
-                        bullet.pos.x, bullet.pos.y, 
-                        block.pos.x, block.pos.y, block.size.x, block.size.y
-                    )) {
-                        return true;
-                    }
-                }
-                return false;
+    // Relays subscribe here to fan the stream out, so a match costs the same
+    // however many watch it
+    server.listen(proto::spectateChannel, [](const udp::endpoint& ep, char* data, size_t n) {
+        proto::Header h;
+        proto::Spectate spectate;
+        if (n != sizeof h + sizeof spectate) {
+            LOG_ERROR("invalid spectate message from %s:%d", ep.address().to_string().c_str(), ep.port());
+            return;
+        }
+        std::memcpy(&spectate, data + sizeof h, sizeof spectate);
+
+        auto it = clients.find(ep);
+        if (it == clients.end()) {
+            Client client{0, proto::Tick(std::max(1, tickrate / sendrate))};
+            client.spectator = true;
+            for (const auto& p : sim->players) {
+                client.events.push_back(joinEvent(p));
             }
-        }), bullets.end());
+            it = clients.emplace(ep, std::move(client)).first;
+            LOG_INFO("spectator connected %s:%d", ep.address().to_string().c_str(), ep.port());
+        } else if (!it->second.spectator) {
+            LOG_ERROR("player %d can't spectate", it->second.id);
+            return;
+        }
+        it->second.follow = spectate.follow;
+        follow(it->second);
+    });
+
+    const std::chrono::duration<float> dt(1.0f/tickrate);
+    while (!stopRequested) {
+        const auto t0 = Clock::now();
+
+        if (recorder && sim->tick % keyframeTicks == 0) {
+            recorder->keyframe(*sim);
+        }
 
         {
+            Profiler::Scope scope{profiler.get(), Profiler::Timeouts};
             std::set<proto::ID> timedOutPlayers;
-            for (auto it = playerIDs.begin(); it != playerIDs.end();) {
+            for (auto it = clients.begin(); it != clients.end();) {
                 const auto ping = server.getPing(it->first);
                 if (ping > 500ms) {
-                    printf("player %d timed out\n", it->second);
-                    timedOutPlayers.insert(it->second);
-                    it = playerIDs.erase(it);
+                    if (it->second.spectator) {
+                        LOG_INFO("spectator %s:%d timed out", it->first.address().to_string().c_str(), it->first.port());
+                    } else {
+                        LOG_INFO("player %d timed out", it->second.id);
+                        timedOutPlayers.insert(it->second.id);
+                    }
+                    server.disconnect(it->first);
+                    it = clients.erase(it);
                 } else {
                     ++it;
                 }
             }
 
-            players.erase(std::remove_if(players.begin(), players.end(), [&timedOutPlayers](const auto& player) {
-                const auto age = Clock::now() - player.createdAt;
-                return age > 1000ms && timedOutPlayers.contains(player.id);
+            for (const auto id : timedOutPlayers) {
+                broadcast({proto::Event::Type::Leave, id});
+            }
+
+            auto& players = sim->players;
+            players.erase(std::remove_if(players.begin(), players.end(), [&timedOutPlayers, playerGraceTicks](const auto& player) {
+                const auto age = sim->tick - player.joinedAt;
+                const bool remove = age > playerGraceTicks && timedOutPlayers.contains(player.id);
+                if (remove && recorder) {
+                    recorder->record(replay::Type::Leave, sim->tick, player.id);
+                }
+                return remove;
             }), players.end());
         }
 
+        sim->step();
+
         {
-            // Handle collision between players and world
-            for (auto& p : players) {
-                for (const auto& block : world.getBlocks()) {
-                    if (CheckCollisionPointAndRec(
-                        p.pos.x, p.pos.y, 
-                        block.pos.x, block.pos.y, block.size.x, block.size.y
-                    )) {
-                        const auto center = block.pos + block.size / 2.f;
-                        const auto diff = p.pos - center;
-                        if (std::abs(diff.x) > std::abs(diff.y)) {
-                            p.pos.x = center.x + (block.size.x / 2 + proto::playerRadius) * diff.x / std::abs(diff.x);
-                        } else {
-                            p.pos.y = center.y + (block.size.y / 2 + proto::playerRadius) * diff.y / std::abs(diff.y);
-                        }
-                        printf("world collision!\n");
-                    }
-                }
+            Profiler::Scope scope{profiler.get(), Profiler::Events};
+            for (const auto& event : sim->events) {
+                broadcast(event);
             }
+            sim->events.clear();
 
-            // Handle collision between players
-            for (auto ita = players.begin(); ita != players.end(); ++ita) {
-                for (auto itb = ita + 1; itb != players.end(); ++itb) {
-                    const auto diff = ita->pos - itb->pos;
-                    const float dist = length(diff);
-                    if (dist < 2 * proto::playerRadius) {
-                        const auto move = (2 * proto::playerRadius - dist) * diff / dist;
-                        ita->pos = ita->pos + move;
-                        itb->pos = itb->pos - move;
-                        printf("player collision!\n");
-                    }
+            for (auto& [_, client] : clients) {
+                if (client.spectator) {
+                    follow(client);
                 }
             }
+
+            sendEvents(server);
+            sendChunks(server);
+        }
+
+        {
+            Profiler::Scope scope{profiler.get(), Profiler::Snapshots};
+            sendUpdate(server);
+        }
+
+        Clock::duration pollTime{0};
+        if (profiler) {
+            const auto work = Clock::now() - t0;
+            profiler->record(Profiler::Tick, work);
+            if (work > dt) {
+                profiler->overrun();
+            }
         }
 
-        state.numPlayers = 0;
-        for (auto& p : players) {
-            p.pos = p.pos + dt.count() * p.velo;
-            state.players[state.numPlayers++] = p;
+        do {
+            const auto p0 = Clock::now();
+            if (server.poll() > 0) {
+                pollTime += Clock::now() - p0;
+            }
+        } while (Clock::now() - t0 < dt);
+
+        if (profiler) {
+            profiler->record(Profiler::Poll, pollTime);
+            profiler->maybeDump(Clock::now(), server.getStats());
         }
 
-        state.numBullets = 0;
-        for (auto& b : bullets) {
-            b.pos = b.pos + dt.count() * b.velo;
-            state.bullets[state.numBullets++] = b;
+        if (recorder) {
+            recorder->flush();
         }
 
-        sendUpdate(server);
+        ++sim->tick;
+    }
 
-        server.poll();
-        while (Clock::now() - t0 < dt) {
-            server.poll();
+    if (checkpointPath) {
+        const auto t0 = Clock::now();
+        try {
+            checkpoint::save(checkpointPath, *sim, clients, server, sendrate);
+            LOG_INFO("saved tick %u with %lu players to %s in %.2fms", sim->tick, sim->players.size(), checkpointPath,
+                std::chrono::duration<float, std::milli>(Clock::now() - t0).count());
+        } catch (const std::exception& e) {
+            LOG_ERROR("%s", e.what());
+            return -1;
         }
     }
 
@@ -0,0 +1,161 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <format>
+#include <stdexcept>
+#include "histogram.h"
+#include "server.h"
+#include "util.h"
+
+
+// Tick instrumentation: a histogram of durations per phase plus the
+// transport counters, written out as text every dumpInterval and reset.
+// Recording is a couple of clock reads and an array increment so it can stay
+// on in production.
+class Profiler {
+public:
+	enum Phase {
+		Tick,          // Work done in a tick, excluding waiting for the next one
+		Poll,          // Handling incoming packets during the tick
+		Timeouts,
+		BulletPlayer,
+		BulletWorld,
+		PlayerWorld,
+		PlayerPlayer,
+		Integrate,
+		Horde,         // Everything npcs do
+		Events,
+		Snapshots,
+		PhaseCount
+	};
+
+	// Times the enclosing scope, does nothing without a profiler
+	class Scope {
+	public:
+		Scope(Profiler* profiler, Phase phase)
+		: profiler{profiler},
+		  phase{phase}
+		{
+			if (profiler) {
+				t0 = Clock::now();
+			}
+		}
+
+		~Scope() {
+			if (profiler) {
+				profiler->record(phase, Clock::now() - t0);
+			}
+		}
+
+	private:
+		Profiler* profiler;
+		Phase phase;
+		Clock::time_point t0;
+	};
+
+	// Phases split into jobs add up the time of every job instead, as they
+	// overlap with each other. Their histograms show the work done per tick,
+	// the tick histogram how long it took.
+	class JobScope {
+	public:
+		JobScope(Profiler* profiler, Phase phase)
+		: profiler{profiler},
+		  phase{phase}
+		{
+			if (profiler) {
+				t0 = Clock::now();
+			}
+		}
+
+		~JobScope() {
+			if (profiler) {
+				profiler->busy[phase].fetch_add((Clock::now() - t0).count(), std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		Profiler* profiler;
+		Phase phase;
+		Clock::time_point t0;
+	};
+
+	Profiler(const char* path, Clock::duration dumpInterval = std::chrono::seconds(10))
+	: file{std::fopen(path, "a")},
+	  dumpInterval{dumpInterval},
+	  prevDump{Clock::now()}
+	{
+		if (!file) {
+			throw std::runtime_error(std::format("unable to open {}", path));
+		}
+	}
+
+	~Profiler() {
+		std::fclose(file);
+	}
+
+	void record(Phase phase, Clock::duration d) {
+		histograms[phase].record(std::chrono::duration_cast<std::chrono::microseconds>(d).count());
+	}
+
+	// Records what JobScopes added up for phase since the last call
+	void recordJobs(Phase phase) {
+		record(phase, Clock::duration{busy[phase].exchange(0, std::memory_order_relaxed)});
+	}
+
+	void overrun() {
+		overruns++;
+	}
+
+	// Transport counters are cumulative, the dump shows how much they grew
+	void maybeDump(Clock::time_point now, const Server::Stats& transport) {
+		if (now - prevDump < dumpInterval) {
+			return;
+		}
+
+		const float s = std::chrono::duration<float>(now - prevDump).count();
+		const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+
+		std::fprintf(file, "# %lld interval_s=%.1f packets_in=%lu kB_in=%.1f packets_out=%lu kB_out=%.1f resends=%lu overruns=%lu\n",
+			(long long)timestamp, s,
+			transport.packetsIn - prevTransport.packetsIn,
+			(transport.bytesIn - prevTransport.bytesIn) / 1024.f,
+			transport.packetsOut - prevTransport.packetsOut,
+			(transport.bytesOut - prevTransport.bytesOut) / 1024.f,
+			transport.resends - prevTransport.resends,
+			overruns - prevOverruns);
+
+		for (int i = 0; i < PhaseCount; ++i) {
+			const auto& h = histograms[i];
+			std::fprintf(file, "%-13s count=%-6lu mean_us=%-8.1f p50=%-6lu p90=%-6lu p99=%-6lu p999=%-6lu max=%lu\n",
+				names[i], h.count(), h.mean(), h.percentile(50), h.percentile(90),
+				h.percentile(99), h.percentile(99.9), h.max());
+			histograms[i].reset();
+		}
+		std::fflush(file);
+
+		prevTransport = transport;
+		prevOverruns = overruns;
+		prevDump = now;
+	}
+
+private:
+	static constexpr const char* names[PhaseCount] = {
+		"tick", "poll", "timeouts", "bullet_player", "bullet_world",
+		"player_world", "player_player", "integrate", "horde", "events", "snapshots"
+	};
+
+	std::FILE* file;
+	Clock::duration dumpInterval;
+	Clock::time_point prevDump;
+	Server::Stats prevTransport;
+	uint64_t overruns{0};  // Ticks that took longer than their budget
+	uint64_t prevOverruns{0};
+	std::array<Histogram, PhaseCount> histograms;
+	std::array<std::atomic<Clock::rep>, PhaseCount> busy{};
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "replay.h"
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include "log.h"
+
+
+namespace replay {
+
+Recorder::Recorder(const char* path, const FileHeader& header)
+    : file{std::fopen(path, "wb")}
+{
+    if (!file) {
+        throw std::runtime_error(std::format("unable to open {}", path));
+    }
+
+    buffer.reserve(flushSize);
+    write(&header, sizeof header);
+    writer = std::thread{[this] { run(); }};
+}
+
+Recorder::~Recorder() {
+    {
+        std::lock_guard lock{mtx};
+        if (!stopped && !buffer.empty()) {
+            queue.push_back(std::move(buffer));
+        }
+        running = false;
+    }
+    cv.notify_one();
+    writer.join();
+    std::fclose(file);
+}
+
+void Recorder::keyframe(const Simulation& sim) {
+    if (stopped) {
+        return;
+    }
+
+    const auto state = sim.saveState();
+    const Keyframe k{
+        state.nextID,
+        uint32_t(sim.players.size()),
+        uint32_t(sim.bullets.size()),
+        uint32_t(sim.npcs.size()),
+        uint32_t(state.rng.size())
+    };
+    const size_t size = sizeof k
+        + sim.players.size() * sizeof (Player)
+        + sim.bullets.size() * sizeof (Bullet)
+        + sim.npcs.size() * sizeof (Npc)
+        + state.rng.size();
+
+    append(Type::Keyframe, sim.tick, 0, nullptr, size);
+    write(&k, sizeof k);
+    write(sim.players.data(), sim.players.size() * sizeof (Player));
+    write(sim.bullets.data(), sim.bullets.size() * sizeof (Bullet));
+    write(sim.npcs.data(), sim.npcs.size() * sizeof (Npc));
+    write(state.rng.data(), state.rng.size());
+}
+
+void Recorder::flush() {
+    const auto now = Clock::now();
+    if (stopped || buffer.empty() || (buffer.size() < flushSize && now - prevFlush < flushInterval)) {
+        return;
+    }
+    prevFlush = now;
+
+    {
+        std::lock_guard lock{mtx};
+        if (queue.size() >= maxQueued) {
+            LOG_ERROR("replay writer fell behind, recording stopped at tick %u", tick);
+            stopped = true;
+            return;
+        }
+        queue.push_back(std::move(buffer));
+    }
+    cv.notify_one();
+
+    buffer = {};
+    buffer.reserve(flushSize);
+}
+
+void Recorder::append(Type type, proto::Tick tick, proto::ID id, const void* payload, size_t size) {
+    if (stopped) {
+        return;
+    }
+
+    this->tick = tick;
+
+    Record r{};
+    r.type = type;
+    r.tick = tick;
+    r.id = id;
+    r.size = size;
+    write(&r, sizeof r);
+    if (payload) {
+        write(payload, size);
+    }
+}
+
+void Recorder::write(const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+}
+
+void Recorder::run() {
+    for (;;) {
+        std::vector<char> chunk;
+        {
+            std::unique_lock lock{mtx};
+            cv.wait(lock, [this] { return !queue.empty() || !running; });
+            if (queue.empty()) {
+                return;
+            }
+            chunk = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        if (std::fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size()) {
+            LOG_ERROR("replay write failed: %s", std::strerror(errno));
+        }
+        std::fflush(file);
+    }
+}
+
+}
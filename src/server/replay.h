@@ -0,0 +1,110 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "simulation.h"
+
+
+// Replay files hold what is needed to run a match again tick by tick: the
+// parameters the simulation was created with, every input the server applied
+// tagged with its tick, and every now and then a keyframe of the full state
+// to check the replay against or to start from.
+//
+// Within a tick, keyframes and leaves are recorded before the tick's step()
+// and everything else after it, the same order the server does them in.
+namespace replay {
+
+constexpr uint32_t magic = 0x50524c42; // "BLRP"
+constexpr uint32_t version = 3;
+
+struct FileHeader {
+	uint32_t magic{replay::magic};
+	uint32_t version{replay::version};
+	int32_t tickrate;
+	int32_t sendrate;
+	uint32_t seed;
+	World::Params world;
+	uint32_t hordeSize;
+};
+
+enum class Type : uint8_t {
+	Join,
+	Leave,
+	Move,      // proto::Move
+	MouseMove, // proto::MouseMove
+	Shoot,     // proto::Shoot
+	Keyframe,
+	Hitscan    // proto::Hitscan
+};
+
+// Every record starts with this and is followed by size bytes of payload
+struct Record {
+	Type type;
+	proto::Tick tick;
+	proto::ID id;
+	uint32_t size;
+};
+
+// Followed by the players, the bullets, the npcs and rngSize bytes of
+// generator state
+struct Keyframe {
+	proto::ID nextID;
+	uint32_t numPlayers;
+	uint32_t numBullets;
+	uint32_t numNpcs;
+	uint32_t rngSize;
+};
+
+// Appends records to a file from a background thread. The tick thread only
+// copies records into a buffer and hands it over once per flushInterval. If
+// the writer falls maxQueued buffers behind, recording stops rather than
+// stalling the tick, and the file stays valid up to where it stopped.
+class Recorder {
+public:
+	Recorder(const char* path, const FileHeader& header);
+	~Recorder();
+
+	template <typename T>
+	void record(Type type, proto::Tick tick, proto::ID id, const T& payload) {
+		append(type, tick, id, &payload, sizeof payload);
+	}
+
+	void record(Type type, proto::Tick tick, proto::ID id) {
+		append(type, tick, id, nullptr, 0);
+	}
+
+	void keyframe(const Simulation& sim);
+
+	// Call once per tick
+	void flush();
+
+private:
+	void append(Type type, proto::Tick tick, proto::ID id, const void* payload, size_t size);
+	void write(const void* data, size_t size);
+	void run();
+
+	static constexpr size_t flushSize = 64 * 1024;
+	static constexpr auto flushInterval = std::chrono::seconds(1);
+	static constexpr size_t maxQueued = 64;
+
+	std::FILE* file;
+	std::vector<char> buffer;
+	Clock::time_point prevFlush{Clock::now()};
+	proto::Tick tick{0};  // Of the latest record
+	bool stopped{false};
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	std::deque<std::vector<char>> queue;
+	bool running{true};
+	std::thread writer;
+};
+
+}
+
+#endif
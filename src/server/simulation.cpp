@@ -0,0 +1,636 @@
+#include "simulation.h"
+#include <limits>
+#include <numbers>
+#include <set>
+#include <format>
+#include <sstream>
+#include "util.h"
+#include "collision.h"
+#include "log.h"
+
+
+Simulation::Simulation(int tickrate, uint32_t seed, World world, uint32_t hordeSize)
+    : tickrate{tickrate},
+      hordeSize{hordeSize},
+      world{std::move(world)},
+      rng{seed}
+{
+}
+
+proto::Tick Simulation::toTicks(Clock::duration d) const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d).count() * tickrate / 1000;
+}
+
+Simulation::State Simulation::saveState() const {
+    std::ostringstream rngState;
+    rngState << rng;
+    return {nextID, rngState.str()};
+}
+
+void Simulation::restoreState(const State& state) {
+    nextID = state.nextID;
+    std::istringstream rngState{state.rng};
+    rngState >> rng;
+}
+
+constexpr float spawnExtent = 50.f;
+// Chunks nothing has needed for this long are dropped
+constexpr proto::Tick chunkEvictTicks = 600;
+// Npcs come in this far from a player, a few every tick
+constexpr float npcSpawnMin = 30.f;
+constexpr float npcSpawnMax = 50.f;
+constexpr size_t npcSpawnsPerTick = 4;
+// Npcs only make way for this many others, so a crowd costs the same per npc
+constexpr int npcMaxNeighbours = 8;
+constexpr float npcSeparation = 6.f;
+constexpr uint32_t noTarget = std::numeric_limits<uint32_t>::max();
+
+Vec2 Simulation::spawnPos() {
+    std::uniform_real_distribution<float> dist(-spawnExtent, spawnExtent);
+    const float x = dist(rng);
+    return {x, dist(rng)};
+}
+
+Player& Simulation::addPlayer() {
+    players.push_back(Player{{nextID++, spawnPos()}, tick});
+    return players.back();
+}
+
+Player& Simulation::findPlayer(proto::ID id) {
+    auto it = std::find_if(players.begin(), players.end(), [id](const Player& p) {
+            return p.id == id;
+        }
+    );
+
+    if (it == players.end()) {
+        throw std::runtime_error(std::format("unable to find player {}", id));
+    }
+
+    return *it;
+}
+
+void Simulation::applyMove(proto::ID id, const proto::Move& move) {
+    Player& p = findPlayer(id);
+    float velo = length(move.velo);
+    LOG_DEBUG("move.velo %.2f, %.2f", move.velo.x, move.velo.y);
+    if (velo > 0) {
+        p.velo = (proto::playerSpeed / velo) * move.velo;
+    } else {
+        p.velo = move.velo;
+    }
+}
+
+void Simulation::applyMouseMove(proto::ID id, const proto::MouseMove& move) {
+    Player& p = findPlayer(id);
+    p.target = move.pos;
+}
+
+void Simulation::applyShoot(proto::ID id, const proto::Shoot& shoot) {
+    findPlayer(id).lastShotAt = tick;
+    bullets.push_back(Bullet{shoot.bullet, tick + toTicks(proto::bulletLifetime)});
+    bullets.back().id = nextID++;
+}
+
+// Entities per job, sized so a job is worth more than handing it out
+constexpr size_t hitGrain = 64;
+constexpr size_t expireGrain = 256;
+constexpr size_t worldGrain = 256;
+constexpr size_t moveGrain = 1024;
+constexpr size_t npcGrain = 256;
+
+// Where the ray enters the circle, infinity if it misses or the circle is
+// behind its origin
+static float enterCircle(const Ray& ray, Vec2 center, float radius) {
+    const Vec2 m = center - ray.origin;
+    const float along = dot(m, ray.dir);
+    const float off = lengthSquared(m) - along * along;
+    const float r2 = radius * radius;
+    if (along < 0 || off > r2) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return std::max(0.f, along - std::sqrt(r2 - off));
+}
+
+// Moves a circle at pos out of the blocks of the chunk it is in
+static void pushOutOfBlocks(const World& world, Vec2& pos, float radius) {
+    const Chunk* chunk = world.find(World::chunkOf(pos));
+    if (!chunk) {
+        return;
+    }
+    for (const auto& block : chunk->blocks) {
+        if (CheckCollisionPointAndRec(
+            pos.x, pos.y,
+            block.pos.x, block.pos.y, block.size.x, block.size.y
+        )) {
+            const auto center = block.pos + block.size / 2.f;
+            const auto diff = pos - center;
+            if (std::abs(diff.x) > std::abs(diff.y)) {
+                pos.x = center.x + (block.size.x / 2 + radius) * diff.x / std::abs(diff.x);
+            } else {
+                pos.y = center.y + (block.size.y / 2 + radius) * diff.y / std::abs(diff.y);
+            }
+            LOG_DEBUG("world collision!");
+        }
+    }
+}
+
+JobSystem& Simulation::jobSystem() {
+    static thread_local JobSystem inlineJobs{0};
+    return jobs ? *jobs : inlineJobs;
+}
+
+// Hits the first player or block on the line, right away rather than on
+// the next step like a bullet
+void Simulation::applyHitscan(proto::ID id, const proto::Hitscan& shot) {
+    Player& shooter = findPlayer(id);
+    const float len = length(shot.dir);
+    if (!(len > 0)) {
+        throw std::runtime_error(std::format("invalid hitscan direction from player {}", id));
+    }
+    shooter.lastShotAt = tick;
+
+    // Blocks only stop the shot in chunks that have been made
+    const ChunkCoord from = World::chunkOf(shooter.pos - Vec2{proto::hitscanRange, proto::hitscanRange});
+    const ChunkCoord to = World::chunkOf(shooter.pos + Vec2{proto::hitscanRange, proto::hitscanRange});
+    for (int32_t x = from.x; x <= to.x; ++x) {
+        for (int32_t y = from.y; y <= to.y; ++y) {
+            world.load({x, y});
+        }
+    }
+
+    const Ray ray{shooter.pos, (1 / len) * shot.dir, proto::hitscanRange};
+    float nearest = world.raycast(ray).distance;
+    Player* hit = nullptr;
+    for (auto& p : players) {
+        if (const float t = enterCircle(ray, p.pos, proto::playerRadius); p.id != id && t <= nearest) {
+            nearest = t;
+            hit = &p;
+        }
+    }
+    auto hitNpc = npcs.end();
+    for (auto it = npcs.begin(); it != npcs.end(); ++it) {
+        if (const float t = enterCircle(ray, it->pos, proto::enemyRadius); t <= nearest) {
+            nearest = t;
+            hitNpc = it;
+            hit = nullptr;
+        }
+    }
+
+    if (hit) {
+        damage(*hit, id, proto::hitscanDamage);
+    } else if (hitNpc != npcs.end()) {
+        hitNpc->health -= std::min(hitNpc->health, proto::hitscanDamage);
+        if (hitNpc->health == 0) {
+            events.push_back({proto::Event::Type::Leave, hitNpc->id});
+            npcs.erase(hitNpc);
+        }
+    }
+}
+
+bool Simulation::damage(Player& p, proto::ID shooter, uint32_t amount) {
+    if (p.health <= amount) {
+        p.stats.deaths++;
+        p.pos = spawnPos();
+        p.velo = Vec2{0, 0};
+        p.health = proto::maxHealth;
+        // Npcs don't keep score
+        auto it = std::find_if(players.begin(), players.end(), [shooter](const Player& s) {
+            return s.id == shooter;
+        });
+        if (it != players.end()) {
+            it->stats.kills++;
+        }
+        events.push_back({proto::Event::Type::Kill, p.id, shooter, p.stats, p.health});
+        return true;
+    }
+
+    p.health -= amount;
+    events.push_back({proto::Event::Type::Damage, p.id, shooter, p.stats, p.health});
+    return false;
+}
+
+// Hits are looked for while expired bullets are and the flow field is built,
+// and only then are bullets removed and players and npcs damaged and
+// respawned. Pushing players out of the world waits for the respawns, the
+// bullets move as soon as the expired ones are gone and the npcs once the
+// damage is done.
+void Simulation::step() {
+    loadChunks();
+
+    Counter gridBuilt, found, hitsApplied, npcsHit, bulletsRemoved, worldResolved, playersResolved,
+            steered, npcsMoved, moved;
+
+    buildGrid(nullptr, gridBuilt);
+    findHits(nullptr, found);
+    findExpired(nullptr, found);
+    buildField(nullptr, found);
+    findNpcHits(&gridBuilt, found);
+    findAttacks(&gridBuilt, found);
+    applyHits(&found, hitsApplied);
+    removeExpired(&found, bulletsRemoved);
+    applyNpcHits(&hitsApplied, npcsHit);
+    resolveWorld(&npcsHit, worldResolved);
+    resolvePlayers(&worldResolved, playersResolved);
+    movePlayers(&playersResolved, moved);
+    moveBullets(&bulletsRemoved, moved);
+    steerNpcs(&npcsHit, steered);
+    moveNpcs(&steered, npcsMoved);
+    updateHorde(&npcsMoved, moved);
+    jobSystem().wait(moved);
+
+    if (profiler) {
+        for (const auto phase : {Profiler::BulletPlayer, Profiler::BulletWorld, Profiler::PlayerWorld,
+                                 Profiler::PlayerPlayer, Profiler::Integrate, Profiler::Horde}) {
+            profiler->recordJobs(phase);
+        }
+    }
+}
+
+// Respawns happen during the tick, so the spawn area is always loaded
+void Simulation::loadChunks() {
+    if (tick % chunkEvictTicks == 0) {
+        world.evictUnused();
+    }
+
+    const ChunkCoord spawnFrom = World::chunkOf({-spawnExtent, -spawnExtent});
+    const ChunkCoord spawnTo = World::chunkOf({spawnExtent, spawnExtent});
+    for (int32_t x = spawnFrom.x; x <= spawnTo.x; ++x) {
+        for (int32_t y = spawnFrom.y; y <= spawnTo.y; ++y) {
+            world.load({x, y});
+        }
+    }
+
+    for (const auto& p : players) {
+        world.load(World::chunkOf(p.pos));
+    }
+    for (const auto& b : bullets) {
+        world.load(World::chunkOf(b.pos));
+    }
+    for (const auto& n : npcs) {
+        world.load(World::chunkOf(n.pos));
+    }
+
+    goals.resize(players.size());
+    for (size_t i = 0; i < players.size(); ++i) {
+        goals[i] = players[i].pos;
+    }
+
+    // A field per player, so a player moving only rebuilds their own
+    goalFields.clear();
+    staleFields.clear();
+    std::erase_if(fields, [this](const auto& kv) {
+        return std::none_of(players.begin(), players.end(), [&kv](const Player& p) {
+            return p.id == kv.first;
+        });
+    });
+    if (hordeSize == 0 && npcs.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < players.size(); ++i) {
+        auto& field = fields[players[i].id];
+        if (field.prepare(world, &goals[i], 1)) {
+            staleFields.push_back(&field);
+        }
+        goalFields.push_back(&field);
+    }
+}
+
+void Simulation::collideBullets() {
+    Counter found, applied;
+    findHits(nullptr, found);
+    applyHits(&found, applied);
+    jobSystem().wait(applied);
+}
+
+void Simulation::expireBullets() {
+    Counter found, removed;
+    findExpired(nullptr, found);
+    removeExpired(&found, removed);
+    jobSystem().wait(removed);
+}
+
+void Simulation::collideWorld() {
+    Counter done;
+    resolveWorld(nullptr, done);
+    jobSystem().wait(done);
+}
+
+void Simulation::collidePlayers() {
+    Counter done;
+    resolvePlayers(nullptr, done);
+    jobSystem().wait(done);
+}
+
+void Simulation::integrate() {
+    Counter done;
+    movePlayers(nullptr, done);
+    moveBullets(nullptr, done);
+    jobSystem().wait(done);
+}
+
+void Simulation::moveHorde() {
+    Counter built, steered, done;
+    buildGrid(nullptr, built);
+    buildField(nullptr, built);
+    steerNpcs(&built, steered);
+    moveNpcs(&steered, done);
+    jobSystem().wait(done);
+}
+
+void Simulation::findHits(Counter* after, Counter& done) {
+    positions.resize(players.size());
+    for (size_t i = 0; i < players.size(); ++i) {
+        positions[i] = players[i].pos;
+    }
+
+    hits.resize(JobSystem::chunks(bullets.size(), hitGrain));
+    jobSystem().parallelFor(after, done, bullets.size(), hitGrain, [this](size_t chunk, size_t begin, size_t end) {
+        Profiler::JobScope scope{profiler, Profiler::BulletPlayer};
+        constexpr float hitDistanceSquared = proto::playerRadius * proto::playerRadius;
+        static thread_local std::vector<float> distances;
+        distances.resize(positions.size());
+
+        auto& found = hits[chunk];
+        found.clear();
+        for (size_t i = begin; i < end; ++i) {
+            const auto& b = bullets[i];
+            distancesSquared(b.pos, positions.data(), positions.size(), distances.data());
+            for (size_t j = 0; j < positions.size(); ++j) {
+                if (distances[j] < hitDistanceSquared && players[j].id != b.shooterID) {
+                    found.push_back({uint32_t(j), b.shooterID});
+                }
+            }
+        }
+    });
+}
+
+// A player killed here respawns elsewhere, but can't be hit again this tick,
+// so the hits found at the old positions all still apply
+void Simulation::applyHits(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this] {
+        Profiler::JobScope scope{profiler, Profiler::BulletPlayer};
+        std::set<proto::ID> killed;
+        for (const auto& chunk : hits) {
+            for (const auto& hit : chunk) {
+                auto& p = players[hit.player];
+                if (!killed.contains(p.id) && damage(p, hit.shooter, proto::bulletDamage)) {
+                    killed.insert(p.id);
+                }
+            }
+        }
+    });
+}
+
+void Simulation::findExpired(Counter* after, Counter& done) {
+    expired.resize(bullets.size());
+    jobSystem().parallelFor(after, done, bullets.size(), expireGrain, [this](size_t, size_t begin, size_t end) {
+        Profiler::JobScope scope{profiler, Profiler::BulletWorld};
+        for (size_t i = begin; i < end; ++i) {
+            const auto& bullet = bullets[i];
+            expired[i] = tick >= bullet.expiresAt || world.blockAt(bullet.pos);
+        }
+    });
+}
+
+void Simulation::removeExpired(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this] {
+        Profiler::JobScope scope{profiler, Profiler::BulletWorld};
+        size_t kept = 0;
+        for (size_t i = 0; i < bullets.size(); ++i) {
+            if (!expired[i]) {
+                bullets[kept++] = bullets[i];
+            }
+        }
+        bullets.resize(kept);
+    });
+}
+
+void Simulation::resolveWorld(Counter* after, Counter& done) {
+    jobSystem().parallelFor(after, done, players.size(), worldGrain, [this](size_t, size_t begin, size_t end) {
+        Profiler::JobScope scope{profiler, Profiler::PlayerWorld};
+        for (size_t i = begin; i < end; ++i) {
+            pushOutOfBlocks(world, players[i].pos, proto::playerRadius);
+        }
+    });
+}
+
+// Every push moves players the later pairs look at, so this one stays in order
+void Simulation::resolvePlayers(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this] {
+        Profiler::JobScope scope{profiler, Profiler::PlayerPlayer};
+        for (auto ita = players.begin(); ita != players.end(); ++ita) {
+            for (auto itb = ita + 1; itb != players.end(); ++itb) {
+                const auto diff = ita->pos - itb->pos;
+                const float dist = length(diff);
+                if (dist < 2 * proto::playerRadius) {
+                    const auto move = (2 * proto::playerRadius - dist) * diff / dist;
+                    ita->pos = ita->pos + move;
+                    itb->pos = itb->pos - move;
+                    LOG_DEBUG("player collision!");
+                }
+            }
+        }
+    });
+}
+
+void Simulation::movePlayers(Counter* after, Counter& done) {
+    jobSystem().parallelFor(after, done, players.size(), moveGrain, [this](size_t, size_t begin, size_t end) {
+        Profiler::JobScope scope{profiler, Profiler::Integrate};
+        const float dt = 1.0f / tickrate;
+        for (size_t i = begin; i < end; ++i) {
+            players[i].pos += dt * players[i].velo;
+        }
+    });
+}
+
+// How many bullets are left is only known once the expired ones are gone
+void Simulation::moveBullets(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this, &done] {
+        jobSystem().parallelFor(nullptr, done, bullets.size(), moveGrain, [this](size_t, size_t begin, size_t end) {
+            Profiler::JobScope scope{profiler, Profiler::Integrate};
+            const float dt = 1.0f / tickrate;
+            for (size_t i = begin; i < end; ++i) {
+                bullets[i].pos += dt * bullets[i].velo;
+            }
+        });
+    });
+}
+
+void Simulation::buildGrid(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this] {
+        Profiler::JobScope scope{profiler, Profiler::Horde};
+        npcPositions.resize(npcs.size());
+        for (size_t i = 0; i < npcs.size(); ++i) {
+            npcPositions[i] = npcs[i].pos;
+        }
+        grid.build(npcPositions.data(), npcPositions.size());
+    });
+}
+
+// Only the fields of players that went to another cell since the last time
+void Simulation::buildField(Counter* after, Counter& done) {
+    jobSystem().parallelFor(after, done, staleFields.size(), 1, [this](size_t, size_t begin, size_t end) {
+        Profiler::JobScope scope{profiler, Profiler::Horde};
+        for (size_t i = begin; i < end; ++i) {
+            staleFields[i]->build(world);
+        }
+    });
+}
+
+void Simulation::findNpcHits(Counter* after, Counter& done) {
+    npcHits.resize(JobSystem::chunks(bullets.size(), hitGrain));
+    jobSystem().parallelFor(after, done, bullets.size(), hitGrain, [this](size_t chunk, size_t begin, size_t end) {
+        Profiler::JobScope scope{profiler, Profiler::Horde};
+        auto& found = npcHits[chunk];
+        found.clear();
+        for (size_t i = begin; i < end; ++i) {
+            const auto& b = bullets[i];
+            grid.query(b.pos, proto::enemyRadius + proto::bulletRadius, [&](uint32_t npc) {
+                found.push_back({npc, 0, b.shooterID});
+                return true;
+            });
+        }
+    });
+}
+
+// There are far fewer players than npcs, so the players look for npcs
+void Simulation::findAttacks(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this] {
+        Profiler::JobScope scope{profiler, Profiler::Horde};
+        attacks.clear();
+        for (size_t i = 0; i < goals.size(); ++i) {
+            grid.query(goals[i], proto::enemyRadius + proto::playerRadius, [&](uint32_t npc) {
+                if (npcs[npc].attackReadyAt <= tick) {
+                    attacks.push_back({npc, uint32_t(i), npcs[npc].id});
+                }
+                return true;
+            });
+        }
+    });
+}
+
+// Npcs shot dead stay where they are until updateHorde(), so the indices the
+// other phases hold stay valid
+void Simulation::applyNpcHits(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this] {
+        Profiler::JobScope scope{profiler, Profiler::Horde};
+        for (const auto& chunk : npcHits) {
+            for (const auto& hit : chunk) {
+                auto& n = npcs[hit.npc];
+                n.health -= std::min(n.health, proto::bulletDamage);
+            }
+        }
+
+        std::set<proto::ID> killed;
+        for (const auto& attack : attacks) {
+            auto& n = npcs[attack.npc];
+            auto& p = players[attack.player];
+            if (n.health == 0 || n.attackReadyAt > tick || killed.contains(p.id)) {
+                continue;
+            }
+            n.attackReadyAt = tick + toTicks(proto::npcAttackInterval);
+            if (damage(p, n.id, proto::npcDamage)) {
+                killed.insert(p.id);
+            }
+        }
+    });
+}
+
+// Along the flow field of the nearest player and away from the npcs around.
+// Each npc only writes its own velocity and target, positions are read from
+// where the grid was built.
+void Simulation::steerNpcs(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this, &done] {
+        targets.resize(npcs.size());
+        jobSystem().parallelFor(nullptr, done, npcs.size(), npcGrain, [this](size_t, size_t begin, size_t end) {
+            Profiler::JobScope scope{profiler, Profiler::Horde};
+            constexpr float apart = 2 * proto::enemyRadius;
+            static thread_local std::vector<float> distances;
+            distances.resize(goals.size());
+
+            for (size_t i = begin; i < end; ++i) {
+                auto& n = npcs[i];
+                targets[i] = noTarget;
+                if (n.health == 0 || goals.empty()) {
+                    continue;
+                }
+                const Vec2 pos = npcPositions[i];
+
+                distancesSquared(pos, goals.data(), goals.size(), distances.data());
+                const auto nearest = uint32_t(std::min_element(distances.begin(), distances.end()) - distances.begin());
+                targets[i] = nearest;
+                const FlowField& field = *goalFields[nearest];
+
+                Vec2 dir = field.direction(pos);
+                if (dir == Vec2{0, 0} && field.distance(pos) == 0 && distances[nearest] > 0) {
+                    // In the cell of the player, straight at them
+                    dir = unit(goals[nearest] - pos);
+                }
+
+                Vec2 push{0, 0};
+                int neighbours = 0;
+                grid.query(pos, apart, [&](uint32_t j) {
+                    if (j == i || npcs[j].health == 0) {
+                        return true;
+                    }
+                    const Vec2 diff = pos - npcPositions[j];
+                    const float d = length(diff);
+                    if (d > 0) {
+                        push += ((apart - d) / (apart * d)) * diff;
+                    }
+                    return ++neighbours < npcMaxNeighbours;
+                });
+
+                n.velo = proto::npcSpeed * dir + npcSeparation * push;
+            }
+        });
+    });
+}
+
+void Simulation::moveNpcs(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this, &done] {
+        jobSystem().parallelFor(nullptr, done, npcs.size(), npcGrain, [this](size_t, size_t begin, size_t end) {
+            Profiler::JobScope scope{profiler, Profiler::Horde};
+            const float dt = 1.0f / tickrate;
+            for (size_t i = begin; i < end; ++i) {
+                npcs[i].pos += dt * npcs[i].velo;
+                pushOutOfBlocks(world, npcs[i].pos, proto::enemyRadius);
+            }
+        });
+    });
+}
+
+// Drops the dead npcs and those too far from their nearest player for its
+// flow field to cover, and brings in new ones where a player can be reached
+// from
+void Simulation::updateHorde(Counter* after, Counter& done) {
+    jobSystem().run(after, done, [this] {
+        Profiler::JobScope scope{profiler, Profiler::Horde};
+        size_t kept = 0;
+        for (size_t i = 0; i < npcs.size(); ++i) {
+            const auto& n = npcs[i];
+            if (n.health == 0 || targets[i] == noTarget || !goalFields[targets[i]]->covers(n.pos)) {
+                events.push_back({proto::Event::Type::Leave, n.id});
+                continue;
+            }
+            npcs[kept++] = n;
+        }
+        npcs.resize(kept);
+
+        if (goals.empty()) {
+            return;
+        }
+        std::uniform_int_distribution<size_t> player(0, goals.size() - 1);
+        std::uniform_real_distribution<float> angle(0, 2 * std::numbers::pi_v<float>);
+        std::uniform_real_distribution<float> dist(npcSpawnMin, npcSpawnMax);
+        for (size_t i = 0; i < npcSpawnsPerTick && npcs.size() < hordeSize; ++i) {
+            const size_t p = player(rng);
+            const float a = angle(rng);
+            const Vec2 pos = goals[p] + dist(rng) * Vec2{std::cos(a), std::sin(a)};
+            if (goalFields[p]->distance(pos) == FlowField::unreachable) {
+                continue;
+            }
+            npcs.push_back(Npc{{nextID++, pos, {0, 0}}});
+        }
+    });
+}
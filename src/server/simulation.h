@@ -0,0 +1,146 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "protocol.h"
+#include "world.h"
+#include "flowfield.h"
+#include "grid.h"
+#include "profiler.h"
+#include "jobs.h"
+
+
+// Server side entities carry their lifetimes as ticks, the wire format only
+// carries the tick of the whole snapshot.
+struct Bullet : proto::Bullet {
+	proto::Tick expiresAt;
+};
+
+struct Player : proto::Player {
+	proto::Tick joinedAt;
+	proto::Tick lastShotAt{0};
+	proto::Stats stats{};
+	uint32_t health{proto::maxHealth};
+};
+
+struct Npc : proto::Npc {
+	uint32_t health{proto::npcHealth};
+	proto::Tick attackReadyAt{0};
+};
+
+// Authoritative game state and the phases of a server tick. Nothing in here
+// touches the network, so benchmarks and tools can drive it as well.
+class Simulation {
+public:
+	// Up to hordeSize npcs are kept coming at the players
+	Simulation(int tickrate, uint32_t seed = 1, World world = World{World::Params{}}, uint32_t hordeSize = 0);
+
+	Player& addPlayer();
+	Player& findPlayer(proto::ID id);
+
+	void applyMove(proto::ID id, const proto::Move& move);
+	void applyMouseMove(proto::ID id, const proto::MouseMove& move);
+	void applyShoot(proto::ID id, const proto::Shoot& shoot);
+	void applyHitscan(proto::ID id, const proto::Hitscan& shot);
+
+	// Runs the phases below as jobs, overlapping the ones that don't touch
+	// the same entities. The result is the same as running them one after
+	// another on one thread. The caller advances tick afterwards.
+	void step();
+
+	// Each of these runs one phase on its own and waits for it
+	void collideBullets();
+	void expireBullets();
+	void collideWorld();
+	void collidePlayers();
+	void integrate();
+	void moveHorde();
+
+	// Makes the world chunks the phases look at, which they can't do
+	// themselves as they run in parallel. step() starts with it.
+	void loadChunks();
+
+	proto::Tick toTicks(Clock::duration d) const;
+
+	// What the following ticks depend on besides the public members
+	struct State {
+		proto::ID nextID;
+		std::string rng;
+	};
+
+	State saveState() const;
+	void restoreState(const State& state);
+
+	int tickrate;
+	uint32_t hordeSize;
+	proto::Tick tick{0};
+	World world;
+	std::vector<Player> players;
+	std::vector<Bullet> bullets;
+	std::vector<Npc> npcs;
+	std::vector<proto::Event> events; // Produced by the phases, drained by the caller
+	Profiler* profiler{nullptr};
+	JobSystem* jobs{nullptr}; // Runs everything on the calling thread without one
+
+private:
+	using Counter = JobSystem::Counter;
+
+	// A bullet of shooter within reach of player, applied in order afterwards
+	struct Hit {
+		uint32_t player;
+		proto::ID shooter;
+	};
+
+	// Npc within reach of a player, or a bullet of shooter within reach of npc
+	struct NpcHit {
+		uint32_t npc;
+		uint32_t player;
+		proto::ID shooter;
+	};
+
+	// The phases as jobs, each one starts after the jobs counted in after
+	// and counts its own in done
+	void findHits(Counter* after, Counter& done);
+	void applyHits(Counter* after, Counter& done);
+	void findExpired(Counter* after, Counter& done);
+	void removeExpired(Counter* after, Counter& done);
+	void resolveWorld(Counter* after, Counter& done);
+	void resolvePlayers(Counter* after, Counter& done);
+	void movePlayers(Counter* after, Counter& done);
+	void moveBullets(Counter* after, Counter& done);
+	void buildGrid(Counter* after, Counter& done);
+	void buildField(Counter* after, Counter& done);
+	void findNpcHits(Counter* after, Counter& done);
+	void findAttacks(Counter* after, Counter& done);
+	void applyNpcHits(Counter* after, Counter& done);
+	void steerNpcs(Counter* after, Counter& done);
+	void moveNpcs(Counter* after, Counter& done);
+	void updateHorde(Counter* after, Counter& done);
+
+	JobSystem& jobSystem();
+	Vec2 spawnPos();
+	// Returns whether it killed p, who has then respawned
+	bool damage(Player& p, proto::ID shooter, uint32_t amount);
+
+	// Scratch space of the phases, kept to not allocate every tick
+	std::vector<Vec2> positions;
+	std::vector<std::vector<Hit>> hits; // Per chunk of bullets
+	std::vector<uint8_t> expired;
+	std::vector<Vec2> goals; // Players at the start of the tick, what npcs go for
+	std::vector<Vec2> npcPositions;
+	std::vector<std::vector<NpcHit>> npcHits; // Per chunk of bullets
+	std::vector<NpcHit> attacks;
+	std::vector<uint32_t> targets; // Nearest goal of each npc
+	SpatialGrid grid{2 * proto::enemyRadius};
+	std::unordered_map<proto::ID, FlowField> fields; // Towards each player
+	std::vector<const FlowField*> goalFields;
+	std::vector<FlowField*> staleFields; // Of players that went to another cell
+
+	proto::ID nextID{1};
+	std::mt19937 rng;
+};
+
+#endif
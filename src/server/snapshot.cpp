@@ -0,0 +1,188 @@
+#include "snapshot.h"
+#include "util.h"
+
+
+using namespace std::chrono_literals;
+
+constexpr auto shootingDuration = 500ms;
+
+// Players and bullets kept their keys from when there were only the two
+static uint64_t priorityKey(uint8_t kind, proto::ID id) {
+    return (uint64_t(kind) << 32) | id;
+}
+
+static float relevance(Vec2 viewer, Vec2 pos) {
+    return 1 + 4 * std::max(0.f, 1 - distance(viewer, pos) / relevantDistance);
+}
+
+static float playerWeight(const Simulation& sim, Vec2 viewer, const Player& p) {
+    const bool shooting = p.lastShotAt != 0 && sim.tick - p.lastShotAt < sim.toTicks(shootingDuration);
+    return relevance(viewer, p.pos) * (shooting ? 2 : 1);
+}
+
+static float bulletWeight(Vec2 viewer, const Bullet& b) {
+    const auto diff = viewer - b.pos;
+    const float towards = dot(b.velo, diff);
+    const bool incoming = towards > 0.9f * length(b.velo) * length(diff);
+    return relevance(viewer, b.pos) * (incoming ? 3 : 1);
+}
+
+bool farFromAction(const Simulation& sim, proto::ID id) {
+    auto it = std::find_if(sim.players.begin(), sim.players.end(), [id](const Player& p) {
+        return p.id == id;
+    });
+    if (it == sim.players.end()) {
+        return false;
+    }
+
+    for (const auto& p : sim.players) {
+        if (p.id != id && distanceSquared(p.pos, it->pos) < farFromActionDistance * farFromActionDistance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SnapshotEncoder::encodeEntities(const Simulation& sim) {
+    wirePlayers.clear();
+    for (const auto& p : sim.players) {
+        wirePlayers.push_back(p);
+    }
+
+    wireBullets.clear();
+    for (const auto& b : sim.bullets) {
+        wireBullets.push_back(b);
+    }
+
+    wireNpcs.clear();
+    for (const auto& n : sim.npcs) {
+        wireNpcs.push_back(n);
+    }
+}
+
+size_t SnapshotEncoder::fill(const Simulation& sim, Client& client, char* out, size_t budget) {
+    const auto& players = sim.players;
+    const auto& bullets = sim.bullets;
+    const auto& npcs = sim.npcs;
+    const proto::Tick tick = sim.tick;
+    candidates.clear();
+
+    auto self = std::find_if(players.begin(), players.end(), [&client](const Player& p) {
+        return p.id == client.id;
+    });
+    const Vec2 viewer = self != players.end() ? self->pos : Vec2{0, 0};
+    const float elapsed = tick - client.prevSend;
+
+    rays.clear();
+    rayCandidates.clear();
+    auto occlusionTest = [&](Vec2 pos) {
+        const Vec2 diff = pos - viewer;
+        const float d2 = lengthSquared(diff);
+        if (self != players.end() && d2 > 0 && d2 < proto::occlusionDistance * proto::occlusionDistance) {
+            const float d = std::sqrt(d2);
+            rays.push_back({viewer, (1 / d) * diff, d});
+            rayCandidates.push_back(candidates.size() - 1);
+        }
+    };
+
+    for (size_t i = 0; i < players.size(); ++i) {
+        if (players[i].id == client.id) {
+            continue;
+        }
+        auto& acc = client.priorities[priorityKey(uint8_t(Kind::Player), players[i].id)];
+        acc.value += elapsed * playerWeight(sim, viewer, players[i]);
+        acc.seen = tick;
+        candidates.push_back({acc.value, Kind::Player, i});
+        occlusionTest(players[i].pos);
+    }
+
+    for (size_t i = 0; i < bullets.size(); ++i) {
+        auto& acc = client.priorities[priorityKey(uint8_t(Kind::Bullet), bullets[i].id)];
+        acc.value += elapsed * bulletWeight(viewer, bullets[i]);
+        acc.seen = tick;
+        candidates.push_back({acc.value, Kind::Bullet, i});
+        occlusionTest(bullets[i].pos);
+    }
+
+    for (size_t i = 0; i < npcs.size(); ++i) {
+        auto& acc = client.priorities[priorityKey(uint8_t(Kind::Npc), npcs[i].id)];
+        acc.value += elapsed * relevance(viewer, npcs[i].pos);
+        acc.seen = tick;
+        candidates.push_back({acc.value, Kind::Npc, i});
+        occlusionTest(npcs[i].pos);
+    }
+
+    // Hidden entities keep gaining priority, so they are sent as soon as they
+    // come into view
+    rayHits.resize(rays.size());
+    sim.world.raycast(rays.data(), rays.size(), rayHits.data());
+    for (size_t i = 0; i < rays.size(); ++i) {
+        candidates[rayCandidates[i]].hidden = rayHits[i].block != nullptr;
+    }
+
+    std::erase_if(client.priorities, [tick](const auto& item) {
+        return item.second.seen != tick;
+    });
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        return a.priority > b.priority;
+    });
+
+    sentPlayers.clear();
+    sentBullets.clear();
+    sentNpcs.clear();
+
+    size_t n = sizeof (proto::Snapshot);
+    if (self != players.end()) {
+        sentPlayers.push_back(self - players.begin());
+        n += sizeof (proto::Player);
+    }
+
+    for (const auto& c : candidates) {
+        if (c.hidden) {
+            continue;
+        }
+        const size_t size = c.kind == Kind::Player ? sizeof (proto::Player)
+            : c.kind == Kind::Bullet ? sizeof (proto::Bullet)
+            : sizeof (proto::Npc);
+        if (n + size > budget) {
+            // A smaller entity might still fit
+            continue;
+        }
+        n += size;
+        switch (c.kind) {
+            case Kind::Player:
+                sentPlayers.push_back(c.idx);
+                client.priorities[priorityKey(uint8_t(c.kind), players[c.idx].id)].value = 0;
+                break;
+            case Kind::Bullet:
+                sentBullets.push_back(c.idx);
+                client.priorities[priorityKey(uint8_t(c.kind), bullets[c.idx].id)].value = 0;
+                break;
+            case Kind::Npc:
+                sentNpcs.push_back(c.idx);
+                client.priorities[priorityKey(uint8_t(c.kind), npcs[c.idx].id)].value = 0;
+                break;
+        }
+    }
+
+    const proto::Snapshot snapshot{tick, uint16_t(sentPlayers.size()), uint16_t(sentBullets.size()), uint16_t(sentNpcs.size())};
+    char* it = out;
+    std::memcpy(it, &snapshot, sizeof snapshot);
+    it += sizeof snapshot;
+    for (const auto idx : sentPlayers) {
+        std::memcpy(it, &wirePlayers[idx], sizeof wirePlayers[idx]);
+        it += sizeof wirePlayers[idx];
+    }
+    for (const auto idx : sentBullets) {
+        std::memcpy(it, &wireBullets[idx], sizeof wireBullets[idx]);
+        it += sizeof wireBullets[idx];
+    }
+    for (const auto idx : sentNpcs) {
+        std::memcpy(it, &wireNpcs[idx], sizeof wireNpcs[idx]);
+        it += sizeof wireNpcs[idx];
+    }
+
+    client.prevSend = tick;
+    return n;
+}
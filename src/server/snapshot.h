@@ -0,0 +1,80 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "simulation.h"
+
+
+// Clients with nobody within this distance get snapshots less often
+constexpr float farFromActionDistance = 100.f;
+constexpr proto::Tick farFromActionSlowdown = 2;
+// Entities within this distance of a client gain priority faster
+constexpr float relevantDistance = 60.f;
+constexpr size_t minSnapshotSize = 256;
+
+struct Priority {
+	float value{0};
+	proto::Tick seen{0};
+};
+
+// Replication state of a connected client
+struct Client {
+	proto::ID id;
+	// Fewest ticks between snapshots, a congested link gets them less often
+	proto::Tick sendInterval{1};
+	proto::Tick nextSend{0};
+	proto::Tick prevSend{0};
+	// Accumulated priority of each entity, reset when the entity gets sent
+	std::unordered_map<uint64_t, Priority> priorities;
+	std::vector<proto::Event> events; // Not yet sent
+	// World chunks sent around the chunk the player was last seen in
+	std::unordered_set<uint64_t> chunks;
+	std::optional<ChunkCoord> chunkCenter;
+	// Spectators are sent what the player id is without playing, the one
+	// they asked to follow when it is in the game, else whoever is
+	bool spectator{false};
+	proto::ID follow{0}; // 0 for anyone
+};
+
+bool farFromAction(const Simulation& sim, proto::ID id);
+
+class SnapshotEncoder {
+public:
+	// Wire form of every entity, to be done at most once per tick and only on
+	// ticks where some client is due a snapshot
+	void encodeEntities(const Simulation& sim);
+
+	// Fills the snapshot for the client in priority order up to budget bytes.
+	// The client's own player is always included. Returns the snapshot size.
+	size_t fill(const Simulation& sim, Client& client, char* out, size_t budget);
+
+private:
+	enum class Kind : uint8_t {
+		Player,
+		Bullet,
+		Npc
+	};
+
+	struct Candidate {
+		float priority;
+		Kind kind;
+		size_t idx;
+		bool hidden{false};
+	};
+
+	std::vector<proto::Player> wirePlayers;
+	std::vector<proto::Bullet> wireBullets;
+	std::vector<proto::Npc> wireNpcs;
+	std::vector<Candidate> candidates;
+	std::vector<Ray> rays;
+	std::vector<RayHit> rayHits;
+	std::vector<size_t> rayCandidates; // Candidate each ray was cast for
+	std::vector<size_t> sentPlayers;
+	std::vector<size_t> sentBullets;
+	std::vector<size_t> sentNpcs;
+};
+
+#endif
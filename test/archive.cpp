@@ -0,0 +1,44 @@
+#include "archive.h"
+#include <catch2/catch_test_macros.hpp>
+
+
+TEST_CASE("archive round trips values, vectors and strings", "[archive]") {
+	struct Pod {
+		int a;
+		float b;
+	};
+
+	Writer w;
+	w.write(Pod{1, 2.5f});
+	w.write(std::vector<uint16_t>{1, 2, 3});
+	w.write(std::string{"rng state"});
+	w.write<uint64_t>(42);
+
+	Reader r{w.data().data(), w.data().size()};
+	const auto pod = r.read<Pod>();
+	REQUIRE(pod.a == 1);
+	REQUIRE(pod.b == 2.5f);
+
+	std::vector<uint16_t> v;
+	r.read(v);
+	REQUIRE(v == std::vector<uint16_t>{1, 2, 3});
+
+	std::string s;
+	r.read(s);
+	REQUIRE(s == "rng state");
+	REQUIRE(r.read<uint64_t>() == 42);
+}
+
+
+TEST_CASE("reading past the end throws", "[archive]") {
+	Writer w;
+	w.write(std::vector<uint32_t>{1, 2, 3});
+
+	// Cut off in the middle of the vector
+	Reader r{w.data().data(), w.data().size() - 2};
+	std::vector<uint32_t> v;
+	REQUIRE_THROWS(r.read(v));
+
+	Reader empty{nullptr, 0};
+	REQUIRE_THROWS(empty.read<int>());
+}
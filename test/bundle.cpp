@@ -0,0 +1,73 @@
+#include "atlas.h"
+#include "bundle.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+
+
+TEST_CASE("packed rectangles don't overlap and stay on their page", "[bundle]") {
+	std::mt19937 mt{1};
+	std::uniform_int_distribution<int32_t> side(20, 300);
+	std::vector<AtlasSize> sizes;
+	for (int i = 0; i < 100; ++i) {
+		sizes.push_back({side(mt), side(mt)});
+	}
+
+	const AtlasLayout layout = packRows(sizes, 1024, 1);
+	REQUIRE(layout.places.size() == sizes.size());
+	REQUIRE(layout.pages.size() > 1);
+	for (size_t i = 0; i < sizes.size(); ++i) {
+		const auto& a = layout.places[i];
+		REQUIRE(a.page < layout.pages.size());
+		REQUIRE(a.x + sizes[i].width <= layout.pages[a.page].width);
+		REQUIRE(a.y + sizes[i].height <= layout.pages[a.page].height);
+		REQUIRE(layout.pages[a.page].width <= 1024);
+		REQUIRE(layout.pages[a.page].height <= 1024);
+		for (size_t j = 0; j < i; ++j) {
+			const auto& b = layout.places[j];
+			const bool apart = a.page != b.page
+				|| a.x >= b.x + sizes[j].width + 1 || b.x >= a.x + sizes[i].width + 1
+				|| a.y >= b.y + sizes[j].height + 1 || b.y >= a.y + sizes[i].height + 1;
+			REQUIRE(apart);
+		}
+	}
+
+	const AtlasLayout single = packRows(sizes, 0, 1);
+	REQUIRE(single.pages.size() == sizes.size());
+	REQUIRE_THROWS_WITH(packRows({{2000, 10}}, 1024, 1), "2000x10 doesn't fit an atlas of 1024");
+}
+
+
+TEST_CASE("bundles round trip animations and pixels", "[bundle]") {
+	const char* path = "bundle_test.bundle";
+	std::vector<uint32_t> first(4 * 2, 0xff0000ff);
+	std::vector<uint32_t> second(3 * 5, 0xff00ff00);
+	std::vector<bundle::Animation> animations{{"rifle/move", 0, 2}, {"knife/idle", 2, 1}};
+	std::vector<bundle::Frame> frames{{0, 0, 0, 2, 2}, {0, 2, 0, 2, 2}, {1, 0, 0, 3, 5}};
+	bundle::write(path, animations, frames, {{4, 2, first.data()}, {3, 5, second.data()}});
+
+	{
+		const Bundle b{path};
+		REQUIRE(b.getAtlases().size() == 2);
+		const auto move = b.animation("rifle/move");
+		REQUIRE(move.size() == 2);
+		REQUIRE(move[1].x == 2);
+		const auto idle = b.animation("knife/idle");
+		REQUIRE(idle.size() == 1);
+		REQUIRE(idle[0].atlas == 1);
+		REQUIRE_THROWS_WITH(b.animation("shotgun/reload"), "no animation shotgun/reload in the bundle");
+
+		const auto& atlas = b.getAtlases()[1];
+		REQUIRE(atlas.width == 3);
+		REQUIRE(atlas.height == 5);
+		REQUIRE(std::memcmp(b.pixels(atlas), second.data(), second.size() * 4) == 0);
+		REQUIRE(std::memcmp(b.pixels(b.getAtlases()[0]), first.data(), first.size() * 4) == 0);
+	}
+
+	// Cut short in the pixels
+	std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+	REQUIRE_THROWS_WITH(Bundle{path}, "pixels of bundle_test.bundle are cut short");
+	std::remove(path);
+}
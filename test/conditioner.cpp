@@ -0,0 +1,98 @@
+#include "server.h"
+#include <catch2/catch_test_macros.hpp>
+#include <algorithm>
+
+
+using namespace std::chrono_literals;
+
+TEST_CASE("link model is reproducible from its seed", "[conditioner]") {
+	const LinkConditions bad{50ms, 20ms, 0.2f, 0.1f, 0.1f, 64 * 1024};
+	LinkModel a{bad, 7};
+	LinkModel b{bad, 7};
+
+	const auto now = Clock::now();
+	size_t lost = 0;
+	for (int i = 0; i < 1000; ++i) {
+		const auto delays = a.plan(100, now + i * 1ms);
+		REQUIRE(delays == b.plan(100, now + i * 1ms));
+		lost += delays.empty();
+		for (const auto d : delays) {
+			REQUIRE(d >= bad.latency);
+		}
+	}
+
+	REQUIRE(lost > 150);
+	REQUIRE(lost < 250);
+}
+
+
+TEST_CASE("bandwidth cap queues datagrams", "[conditioner]") {
+	LinkModel link{{.bandwidth = 1000}, 1};
+	const auto now = Clock::now();
+
+	// Ten 100 byte datagrams at once take a second to get through
+	Clock::duration last{0};
+	for (int i = 0; i < 10; ++i) {
+		const auto delays = link.plan(100, now);
+		REQUIRE(delays.size() == 1);
+		REQUIRE(delays[0] > last);
+		last = delays[0];
+	}
+	REQUIRE(std::chrono::abs(last - 1s) < 1ms);
+}
+
+
+// Reliable messages have to arrive once and in order in both directions
+// through a lossy, jittery link that also duplicates and reorders
+TEST_CASE("reliable delivery over a bad link", "[conditioner]") {
+	constexpr unsigned short port = 47777;
+	constexpr Channel channel = openChannelStart + 1;
+	constexpr int n = 50;
+
+	const LinkConditions bad{20ms, 10ms, 0.2f, 0.05f, 0.05f, 0};
+	Server server{port, Conditions{bad, bad, 1}};
+	Connection client{udp::endpoint{asio::ip::make_address("127.0.0.1"), port}, Conditions{bad, bad, 2}};
+
+	std::vector<int> atServer;
+	udp::endpoint clientEp;
+	server.listen(channel, [&](const udp::endpoint& ep, char* data, size_t size) {
+		REQUIRE(size == sizeof (int));
+		int i;
+		std::memcpy(&i, data, sizeof i);
+		atServer.push_back(i);
+		clientEp = ep;
+	});
+
+	std::vector<int> atClient;
+	client.listen(channel, [&](char* data, size_t size) {
+		REQUIRE(size == sizeof (int));
+		int i;
+		std::memcpy(&i, data, sizeof i);
+		atClient.push_back(i);
+	});
+
+	for (int i = 0; i < n; ++i) {
+		client.writeReliable(channel, &i, sizeof i);
+	}
+
+	bool sent = false;
+	const auto start = Clock::now();
+	while ((atServer.size() < n || atClient.size() < n) && Clock::now() - start < 20s) {
+		while (server.poll() > 0) {}
+		client.poll();
+
+		if (!sent && !atServer.empty()) {
+			for (int i = 0; i < n; ++i) {
+				server.writeReliable(channel, clientEp, &i, sizeof i);
+			}
+			sent = true;
+		}
+		std::this_thread::sleep_for(1ms);
+	}
+
+	std::vector<int> expected(n);
+	std::iota(expected.begin(), expected.end(), 0);
+	REQUIRE(atServer == expected);
+	REQUIRE(atClient == expected);
+	REQUIRE(client.getStats().resends > 0);
+}
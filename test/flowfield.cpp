@@ -0,0 +1,74 @@
+#include "flowfield.h"
+#include <catch2/catch_test_macros.hpp>
+
+
+// A wall from (-40, -40) to (-30, 40) between the goal and the start
+static World walled() {
+	World w;
+	for (int32_t y = -2; y < 2; ++y) {
+		w.insert({{-2, y}, {{{-40, y * World::chunkSize}, {10, World::chunkSize}}}});
+	}
+	return w;
+}
+
+TEST_CASE("following the field leads around blocks to the goal", "[flowfield]") {
+	World world = walled();
+	FlowField field;
+	const Vec2 goal{-60, 0};
+	REQUIRE(field.prepare(world, &goal, 1));
+	field.build(world);
+
+	REQUIRE(field.distance(goal) == 0);
+	REQUIRE(field.distance({-35, 0}) == FlowField::unreachable);
+
+	Vec2 pos{-10, 0};
+	const uint16_t start = field.distance(pos);
+	REQUIRE(start != FlowField::unreachable);
+	// Straight through the wall it would be 25 cells
+	REQUIRE(start > 40);
+
+	int steps = 0;
+	while (field.distance(pos) != 0 && steps < 1000) {
+		REQUIRE_FALSE(world.blockAt(pos));
+		pos += 0.5f * field.direction(pos);
+		++steps;
+	}
+	REQUIRE(field.distance(pos) == 0);
+}
+
+
+TEST_CASE("the field is only rebuilt when a goal changes cell", "[flowfield]") {
+	World world{World::Params{}};
+	FlowField field;
+	Vec2 goals[2] = {{0.5f, 0.5f}, {20, 20}};
+
+	REQUIRE(field.prepare(world, goals, 2));
+	field.build(world);
+	REQUIRE(field.getBuilds() == 1);
+
+	goals[0] = {1.5f, 1.5f}; // Same cell
+	REQUIRE_FALSE(field.prepare(world, goals, 2));
+	field.build(world);
+	REQUIRE(field.getBuilds() == 1);
+
+	goals[1] = {23, 20};
+	REQUIRE(field.prepare(world, goals, 2));
+	field.build(world);
+	REQUIRE(field.getBuilds() == 2);
+	REQUIRE(field.distance({23, 20}) == 0);
+	REQUIRE(field.distance({20, 20}) != 0);
+}
+
+
+TEST_CASE("outside the field there is no way to go", "[flowfield]") {
+	World world;
+	FlowField field{1, 4};
+	const Vec2 goals[2] = {{0, 0}, {1000, 0}};
+	field.prepare(world, goals, 2);
+	field.build(world);
+
+	// Only four chunks across fit, the middle of the two goals
+	REQUIRE(field.distance({0, 0}) == FlowField::unreachable);
+	REQUIRE(field.direction({0, 0}) == Vec2{0, 0});
+	REQUIRE(field.distance({500, 0}) == FlowField::unreachable);
+}
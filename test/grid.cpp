@@ -0,0 +1,49 @@
+#include "grid.h"
+#include <catch2/catch_test_macros.hpp>
+#include <random>
+
+
+TEST_CASE("grid queries find the points within the radius", "[grid]") {
+	std::mt19937 mt{1};
+	for (float extent : {5.f, 100.f}) {
+		std::uniform_real_distribution<float> dist(-extent, extent);
+		std::vector<Vec2> points(2000);
+		for (auto& p : points) {
+			p = {dist(mt), dist(mt)};
+		}
+
+		SpatialGrid grid{2.f};
+		grid.build(points.data(), points.size());
+
+		for (int q = 0; q < 200; ++q) {
+			const Vec2 pos{dist(mt), dist(mt)};
+			std::vector<uint32_t> found;
+			grid.query(pos, 2.f, [&](uint32_t i) {
+				found.push_back(i);
+				return true;
+			});
+			std::sort(found.begin(), found.end());
+
+			std::vector<uint32_t> expected;
+			for (uint32_t i = 0; i < points.size(); ++i) {
+				if (distanceSquared(pos, points[i]) <= 4.f) {
+					expected.push_back(i);
+				}
+			}
+			REQUIRE(found == expected);
+		}
+	}
+}
+
+
+TEST_CASE("grid queries stop when asked to", "[grid]") {
+	std::vector<Vec2> points(10, Vec2{0.5f, 0.5f});
+	SpatialGrid grid{1.f};
+	grid.build(points.data(), points.size());
+
+	int calls = 0;
+	grid.query({0, 0}, 1.f, [&](uint32_t) {
+		return ++calls < 3;
+	});
+	REQUIRE(calls == 3);
+}
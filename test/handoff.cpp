@@ -0,0 +1,50 @@
+#include "handoff.h"
+#include <catch2/catch_test_macros.hpp>
+#include <thread>
+
+
+TEST_CASE("spsc queue hands over everything in order", "[handoff]") {
+	SpscQueue<std::vector<int>> q{64};
+	constexpr int n = 100000;
+
+	std::thread producer{[&] {
+		for (int i = 0; i < n; ++i) {
+			std::vector<int> v{i, -i};
+			while (!q.push(v)) {
+				std::this_thread::yield();
+			}
+		}
+	}};
+
+	int expected = 0;
+	bool ordered = true;
+	std::vector<int> v;
+	while (expected < n) {
+		if (!q.pop(v)) {
+			std::this_thread::yield();
+			continue;
+		}
+		ordered &= v.size() == 2 && v[0] == expected && v[1] == -expected;
+		++expected;
+	}
+	producer.join();
+
+	REQUIRE(ordered);
+	REQUIRE_FALSE(q.pop(v));
+}
+
+
+TEST_CASE("spsc queue refuses to push when full", "[handoff]") {
+	SpscQueue<int> q{4};
+	for (int i = 0; i < 4; ++i) {
+		REQUIRE(q.push(i));
+	}
+	int v = 4;
+	REQUIRE_FALSE(q.push(v));
+	REQUIRE(v == 4);
+
+	REQUIRE(q.pop(v));
+	REQUIRE(v == 0);
+	REQUIRE(q.push(v));
+}
+
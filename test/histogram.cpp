@@ -0,0 +1,42 @@
+#include "histogram.h"
+#include <catch2/catch_test_macros.hpp>
+
+
+TEST_CASE("small values are exact", "[histogram]") {
+	Histogram h;
+	for (uint64_t i = 1; i <= 50; ++i) {
+		h.record(i);
+	}
+
+	REQUIRE(h.count() == 50);
+	REQUIRE(h.min() == 1);
+	REQUIRE(h.max() == 50);
+	REQUIRE(h.percentile(50) == 25);
+	REQUIRE(h.percentile(100) == 50);
+}
+
+
+TEST_CASE("large values are within bucket precision", "[histogram]") {
+	Histogram h;
+	for (uint64_t i = 1; i <= 100000; ++i) {
+		h.record(i);
+	}
+
+	for (double p : {10.0, 50.0, 90.0, 99.0, 99.9}) {
+		const double expected = p / 100 * 100000;
+		REQUIRE(std::abs(h.percentile(p) - expected) <= expected * 0.04);
+	}
+}
+
+
+TEST_CASE("merged histograms add up", "[histogram]") {
+	Histogram a, b;
+	a.record(10, 3);
+	b.record(1000000);
+	a.merge(b);
+
+	REQUIRE(a.count() == 4);
+	REQUIRE(a.min() == 10);
+	REQUIRE(a.max() == 1000000);
+	REQUIRE(a.percentile(75) == 10);
+}
@@ -0,0 +1,79 @@
+#include "jobs.h"
+#include <catch2/catch_test_macros.hpp>
+#include <numeric>
+#include <stdexcept>
+
+
+TEST_CASE("parallel for covers every index once", "[jobs]") {
+	for (unsigned workers : {0u, 1u, 4u}) {
+		JobSystem jobs{workers};
+		std::vector<std::atomic<int>> seen(10007);
+
+		JobSystem::Counter done;
+		const size_t chunks = jobs.parallelFor(nullptr, done, seen.size(), 64, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				seen[i]++;
+			}
+		});
+		jobs.wait(done);
+
+		REQUIRE(chunks == JobSystem::chunks(seen.size(), 64));
+		for (const auto& n : seen) {
+			REQUIRE(n == 1);
+		}
+	}
+}
+
+
+TEST_CASE("jobs start after what they depend on", "[jobs]") {
+	JobSystem jobs{4};
+	for (int round = 0; round < 100; ++round) {
+		std::vector<int> values(1000);
+		std::atomic<bool> ordered{true};
+
+		JobSystem::Counter filled, doubled, summed;
+		jobs.parallelFor(nullptr, filled, values.size(), 10, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				values[i] = i;
+			}
+		});
+		jobs.parallelFor(&filled, doubled, values.size(), 10, [&](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) {
+				if (values[i] != int(i)) {
+					ordered = false;
+				}
+				values[i] *= 2;
+			}
+		});
+
+		long sum = 0;
+		jobs.run(&doubled, summed, [&] {
+			sum = std::accumulate(values.begin(), values.end(), 0L);
+		});
+		jobs.wait(summed);
+
+		REQUIRE(ordered);
+		REQUIRE(sum == 999 * 1000);
+	}
+}
+
+
+TEST_CASE("wait rethrows what a job threw", "[jobs]") {
+	JobSystem jobs{2};
+	JobSystem::Counter done;
+	std::atomic<int> ran{0};
+	jobs.parallelFor(nullptr, done, 100, 1, [&](size_t chunk, size_t, size_t) {
+		ran++;
+		if (chunk == 50) {
+			throw std::runtime_error("chunk 50");
+		}
+	});
+
+	REQUIRE_THROWS_WITH(jobs.wait(done), "chunk 50");
+	REQUIRE(ran == 100);
+
+	// The error is reported once
+	JobSystem::Counter next;
+	jobs.run(next, [] {});
+	REQUIRE_NOTHROW(jobs.wait(next));
+}
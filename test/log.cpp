@@ -0,0 +1,38 @@
+#include "log.h"
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+
+
+TEST_CASE("ring drops records when full", "[log]") {
+	auto ring = std::make_unique<logging::Ring>();
+	for (size_t i = 0; i < logging::ringSize; ++i) {
+		REQUIRE(ring->claim() != nullptr);
+		ring->commit();
+	}
+
+	REQUIRE(ring->claim() == nullptr);
+	REQUIRE(ring->dropped == 1);
+
+	REQUIRE(ring->front() != nullptr);
+	ring->pop();
+	REQUIRE(ring->claim() != nullptr);
+}
+
+
+TEST_CASE("records format their arguments later", "[log]") {
+	std::string name = "peer";
+	const char* fmt = "%s %d %.1f";
+
+	logging::Record r;
+	r.format = &logging::format<const char*, int, float>;
+	r.fmt = fmt;
+	using Packed = std::tuple<logging::String, int, float>;
+	new (r.args) Packed{logging::Stored<const char*>::store(name.c_str()), 42, 1.5f};
+
+	// The string was copied, changing the original does not matter
+	name = "changed";
+
+	char buf[64];
+	r.format(r, buf, sizeof buf);
+	REQUIRE(std::string(buf) == "peer 42 1.5");
+}
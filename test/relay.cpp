@@ -0,0 +1,143 @@
+#include "relay.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <thread>
+
+
+using namespace std::chrono_literals;
+
+namespace {
+
+std::vector<char> message(proto::ID playerId, const void* payload, size_t n) {
+	const proto::Header h{playerId, n};
+	std::vector<char> data(sizeof h + n);
+	std::memcpy(data.data(), &h, sizeof h);
+	std::memcpy(data.data() + sizeof h, payload, n);
+	return data;
+}
+
+std::vector<char> snapshot(proto::ID followed, proto::Tick tick) {
+	struct {
+		proto::Snapshot snapshot;
+		proto::Player player;
+	} payload{{tick, 1, 0, 0}, {followed}};
+	return message(followed, &payload, sizeof payload);
+}
+
+// A spectator of the relay, counting what it gets
+struct Spectator {
+	Spectator(unsigned short port)
+	: con{udp::endpoint{asio::ip::make_address("127.0.0.1"), port}}
+	{
+		con.listen(proto::updateChannel, [this](char*, size_t) {
+			++snapshots;
+		});
+		con.listen(proto::eventChannel, [this](char* data, size_t n) {
+			proto::Header h;
+			std::memcpy(&h, data, sizeof h);
+			for (size_t i = 0; i < h.payloadSize / sizeof (proto::Event); ++i) {
+				proto::Event e;
+				std::memcpy(&e, data + sizeof h + i * sizeof e, sizeof e);
+				joined.push_back(e.subject);
+			}
+		});
+		con.listen(proto::chunkChannel, [this](char*, size_t) {
+			++chunks;
+		});
+
+		const proto::Spectate spectate{};
+		auto [buf, n] = proto::makeMessage({0, sizeof spectate}, &spectate);
+		con.writeReliable(proto::spectateChannel, buf, n);
+		delete[] buf;
+	}
+
+	Connection con;
+	size_t snapshots{0};
+	size_t chunks{0};
+	std::vector<proto::ID> joined;
+};
+
+// Runs both ends until done returns true or a few seconds pass
+template<typename Done>
+bool pump(Server& server, std::initializer_list<Spectator*> spectators, Done done) {
+	const auto start = Clock::now();
+	while (!done() && Clock::now() - start < 5s) {
+		while (server.poll() > 0) {
+		}
+		for (auto* s : spectators) {
+			s->con.poll();
+		}
+		std::this_thread::sleep_for(1ms);
+	}
+	return done();
+}
+
+}
+
+
+TEST_CASE("relay holds back, fans out and catches up", "[relay]") {
+	constexpr unsigned short port = 47781;
+	constexpr proto::ID followed = 3;
+
+	Server server{port};
+	Relay relay{server, 200ms};
+	server.listen(proto::spectateChannel, [&relay](const udp::endpoint& ep, char*, size_t) {
+		relay.subscribe(ep);
+	});
+
+	Spectator first{port};
+	Spectator second{port};
+	REQUIRE(pump(server, {&first, &second}, [&] { return relay.getSpectators() == 2; }));
+
+	const auto t0 = Clock::now();
+	const proto::Event joins[] = {
+		{proto::Event::Type::Join, followed, 0, {}, 100},
+		{proto::Event::Type::Join, 4, 0, {}, 100},
+	};
+	const auto events = message(followed, joins, sizeof joins);
+	relay.receive(proto::eventChannel, events.data(), events.size(), t0);
+	const proto::ChunkPart part{{0, 0}, 0, 0};
+	const auto chunk = message(followed, &part, sizeof part);
+	relay.receive(proto::chunkChannel, chunk.data(), chunk.size(), t0);
+	const auto update = snapshot(followed, 1);
+	relay.receive(proto::updateChannel, update.data(), update.size(), t0);
+	REQUIRE(relay.getHeld() == 3);
+
+	SECTION("nothing goes out before the delay") {
+		relay.release(t0 + 199ms);
+		REQUIRE(relay.getHeld() == 3);
+		pump(server, {&first, &second}, [] { return false; });
+		REQUIRE(first.snapshots == 0);
+		REQUIRE(first.joined.empty());
+	}
+
+	SECTION("every spectator gets it after the delay") {
+		relay.release(t0 + 200ms);
+		REQUIRE(relay.getHeld() == 0);
+		REQUIRE(relay.getFollowed() == followed);
+		REQUIRE(relay.getChunks() == 1);
+		REQUIRE(pump(server, {&first, &second}, [&] {
+			return first.snapshots == 1 && second.snapshots == 1
+				&& first.joined.size() == 2 && second.joined.size() == 2
+				&& first.chunks == 1 && second.chunks == 1;
+		}));
+	}
+
+	SECTION("a later spectator is caught up on what was sent") {
+		relay.release(t0 + 200ms);
+		Spectator late{port};
+		REQUIRE(pump(server, {&first, &second, &late}, [&] {
+			return late.joined.size() == 2 && late.chunks == 1;
+		}));
+		REQUIRE(late.joined == std::vector<proto::ID>{followed, 4});
+		// Snapshots aren't kept, the next one is what it sees first
+		REQUIRE(late.snapshots == 0);
+
+		const auto next = snapshot(followed, 2);
+		relay.receive(proto::updateChannel, next.data(), next.size(), t0 + 250ms);
+		relay.release(t0 + 450ms);
+		REQUIRE(pump(server, {&first, &second, &late}, [&] {
+			return late.snapshots == 1 && first.snapshots == 2;
+		}));
+	}
+}
@@ -0,0 +1,146 @@
+#include "simulation.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+
+
+namespace {
+
+// FNV-1a over the state the following ticks depend on, field by field so
+// padding doesn't count
+struct Hasher {
+	template<typename T>
+	void add(const T& value) {
+		unsigned char bytes[sizeof value];
+		std::memcpy(bytes, &value, sizeof value);
+		for (const unsigned char b : bytes) {
+			hash = (hash ^ b) * 1099511628211ull;
+		}
+	}
+
+	void add(Vec2 v) {
+		add(v.x);
+		add(v.y);
+	}
+
+	uint64_t hash{14695981039346656037ull};
+};
+
+uint64_t stateHash(const Simulation& sim) {
+	Hasher h;
+	h.add(sim.tick);
+	for (const auto& p : sim.players) {
+		h.add(p.id);
+		h.add(p.pos);
+		h.add(p.velo);
+		h.add(p.target);
+		h.add(p.health);
+		h.add(p.stats.kills);
+		h.add(p.stats.deaths);
+		h.add(p.lastShotAt);
+	}
+	for (const auto& b : sim.bullets) {
+		h.add(b.id);
+		h.add(b.pos);
+		h.add(b.velo);
+		h.add(b.shooterID);
+		h.add(b.expiresAt);
+	}
+	for (const auto& n : sim.npcs) {
+		h.add(n.id);
+		h.add(n.pos);
+		h.add(n.velo);
+		h.add(n.health);
+		h.add(n.attackReadyAt);
+	}
+	for (const auto& e : sim.events) {
+		h.add(e.type);
+		h.add(e.subject);
+		h.add(e.other);
+		h.add(e.health);
+	}
+	const auto state = sim.saveState();
+	h.add(state.nextID);
+	for (const char c : state.rng) {
+		h.add(c);
+	}
+	return h.hash;
+}
+
+constexpr uint32_t seed = 7;
+constexpr int numPlayers = 40;
+constexpr int numBullets = 3000;
+constexpr uint32_t hordeSize = 500;
+
+Simulation makeSimulation() {
+	Simulation sim{60, seed, World{World::Params{seed}}, hordeSize};
+	std::mt19937 mt{seed};
+	std::uniform_real_distribution<float> pos(-100.f, 100.f);
+	std::uniform_real_distribution<float> dir(-1.f, 1.f);
+
+	for (int i = 0; i < numPlayers; ++i) {
+		sim.addPlayer();
+	}
+	for (int i = 0; i < numBullets; ++i) {
+		const Player& p = sim.players[i % numPlayers];
+		const proto::Bullet b{{pos(mt), pos(mt)}, proto::bulletSpeed * unit(Vec2{dir(mt), dir(mt)}), p.id};
+		sim.applyShoot(p.id, {b});
+	}
+	return sim;
+}
+
+// Every player moves, aims and sometimes shoots, the same in every run
+void applyInputs(Simulation& sim, std::mt19937& mt) {
+	std::uniform_real_distribution<float> dir(-1.f, 1.f);
+	std::uniform_int_distribution<int> chance(0, 9);
+	std::vector<proto::ID> ids;
+	for (const auto& p : sim.players) {
+		ids.push_back(p.id);
+	}
+	for (const proto::ID id : ids) {
+		sim.applyMove(id, {{dir(mt), dir(mt)}});
+		const Vec2 pos = sim.findPlayer(id).pos;
+		const Vec2 aim = unit(Vec2{dir(mt), dir(mt)});
+		sim.applyMouseMove(id, {pos + aim});
+		if (chance(mt) == 0) {
+			sim.applyShoot(id, {{pos, proto::bulletSpeed * aim, id}});
+		}
+	}
+}
+
+}
+
+
+// The tick phases run as jobs have to come out the same however many threads
+// run them, or replays and checkpoints would not
+TEST_CASE("simulation on a job system matches running it inline", "[simulation]") {
+	constexpr int ticks = 600;
+
+	JobSystem jobs{4};
+	Simulation serial = makeSimulation();
+	Simulation parallel = makeSimulation();
+	parallel.jobs = &jobs;
+	REQUIRE(stateHash(serial) == stateHash(parallel));
+
+	std::mt19937 inputsA{seed};
+	std::mt19937 inputsB{seed};
+	size_t mostNpcs = 0;
+	for (int i = 0; i < ticks; ++i) {
+		applyInputs(serial, inputsA);
+		applyInputs(parallel, inputsB);
+		serial.step();
+		parallel.step();
+
+		INFO("tick " << serial.tick);
+		REQUIRE(stateHash(serial) == stateHash(parallel));
+
+		mostNpcs = std::max(mostNpcs, serial.npcs.size());
+		serial.events.clear();
+		parallel.events.clear();
+		++serial.tick;
+		++parallel.tick;
+	}
+
+	// Or there was not much to get wrong
+	REQUIRE(mostNpcs > 0);
+	REQUIRE(serial.bullets.size() > 0);
+}
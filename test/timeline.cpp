@@ -0,0 +1,80 @@
+#include "timeline.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+
+TEST_CASE("timeline records zones only while on", "[timeline]") {
+	Timeline timeline;
+	{
+		Timeline::Zone zone{&timeline, "off"};
+	}
+	REQUIRE(timeline.collect().empty());
+
+	timeline.setEnabled(true);
+	{
+		Timeline::Zone outer{&timeline, "outer"};
+		Timeline::Zone inner{&timeline, "inner"};
+	}
+	{
+		Timeline::Zone none{nullptr, "no timeline"};
+	}
+	const auto events = timeline.collect();
+	REQUIRE(events.size() == 2);
+	REQUIRE(std::string{events[0].name} == "outer");
+	REQUIRE(std::string{events[1].name} == "inner");
+	REQUIRE(events[0].begin <= events[1].begin);
+	REQUIRE(events[1].end <= events[0].end);
+
+	// Turning it on again starts over
+	timeline.setEnabled(false);
+	timeline.setEnabled(true);
+	REQUIRE(timeline.collect().empty());
+}
+
+
+TEST_CASE("timeline keeps the latest events of every thread", "[timeline]") {
+	Timeline timeline{256};
+	timeline.setEnabled(true);
+
+	constexpr int n = 10000;
+	auto work = [&](const char* name) {
+		timeline.nameThread(name);
+		for (int i = 0; i < n; ++i) {
+			Timeline::Zone zone{&timeline, name};
+		}
+	};
+	std::thread a{work, "a"};
+	std::thread b{work, "b"};
+
+	// Reading while they record only ever gives whole events
+	bool whole = true;
+	while (timeline.collect().size() < 2 * 200) {
+		for (const auto& e : timeline.collect()) {
+			whole &= e.name && e.begin <= e.end;
+		}
+	}
+	a.join();
+	b.join();
+	REQUIRE(whole);
+
+	const auto events = timeline.collect();
+	REQUIRE(events.size() == 2 * 256);
+	size_t fromA = 0;
+	for (const auto& e : events) {
+		fromA += std::string{e.name} == "a";
+	}
+	REQUIRE(fromA == 256);
+
+	const char* path = "timeline_test.json";
+	REQUIRE(timeline.writeChrome(path) == 2 * 256);
+	std::stringstream json;
+	json << std::ifstream{path}.rdbuf();
+	std::remove(path);
+	REQUIRE(json.str().starts_with("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+	REQUIRE(json.str().find("\"args\":{\"name\":\"a\"}") != std::string::npos);
+	REQUIRE(json.str().find("\"ph\":\"X\"") != std::string::npos);
+	REQUIRE(json.str().ends_with("]}\n"));
+}
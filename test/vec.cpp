@@ -0,0 +1,39 @@
+#include "vec.h"
+#include <catch2/catch_test_macros.hpp>
+#include <random>
+
+
+static_assert(Vec2{1, 2} + Vec2{3, 4} == Vec2{4, 6});
+static_assert(2 * Vec2{1, 2} - Vec2{1, 1} == Vec2{1, 3});
+static_assert(distanceSquared(Vec2{1, 1}, Vec2{4, 5}) == 25);
+
+TEST_CASE("length and unit", "[vec]") {
+	REQUIRE(length(Vec2{3, 4}) == 5);
+	REQUIRE(distance(Vec2{-1, -1}, Vec2{2, 3}) == 5);
+
+	const Vec2 u = unit(Vec2{3, 4});
+	REQUIRE(u.x == 0.6f);
+	REQUIRE(u.y == 0.8f);
+}
+
+
+// The SSE path has to agree with the scalar math exactly, the simulation
+// depends on it being the same wherever it runs
+TEST_CASE("batch distances match the scalar math", "[vec]") {
+	std::mt19937 mt{1};
+	std::uniform_real_distribution<float> dist(-100.f, 100.f);
+
+	for (size_t n : {0, 1, 3, 4, 7, 64}) {
+		std::vector<Vec2> points(n);
+		for (size_t i = 0; i < n; ++i) {
+			points[i] = {dist(mt), dist(mt)};
+		}
+		const Vec2 from{dist(mt), dist(mt)};
+
+		std::vector<float> out(n);
+		distancesSquared(from, points.data(), n, out.data());
+		for (size_t i = 0; i < n; ++i) {
+			REQUIRE(out[i] == distanceSquared(from, points[i]));
+		}
+	}
+}
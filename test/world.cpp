@@ -0,0 +1,181 @@
+#include "world.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+
+static bool inside(const Block& b, const Chunk& c) {
+	const Vec2 o = World::origin(c.coord);
+	return b.pos.x >= o.x && b.pos.y >= o.y
+		&& b.pos.x + b.size.x <= o.x + World::chunkSize && b.pos.y + b.size.y <= o.y + World::chunkSize;
+}
+
+TEST_CASE("chunks are generated from the seed and their coordinate", "[world]") {
+	World a{{.seed = 7, .density = 2.5f}};
+	World b{{.seed = 7, .density = 2.5f}};
+	World other{{.seed = 8, .density = 2.5f}};
+
+	size_t blocks = 0;
+	bool differs = false;
+	for (int32_t x = -20; x < 20; ++x) {
+		for (int32_t y = -20; y < 20; ++y) {
+			const Chunk& ca = a.load({x, y});
+			b.load({-x - 1, -y - 1}); // In another order
+			REQUIRE(ca.coord == ChunkCoord{x, y});
+			for (const auto& block : ca.blocks) {
+				REQUIRE(inside(block, ca));
+			}
+			blocks += ca.blocks.size();
+			const Chunk& co = other.load({x, y});
+			differs |= co.blocks.size() != ca.blocks.size()
+				|| (!ca.blocks.empty() && std::memcmp(&co.blocks[0], &ca.blocks[0], sizeof (Block)) != 0);
+		}
+	}
+
+	for (const auto& [key, chunk] : a.getChunks()) {
+		const Chunk* same = b.find(World::coordOf(key));
+		REQUIRE(same);
+		REQUIRE(same->blocks.size() == chunk.blocks.size());
+		for (size_t i = 0; i < chunk.blocks.size(); ++i) {
+			REQUIRE(std::memcmp(&same->blocks[i], &chunk.blocks[i], sizeof (Block)) == 0);
+		}
+	}
+
+	REQUIRE(differs);
+	REQUIRE(blocks > 1600 * 2.4);
+	REQUIRE(blocks < 1600 * 2.6);
+}
+
+
+TEST_CASE("unused generated chunks are evicted", "[world]") {
+	World w{World::Params{}};
+	w.load({0, 0});
+	w.load({1, 0});
+	w.evictUnused();
+
+	w.load({0, 0});
+	w.evictUnused();
+	REQUIRE(w.find({0, 0}));
+	REQUIRE_FALSE(w.find({1, 0}));
+
+	w.evict({10, 10}, 2);
+	REQUIRE(w.getChunks().empty());
+}
+
+
+TEST_CASE("map blocks are cut at chunk borders", "[world]") {
+	const char* path = "world_test.map";
+	{
+		std::ofstream out{path};
+		out << "# a wall across four chunks\n";
+		out << "-8 -8 16 16\n\n";
+		out << "100 100 4 4  # and a small one\n";
+	}
+
+	World w{[&] {
+		World::Params params;
+		std::strcpy(params.map, path);
+		return params;
+	}()};
+	std::remove(path);
+
+	REQUIRE(w.getChunks().size() == 5);
+	for (const auto& [_, chunk] : w.getChunks()) {
+		REQUIRE(chunk.blocks.size() == 1);
+		REQUIRE(inside(chunk.blocks[0], chunk));
+	}
+	REQUIRE(w.blockAt({-4, -4}));
+	REQUIRE(w.blockAt({4, 4}));
+	REQUIRE(w.blockAt({102, 102}));
+	REQUIRE_FALSE(w.blockAt({9, 0}));
+
+	// Map chunks stay, empty ones made on the way don't
+	w.load({50, 50});
+	w.evictUnused();
+	w.evictUnused();
+	REQUIRE(w.getChunks().size() == 5);
+}
+
+
+TEST_CASE("invalid maps are reported", "[world]") {
+	const char* path = "world_test.map";
+	{
+		std::ofstream out{path};
+		out << "0 0 1 1\n0 0 x 1\n";
+	}
+
+	World::Params params;
+	std::strcpy(params.map, path);
+	REQUIRE_THROWS_WITH(World{params}, "invalid block on line 2 of world_test.map");
+	std::remove(path);
+
+	std::strcpy(params.map, "no_such.map");
+	REQUIRE_THROWS_WITH(World{params}, "unable to open map no_such.map");
+}
+
+
+TEST_CASE("raycasts find the first block on the ray", "[world]") {
+	World w{{.seed = 3, .density = 2.5f}};
+	for (int32_t x = -6; x <= 6; ++x) {
+		for (int32_t y = -6; y <= 6; ++y) {
+			w.load({x, y});
+		}
+	}
+
+	// Nearest entry over every block, and the origin inside none of them
+	auto bruteForce = [&](const Ray& ray) {
+		float nearest = ray.length;
+		for (const auto& [_, chunk] : w.getChunks()) {
+			for (const auto& b : chunk.blocks) {
+				for (float t = 0; t < nearest; t += 0.01f) {
+					const Vec2 p = ray.origin + t * ray.dir;
+					if (p.x > b.pos.x && p.y > b.pos.y && p.x < b.pos.x + b.size.x && p.y < b.pos.y + b.size.y) {
+						nearest = t;
+						break;
+					}
+				}
+			}
+		}
+		return nearest;
+	};
+
+	std::mt19937 mt{1};
+	std::uniform_real_distribution<float> pos(-150.f, 150.f);
+	std::uniform_real_distribution<float> angle(0, 6.2831853f);
+	std::vector<Ray> rays;
+	while (rays.size() < 200) {
+		const Vec2 o{pos(mt), pos(mt)};
+		if (w.blockAt(o)) {
+			continue;
+		}
+		const float a = angle(mt);
+		rays.push_back({o, {std::cos(a), std::sin(a)}, 60.f});
+	}
+	rays.push_back({{-100.5f, -100.5f}, {1, 0}, 200.f}); // Along the axes
+	rays.push_back({{-100.5f, -100.5f}, {0, 1}, 200.f});
+
+	std::vector<RayHit> hits(rays.size());
+	w.raycast(rays.data(), rays.size(), hits.data());
+	for (size_t i = 0; i < rays.size(); ++i) {
+		const RayHit single = w.raycast(rays[i]);
+		REQUIRE(single.block == hits[i].block);
+		REQUIRE(single.distance == hits[i].distance);
+		REQUIRE(std::abs(single.distance - bruteForce(rays[i])) < 0.02f);
+		REQUIRE((single.block != nullptr) == (single.distance < rays[i].length));
+	}
+}
+
+
+TEST_CASE("chunks that are not loaded don't block rays", "[world]") {
+	World w;
+	w.insert({{1, 0}, {{{40, 0}, {10, 10}}}});
+
+	const RayHit hit = w.raycast({{0, 5}, {1, 0}, 100});
+	REQUIRE(hit.block);
+	REQUIRE(hit.distance == 40);
+
+	REQUIRE_FALSE(w.raycast({{0, 5}, {1, 0}, 39}).block);
+	REQUIRE_FALSE(w.raycast({{0, 15}, {1, 0}, 100}).block);
+	REQUIRE_FALSE(w.raycast({{0, 5}, {-1, 0}, 100}).block);
+}